@@ -37,6 +37,59 @@ double proposeDic(double dic, void* info)
    return fabs(p->target - dic - 0.5 * p->dt * term);
 }
 
+double newtonDic
+(
+   proposeDic_info* info,
+   double guess,
+   double min,
+   double max,
+   double tolerance
+)
+{
+   // The residual of the implicit step decreases monotonically
+   // with DIC, with a slope no greater than -1
+   double gwAlpha = info->gwAlpha > 0 ? info->gwAlpha : 0;
+   double dic = fmin(fmax(guess, min), max);
+   double low = min;
+   double high = max;
+   double dicOptim[3];
+   for (int iter = 0; iter < 100; iter++) {
+      info->carbonateEq->optfCO2DerivFromDICTotalAlk(
+         dic * 1e-6,
+         info->alkalinity * 1e-6,
+         1e-5,
+         2,
+         12,
+         dicOptim
+      );
+      double kH = info->carbonateEq->kHenryCO2;
+      double residual =
+         info->target - dic -
+         0.5 * info->dt * (info->kCO2 * kH * dicOptim[1] + gwAlpha * dic);
+      double slope =
+         -1 -
+         0.5 * info->dt * (info->kCO2 * kH * dicOptim[2] * 1e-6 + gwAlpha);
+      if (residual > 0) {
+         low = dic;
+      } else {
+         high = dic;
+      }
+
+      // Newton step, falling back to bisection when the step
+      // leaves the bracket
+      double next = dic - residual / slope;
+      if (!(next > low && next < high)) {
+         next = 0.5 * (low + high);
+      }
+      bool converged = fabs(next - dic) <= tolerance;
+      dic = next;
+      if (converged) {
+         break;
+      }
+   }
+   return dic;
+}
+
 CarbonateEq::CarbonateEq
 (
    double tempC,
@@ -122,6 +175,76 @@ void CarbonateEq::reset
    );
 }
 
+void CarbonateEq::resetArray
+(
+   int length,
+   const double* tempC,
+   const double* eConduct,
+   double* kDissocH2CO3App,
+   double* kDissocHCO3App,
+   double* kDissocH2OApp,
+   double* kHenryCO2,
+   double* activityCoeffH,
+   double* activityCoeffCO3
+)
+{
+   // Same relationships as reset, with the activity coefficients of
+   // OH and HCO3 equal to the coefficient of H, and without the state
+   // reset keeps for the scalar solvers
+   for (int i = 0; i < length; i++) {
+      double tempK = tempC[i] + 273.15;
+      double ionicStrength = 0.013 * eConduct[i];
+      double daviesParam = 0.5092 + (tempC[i] - 25) * 0.00085;
+      double sqrtIonicStrength = sqrt(ionicStrength);
+      double daviesExponent =
+         -daviesParam *
+         (
+            (sqrtIonicStrength / (1 + sqrtIonicStrength)) -
+            0.3 * ionicStrength
+         );
+      double activityH = pow(10, daviesExponent);
+      double activityCO3 = pow(10, 4 * daviesExponent);
+      activityCoeffH[i] = activityH;
+      activityCoeffCO3[i] = activityCO3;
+
+      double logTempK = log(tempK);
+      kDissocH2CO3App[i] =
+         exp(290.9097 - (14554.21 / tempK) - (45.0575 * logTempK)) /
+         (activityH * activityH);
+      kDissocHCO3App[i] =
+         exp(207.6548 - (11843.79 / tempK) - (33.6485 * logTempK)) /
+         (activityH * (activityCO3 / activityH));
+      kDissocH2OApp[i] =
+         exp((-13847.26 / tempK) + 148.9802 - (23.6521 * logTempK)) /
+         (activityH * activityH);
+      kHenryCO2[i] = exp(
+         -60.2409 +
+         (93.4517 * (100 / tempK)) +
+         (23.3585 * log(tempK / 100))
+      );
+   }
+}
+
+void CarbonateEq::copyConstants(const CarbonateEq& source)
+{
+   // Copies only the state set by reset, leaving the solver
+   // configuration of this object unchanged
+   tempC = source.tempC;
+   tempK = source.tempK;
+   eConduct = source.eConduct;
+   ionicStrength = source.ionicStrength;
+   daviesParam = source.daviesParam;
+   daviesExponent = source.daviesExponent;
+   activityCoeffH = source.activityCoeffH;
+   activityCoeffOH = source.activityCoeffOH;
+   activityCoeffHCO3 = source.activityCoeffHCO3;
+   activityCoeffCO3 = source.activityCoeffCO3;
+   kDissocH2CO3App = source.kDissocH2CO3App;
+   kDissocHCO3App = source.kDissocHCO3App;
+   kDissocH2OApp = source.kDissocH2OApp;
+   kHenryCO2 = source.kHenryCO2;
+}
+
 void CarbonateEq::optfCO2FromDICTotalAlk
 (
    double concDIC,
@@ -143,6 +266,64 @@ void CarbonateEq::optfCO2FromDICTotalAlk
    out[0] = pH;
 }
 
+void CarbonateEq::optfCO2DerivFromDICTotalAlk
+(
+   double concDIC,
+   double totalAlk,
+   double pHtolerance,
+   double pHmin,
+   double pHmax,
+   double out[]
+)
+{
+   double pH = optpHFromDICTotalAlk(
+      concDIC,
+      totalAlk,
+      pHtolerance,
+      pHmin,
+      pHmax
+   );
+   double concH = pow(10, -pH);
+
+   // Sensitivity of [H+] to DIC at constant alkalinity
+   double derivAlkConcH;
+   calcTotalAlkFromDICConcH(concDIC, concH, &derivAlkConcH);
+   double denominator =
+      concH * concH +
+      kDissocH2CO3App * concH +
+      kDissocH2CO3App * kDissocHCO3App;
+   double derivAlkDIC =
+      (
+         kDissocH2CO3App * concH +
+         2 * kDissocH2CO3App * kDissocHCO3App
+      ) / denominator;
+   double derivConcHDIC = -derivAlkDIC / derivAlkConcH;
+
+   // Fraction of DIC as CO2 with activity corrections,
+   // and its derivative with respect to [H+]
+   double activityFactor =
+      activityCoeffH * activityCoeffH * activityCoeffCO3;
+   double numeratorCO2 = concH * concH * activityFactor;
+   double denominatorCO2 =
+      numeratorCO2 +
+      kDissocH2CO3App * concH * activityCoeffCO3 +
+      kDissocH2CO3App * kDissocHCO3App;
+   double fractionCO2 = numeratorCO2 / denominatorCO2;
+   double derivFractionConcH =
+      (
+         2 * concH * activityFactor * denominatorCO2 -
+         numeratorCO2 *
+         (2 * concH * activityFactor + kDissocH2CO3App * activityCoeffCO3)
+      ) / (denominatorCO2 * denominatorCO2);
+
+   out[0] = pH;
+   out[1] = 1e6 * concDIC * fractionCO2 / kHenryCO2;
+   out[2] =
+      1e6 *
+      (fractionCO2 + concDIC * derivFractionConcH * derivConcHDIC) /
+      kHenryCO2;
+}
+
 double CarbonateEq::optpHFromDICTotalAlk
 (
    double concDIC,
@@ -152,6 +333,36 @@ double CarbonateEq::optpHFromDICTotalAlk
    double max
 )
 {
+   // Narrow the search to a bracket around the previous solution,
+   // doubling its width on either side until it contains the root
+   if (warmStartWidth > 0 && lastpH > min && lastpH < max) {
+      double width = warmStartWidth;
+      double low = fmax(min, lastpH - width);
+      while (low > min && calcTotalAlkFromDICpH(concDIC, low) > totalAlk) {
+         width *= 2;
+         low = fmax(min, lastpH - width);
+      }
+      width = warmStartWidth;
+      double high = fmin(max, lastpH + width);
+      while (high < max && calcTotalAlkFromDICpH(concDIC, high) < totalAlk) {
+         width *= 2;
+         high = fmin(max, lastpH + width);
+      }
+      min = low;
+      max = high;
+   }
+
+   if (pHSolver == newton) {
+      lastpH = newtonpHFromDICTotalAlk(
+         concDIC,
+         totalAlk,
+         tolerance,
+         min,
+         max
+      );
+      return lastpH;
+   }
+
    proposepH_info info;
    info.carbonateEq = this;
    info.totalAlk = totalAlk;
@@ -165,9 +376,64 @@ double CarbonateEq::optpHFromDICTotalAlk
       tolerance
    );
 
+   lastpH = pH;
    return pH;
 }
 
+double CarbonateEq::newtonpHFromDICTotalAlk
+(
+   double concDIC,
+   double totalAlk,
+   double tolerance,
+   double min,
+   double max
+)
+{
+   // Total alkalinity decreases monotonically with [H+], so the
+   // pH limits provide a bracket on the root of the residual
+   double concHLow = pow(10, -max);
+   double concHHigh = pow(10, -min);
+   double derivative;
+   if (calcTotalAlkFromDICConcH(concDIC, concHLow, &derivative) <= totalAlk) {
+      return max;
+   }
+   if (calcTotalAlkFromDICConcH(concDIC, concHHigh, &derivative) >= totalAlk) {
+      return min;
+   }
+
+   // A change of tolerance in pH corresponds to a relative
+   // change of tolerance * ln(10) in [H+]
+   double relTolerance = tolerance * log(10.0);
+   double concH = sqrt(concHLow * concHHigh);
+   if (warmStartWidth > 0 && lastpH > min && lastpH < max) {
+      concH = pow(10, -lastpH);
+   }
+   for (int iter = 0; iter < 100; iter++) {
+      double residual =
+         calcTotalAlkFromDICConcH(concDIC, concH, &derivative) - totalAlk;
+      if (residual > 0) {
+         concHLow = concH;
+      } else {
+         concHHigh = concH;
+      }
+
+      // Newton step, falling back to bisection in log space
+      // when the step leaves the bracket
+      double concHNext = concH - residual / derivative;
+      if (!(concHNext > concHLow && concHNext < concHHigh)) {
+         concHNext = sqrt(concHLow * concHHigh);
+      }
+      bool converged =
+         fabs(concHNext - concH) <= relTolerance * concHNext;
+      concH = concHNext;
+      if (converged) {
+         break;
+      }
+   }
+
+   return -log10(concH);
+}
+
 double CarbonateEq::calcTotalAlkFromDICpH
 (
    double concDIC,
@@ -193,6 +459,33 @@ double CarbonateEq::calcTotalAlkFromDICpH
    return concHCO3 + 2 * concCO3 + concOH - concH;
 }
 
+double CarbonateEq::calcTotalAlkFromDICConcH
+(
+   double concDIC,
+   double concH,
+   double* derivative
+)
+{
+   double denominator =
+      concH * concH +
+      kDissocH2CO3App * concH +
+      kDissocH2CO3App * kDissocHCO3App;
+   double numerator =
+      kDissocH2CO3App * concH +
+      2 * kDissocH2CO3App * kDissocHCO3App;
+   double concOH = kDissocH2OApp / concH;
+
+   *derivative =
+      concDIC *
+      (
+         kDissocH2CO3App * denominator -
+         numerator * (2 * concH + kDissocH2CO3App)
+      ) / (denominator * denominator) -
+      concOH / concH -
+      1;
+   return concDIC * numerator / denominator + concOH - concH;
+}
+
 double CarbonateEq::calcfCO2FromDICpH
 (
    double concDIC,
@@ -200,14 +493,173 @@ double CarbonateEq::calcfCO2FromDICpH
 )
 {
    double concH = pow(10, -pH);
+   // Activity factors from the Davies exponent (10^(6 * daviesExponent)
+   // and 10^(4 * daviesExponent)) are available from reset
+   double activityFactor =
+      activityCoeffH * activityCoeffH * activityCoeffCO3;
    double concCO2 =
       concDIC *
-      pow(concH, 2) *
-      pow(10, 6 * daviesExponent) /
+      concH * concH *
+      activityFactor /
       (
-         pow(concH, 2) * pow(10, 6 * daviesExponent) +
-         kDissocH2CO3App * concH * pow(10, 4 * daviesExponent) +
+         concH * concH * activityFactor +
+         kDissocH2CO3App * concH * activityCoeffCO3 +
          kDissocH2CO3App * kDissocHCO3App
       );
    return 1e6 * (concCO2 / kHenryCO2);
 }
+
+void CarbonateEq::speciate
+(
+   int length,
+   const double* tempC,
+   const double* eConduct,
+   const double* concDIC,
+   const double* totalAlk,
+   double tolerance,
+   double min,
+   double max,
+   double* pH,
+   double* fCO2,
+   double* concCO2,
+   double* concHCO3,
+   double* concCO3
+)
+{
+   // Local copy so the constants of this object are left unchanged
+   CarbonateEq eq = *this;
+
+   double concHLimitLow = pow(10, -max);
+   double concHLimitHigh = pow(10, -min);
+   double relTolerance = tolerance * log(10.0);
+
+   // Structure of arrays for the lanes of a block
+   double k1[batchLanes];
+   double k2[batchLanes];
+   double kW[batchLanes];
+   double kH[batchLanes];
+   double activityH[batchLanes];
+   double activityCO3[batchLanes];
+   double dic[batchLanes];
+   double alk[batchLanes];
+   double concH[batchLanes];
+   double concHLow[batchLanes];
+   double concHHigh[batchLanes];
+   bool done[batchLanes];
+
+   for (int start = 0; start < length; start += batchLanes) {
+      int lanes = length - start;
+      if (lanes > batchLanes) {
+         lanes = batchLanes;
+      }
+
+      // Equilibrium constants for each lane
+      resetArray(
+         lanes,
+         tempC + start,
+         eConduct + start,
+         k1,
+         k2,
+         kW,
+         kH,
+         activityH,
+         activityCO3
+      );
+      for (int j = 0; j < lanes; j++) {
+         dic[j] = concDIC[start + j];
+         alk[j] = totalAlk[start + j];
+      }
+
+      // Solve for [H+] in each lane
+      if (pHSolver == newton) {
+         double derivative;
+         for (int j = 0; j < lanes; j++) {
+            eq.kDissocH2CO3App = k1[j];
+            eq.kDissocHCO3App = k2[j];
+            eq.kDissocH2OApp = kW[j];
+            concHLow[j] = concHLimitLow;
+            concHHigh[j] = concHLimitHigh;
+            concH[j] = sqrt(concHLimitLow * concHLimitHigh);
+            done[j] = false;
+            if (eq.calcTotalAlkFromDICConcH(dic[j], concHLow[j], &derivative) <= alk[j]) {
+               concH[j] = concHLow[j];
+               done[j] = true;
+            } else if (eq.calcTotalAlkFromDICConcH(dic[j], concHHigh[j], &derivative) >= alk[j]) {
+               concH[j] = concHHigh[j];
+               done[j] = true;
+            }
+         }
+
+         // Lanes take safeguarded Newton steps in lockstep until all
+         // have converged, with converged lanes held fixed
+         for (int iter = 0; iter < 100; iter++) {
+            bool allDone = true;
+            for (int j = 0; j < lanes; j++) {
+               double h = concH[j];
+               double denominator = h * h + k1[j] * h + k1[j] * k2[j];
+               double numerator = k1[j] * h + 2 * k1[j] * k2[j];
+               double concOH = kW[j] / h;
+               double residual =
+                  dic[j] * numerator / denominator + concOH - h - alk[j];
+               double slope =
+                  dic[j] *
+                  (k1[j] * denominator - numerator * (2 * h + k1[j])) /
+                  (denominator * denominator) -
+                  concOH / h -
+                  1;
+               double low = residual > 0 ? h : concHLow[j];
+               double high = residual > 0 ? concHHigh[j] : h;
+               double next = h - residual / slope;
+               next = (next > low && next < high) ? next : sqrt(low * high);
+               bool converged = fabs(next - h) <= relTolerance * next;
+
+               concHLow[j] = done[j] ? concHLow[j] : low;
+               concHHigh[j] = done[j] ? concHHigh[j] : high;
+               concH[j] = done[j] ? h : next;
+               done[j] = done[j] || converged;
+               allDone = allDone && done[j];
+            }
+            if (allDone) {
+               break;
+            }
+         }
+         for (int j = 0; j < lanes; j++) {
+            pH[start + j] = -log10(concH[j]);
+         }
+      } else {
+         for (int j = 0; j < lanes; j++) {
+            eq.kDissocH2CO3App = k1[j];
+            eq.kDissocHCO3App = k2[j];
+            eq.kDissocH2OApp = kW[j];
+            pH[start + j] = eq.optpHFromDICTotalAlk(
+               dic[j],
+               alk[j],
+               tolerance,
+               min,
+               max
+            );
+            concH[j] = pow(10, -pH[start + j]);
+         }
+      }
+
+      // Speciation from the [H+] in each lane
+      for (int j = 0; j < lanes; j++) {
+         double h = concH[j];
+         double denominator = h * h + k1[j] * h + k1[j] * k2[j];
+         concCO2[start + j] = dic[j] * h * h / denominator;
+         concHCO3[start + j] = dic[j] * k1[j] * h / denominator;
+         concCO3[start + j] = dic[j] * k1[j] * k2[j] / denominator;
+
+         double activityFactor = activityH[j] * activityH[j] * activityCO3[j];
+         fCO2[start + j] =
+            1e6 *
+            dic[j] * h * h * activityFactor /
+            (
+               h * h * activityFactor +
+               k1[j] * h * activityCO3[j] +
+               k1[j] * k2[j]
+            ) /
+            kH[j];
+      }
+   }
+}
@@ -79,3 +79,87 @@ SEXP CarbonateEq_optfCO2FromDICTotalAlk(
 
    return ret;
 }
+
+SEXP CarbonateEq_setpHSolver(SEXP externalPointer, SEXP value)
+{
+   CarbonateEq* pointer = (CarbonateEq*)R_ExternalPtrAddr(externalPointer);
+   int solver = asInteger(value);
+   if (solver != CarbonateEq::brent && solver != CarbonateEq::newton) {
+      error("Solver code must be 0 (Brent) or 1 (Newton).");
+   }
+   SEXP out = PROTECT(allocVector(INTSXP, 1));
+   INTEGER(out)[0] = pointer->pHSolver;
+   pointer->pHSolver = (CarbonateEq::Solver)solver;
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP CarbonateEq_setWarmStartWidth(SEXP externalPointer, SEXP value)
+{
+   CarbonateEq* pointer = (CarbonateEq*)R_ExternalPtrAddr(externalPointer);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = pointer->warmStartWidth;
+   pointer->warmStartWidth = asReal(value);
+   pointer->lastpH = -1;
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP CarbonateEq_speciate(
+      SEXP externalPointer,
+      SEXP tempC,
+      SEXP eConduct,
+      SEXP concDIC,
+      SEXP totalAlk,
+      SEXP pHtolerance,
+      SEXP pHmin,
+      SEXP pHmax
+   )
+{
+   CarbonateEq* pointer = (CarbonateEq*)R_ExternalPtrAddr(externalPointer);
+   int length = length(concDIC);
+
+   SEXP pH = PROTECT(allocVector(REALSXP, length));
+   SEXP pCO2 = PROTECT(allocVector(REALSXP, length));
+   SEXP concCO2 = PROTECT(allocVector(REALSXP, length));
+   SEXP concHCO3 = PROTECT(allocVector(REALSXP, length));
+   SEXP concCO3 = PROTECT(allocVector(REALSXP, length));
+
+   pointer->speciate(
+      length,
+      REAL(tempC),
+      REAL(eConduct),
+      REAL(concDIC),
+      REAL(totalAlk),
+      asReal(pHtolerance),
+      asReal(pHmin),
+      asReal(pHmax),
+      REAL(pH),
+      REAL(pCO2),
+      REAL(concCO2),
+      REAL(concHCO3),
+      REAL(concCO3)
+   );
+
+   SEXP ret = PROTECT(allocVector(VECSXP, 5));
+   SET_VECTOR_ELT(ret, 0, pH);
+   SET_VECTOR_ELT(ret, 1, pCO2);
+   SET_VECTOR_ELT(ret, 2, concCO2);
+   SET_VECTOR_ELT(ret, 3, concHCO3);
+   SET_VECTOR_ELT(ret, 4, concCO3);
+
+   SEXP ret_names = PROTECT(allocVector(VECSXP, 5));
+   SET_VECTOR_ELT(ret_names, 0, install("pH"));
+   SET_VECTOR_ELT(ret_names, 1, install("pCO2"));
+   SET_VECTOR_ELT(ret_names, 2, install("concCO2"));
+   SET_VECTOR_ELT(ret_names, 3, install("concHCO3"));
+   SET_VECTOR_ELT(ret_names, 4, install("concCO3"));
+
+   setAttrib(ret, install("names"), ret_names);
+
+   UNPROTECT(7);
+
+   return ret;
+}
@@ -1,5 +1,6 @@
 #include "metabc.h"
 #include <cmath>
+#include <cstring>
 
 Metab::Metab()
 {
@@ -10,11 +11,7 @@ Metab::Metab()
 }
 
 Metab::~Metab()
-{
-   delete[] output_.cFixation;
-   delete[] output_.cRespiration;
-   delete[] gwAlpha_;
-}
+{}
 
 void Metab::initialize
 (
@@ -25,14 +22,17 @@ void Metab::initialize
    double* gwAlpha
 )
 {
-   output_.cFixation = new double[length];
-   output_.cRespiration = new double[length];
+   // Arrays of the model and its subclasses share one block of memory,
+   // which is reused if the model is initialized again
+   arena_.reset(arenaArrays(), length);
+
+   length_ = length;
+
+   output_.cFixation = arena_.allocate(length);
+   output_.cRespiration = arena_.allocate(length);
 
    if (gwAlpha) {
-      gwAlpha_ = new double[length];
-      for(int i = 0; i < length; i++) {
-         gwAlpha_[i] = gwAlpha[i];
-      }
+      gwAlpha_ = storeInput(gwAlpha);
    } else {
       gwAlpha_ = nullptr;
    }
@@ -40,7 +40,19 @@ void Metab::initialize
    dailyGPP_ = dailyGPP;
    dailyER_ = dailyER;
    k600_ = k600;
-   length_ = length;
+}
+
+double* Metab::storeInput(double* values)
+{
+   if (borrowInputs_) {
+      return values;
+   }
+
+   double* array = arena_.allocate(length_);
+   for(int i = 0; i < length_; i++) {
+      array[i] = values[i];
+   }
+   return array;
 }
 
 void Metab::setPARDistCalculator(ParDistCalculator calculator)
@@ -72,3 +84,217 @@ void Metab::setkSchmidtDoCalculator
    kSchmidtDoCalculator_ = function;
 }
 
+void Metab::copySettings(Metab* model)
+{
+   parDistCalculator_ = model->parDistCalculator_;
+   densityCalculator_ = model->densityCalculator_;
+   satDoCalculator_ = model->satDoCalculator_;
+   kSchmidtDoCalculator_ = model->kSchmidtDoCalculator_;
+   calcSensitivity_ = model->calcSensitivity_;
+   predictionsOnly_ = model->predictionsOnly_;
+   scanThreads_ = model->scanThreads_;
+   parcelThreads_ = model->parcelThreads_;
+   objective_ = model->objective_;
+}
+
+int Metab::arenaArrays()
+{
+   return 3;
+}
+
+double* Metab::getOutputVariable(const char* name)
+{
+   double** slot = getOutputSlot(name);
+   return slot ? *slot : nullptr;
+}
+
+double** Metab::getOutputSlot(const char* name)
+{
+   if (!strcmp(name, "cFixation")) return &output_.cFixation;
+   if (!strcmp(name, "cRespiration")) return &output_.cRespiration;
+   return nullptr;
+}
+
+Metab_OutputKind Metab::getOutputKind(const char*)
+{
+   return outputDiagnostic;
+}
+
+MetabDo_Sensitivity* Metab::getDoSensitivity()
+{
+   return nullptr;
+}
+
+double Metab::calcDoSSEGradient(const double* obsDO, double* gradient)
+{
+   MetabDo_Sensitivity* sensitivity = getDoSensitivity();
+   double* dox = getOutputVariable("dox");
+   if (!sensitivity || !dox) {
+      return NAN;
+   }
+
+   double sse = 0;
+   gradient[0] = 0;
+   gradient[1] = 0;
+   gradient[2] = 0;
+   for(int i = 0; i < length_; i++) {
+      if (std::isnan(obsDO[i])) {
+         continue;
+      }
+      double residual = obsDO[i] - dox[i];
+      sse += residual * residual;
+      gradient[0] -= 2 * residual * sensitivity->dailyGPP[i];
+      gradient[1] -= 2 * residual * sensitivity->dailyER[i];
+      gradient[2] -= 2 * residual * sensitivity->k600[i];
+   }
+   return sse;
+}
+
+double Metab::runObjective(double* components)
+{
+   run();
+   return objective_.calc(this, components);
+}
+
+//! Model and parameter settings passed through the minimizers
+struct MetabOptim_Info {
+   Metab* model;
+   const bool* estimate;
+   const double* lower;
+   const double* upper;
+   double par[3];
+   bool doGradient;
+   int evaluations;
+};
+
+//! Sets the model parameters from the values of the estimated parameters
+static void setOptimParameters(MetabOptim_Info* optim, const double* x)
+{
+   for(int p = 0, k = 0; p < 3; p++) {
+      if (optim->estimate[p]) optim->par[p] = x[k++];
+   }
+   optim->model->dailyGPP_ = optim->par[0];
+   optim->model->dailyER_ = optim->par[1];
+   optim->model->k600_ = optim->par[2];
+}
+
+//! Objective function of the estimated parameters used by the minimizers
+static double optimObjective(const double* x, double* gradient, void* info)
+{
+   MetabOptim_Info* optim = (MetabOptim_Info*)info;
+   Metab* model = optim->model;
+
+   if (gradient && optim->doGradient) {
+      setOptimParameters(optim, x);
+      model->calcSensitivity_ = true;
+      double value = model->runObjective();
+      model->calcSensitivity_ = false;
+      optim->evaluations++;
+
+      double fullGradient[3];
+      model->objective_.calcDoGradient(model, fullGradient);
+      for(int p = 0, k = 0; p < 3; p++) {
+         if (optim->estimate[p]) gradient[k++] = fullGradient[p];
+      }
+      return value;
+   }
+
+   if (gradient) {
+      // Central differences, kept inside the bounds
+      double xk[3];
+      int n = 0;
+      for(int p = 0; p < 3; p++) {
+         if (optim->estimate[p]) {
+            xk[n] = x[n];
+            n++;
+         }
+      }
+      for(int p = 0, k = 0; p < 3; p++) {
+         if (!optim->estimate[p]) continue;
+         double h = 1e-5 * fmax(fabs(x[k]), 1);
+         double xPlus = fmin(x[k] + h, optim->upper[p]);
+         double xMinus = fmax(x[k] - h, optim->lower[p]);
+         if (!(xPlus > xMinus)) {
+            // Equal bounds leave no room for a difference, and the
+            // parameter cannot move anyway
+            gradient[k] = 0;
+            k++;
+            continue;
+         }
+         xk[k] = xPlus;
+         setOptimParameters(optim, xk);
+         double valuePlus = model->runObjective();
+         xk[k] = xMinus;
+         setOptimParameters(optim, xk);
+         double valueMinus = model->runObjective();
+         xk[k] = x[k];
+         optim->evaluations += 2;
+         gradient[k] = (valuePlus - valueMinus) / (xPlus - xMinus);
+         k++;
+      }
+   }
+
+   setOptimParameters(optim, x);
+   optim->evaluations++;
+   return model->runObjective();
+}
+
+MetabOptim_Result Metab::optimize
+(
+   int method,
+   const double* start,
+   const bool* estimate,
+   const double* lower,
+   const double* upper,
+   double reltol,
+   int maxit
+)
+{
+   MetabOptim_Info optim;
+   optim.model = this;
+   optim.estimate = estimate;
+   optim.lower = lower;
+   optim.upper = upper;
+   optim.doGradient = objective_.hasDoGradient(this);
+   optim.evaluations = 0;
+
+   // Pack the estimated parameters and their bounds
+   double x[3];
+   double xLower[3];
+   double xUpper[3];
+   int n = 0;
+   for(int p = 0; p < 3; p++) {
+      optim.par[p] = start[p];
+      if (estimate[p]) {
+         x[n] = start[p];
+         xLower[n] = lower[p];
+         xUpper[n] = upper[p];
+         n++;
+      }
+   }
+
+   bool calcSensitivity = calcSensitivity_;
+   calcSensitivity_ = false;
+
+   MetabOptim_Result result;
+   result.convergence = optimConverged;
+   if (n > 0) {
+      if (method == optimBFGSB) {
+         BFGSB_fmin(n, x, xLower, xUpper, optimObjective, &optim,
+            reltol, maxit, &result.convergence);
+      } else {
+         NelderMead_fmin(n, x, xLower, xUpper, optimObjective, &optim,
+            reltol, maxit, &result.convergence);
+      }
+   }
+
+   // Leave the model with the output at the estimates
+   calcSensitivity_ = calcSensitivity;
+   setOptimParameters(&optim, x);
+   result.value = runObjective();
+   for(int p = 0; p < 3; p++) {
+      result.par[p] = optim.par[p];
+   }
+   result.evaluations = optim.evaluations;
+   return result;
+}
@@ -3,82 +3,305 @@
 
 void MetabCrankNicolsonDo::run()
 {
-   // Set the initial oxygen concentration
-   outputDo_.dox[0] = initialDO_;
-
-   // Calculate effects on effective organic carbon
-   parDist_[0] = parDistCalculator_.calc(
-      dt_[0],
-      parAvg_[0]
-   );
-   output_.cFixation[0] = dailyGPP_ * parDist_[0];
-   output_.cRespiration[0] = dailyER_ * dt_[0];
-
-   outputDo_.doProduction[0] =
-      output_.cFixation[0] * ratioDoCFix_;
-   outputDo_.doConsumption[0] =
-      output_.cRespiration[0] * ratioDoCResp_;
-
-   kDo_[0] = kSchmidtDoCalculator_(temp_[0], k600_);
-   kDo_[1] = kSchmidtDoCalculator_(temp_[1], k600_);
-   double avgkDO = 0.5 * (kDo_[0] + kDo_[1]);
-   outputDo_.doEquilibration[0] =
-      dt_[0] *
-      avgkDO *
-      0.5 * (satDo_[0] - outputDo_.dox[0] + satDo_[1]);
-
-   // Loop through time steps
+   if (predictionsOnly_) {
+      selectSteps<false>();
+   } else {
+      selectSteps<true>();
+   }
+}
+
+template <bool diagnostics>
+void MetabCrankNicolsonDo::selectSteps()
+{
+   if (scanThreads_ != 1) {
+      if (calcSensitivity_) {
+         scanSteps<true, diagnostics>();
+      } else {
+         scanSteps<false, diagnostics>();
+      }
+   } else {
+      if (calcSensitivity_) {
+         runSteps<true, diagnostics>();
+      } else {
+         runSteps<false, diagnostics>();
+      }
+   }
+}
+
+template <bool sensitivity, bool diagnostics>
+void MetabCrankNicolsonDo::runSteps()
+{
+   // Local copies of the parameters and arrays let the compiler
+   // keep them in registers, as the output arrays could otherwise
+   // alias the attributes of the object
+   const double dailyGPP = dailyGPP_;
+   const double dailyER = dailyER_;
+   const double k600 = k600_;
+   const double ratioDoCFix = ratioDoCFix_;
+   const double ratioDoCResp = ratioDoCResp_;
+   const double* dt = dt_;
+   const double* parDist = parDist_;
+   const double* satDo = satDo_;
+   const double* kDoSchmidt = kDoSchmidt_;
+   double* cFixation = output_.cFixation;
+   double* cRespiration = output_.cRespiration;
+   double* doProduction = outputDo_.doProduction;
+   double* doConsumption = outputDo_.doConsumption;
+   double* doEquilibration = outputDo_.doEquilibration;
+   double* kDo = kDo_;
+   double* dox = outputDo_.dox;
    int lastIndex = length_ - 1;
-   for (int i = 1; i < lastIndex; i++) {
-      long prevIndex = i - 1;
-      outputDo_.dox[i] =
+
+   // Set the initial oxygen concentration
+   dox[0] = initialDO_;
+   double lastk = k600 * kDoSchmidt[0];
+   if (diagnostics) {
+      kDo[0] = lastk;
+   }
+   if (sensitivity) {
+      sensitivityDo_.dailyGPP[0] = 0;
+      sensitivityDo_.dailyER[0] = 0;
+      sensitivityDo_.k600[0] = 0;
+   }
+
+   // Loop through time steps, calculating the fluxes over each
+   // time step and the resulting DO concentration at its end.
+   // The PAR distribution and the temperature dependence of gas
+   // exchange are calculated once by initialize(). Fluxes are only
+   // stored when the diagnostic output is requested.
+   for (int i = 0; i < lastIndex; i++) {
+      double fixation = dailyGPP * parDist[i];
+      double respiration = dailyER * dt[i];
+
+      double production = fixation * ratioDoCFix;
+      double consumption = respiration * ratioDoCResp;
+
+      double nextk = k600 * kDoSchmidt[i + 1];
+      double avgkDO = 0.5 * (lastk + nextk);
+      double equilibration =
+         dt[i] *
+         avgkDO *
+         0.5 * (satDo[i] - dox[i] + satDo[i + 1]);
+      lastk = nextk;
+
+      if (diagnostics) {
+         cFixation[i] = fixation;
+         cRespiration[i] = respiration;
+         doProduction[i] = production;
+         doConsumption[i] = consumption;
+         kDo[i + 1] = nextk;
+         doEquilibration[i] = equilibration;
+      }
+
+      dox[i + 1] =
          (
-            outputDo_.dox[prevIndex] +
-            outputDo_.doProduction[prevIndex] +
-            outputDo_.doConsumption[prevIndex] +
-            outputDo_.doEquilibration[prevIndex]
+            dox[i] +
+            production +
+            consumption +
+            equilibration
          ) /
          (
-            1 + (0.5 * (dt_[prevIndex] * avgkDO))
+            1 + (0.5 * (dt[i] * avgkDO))
          );
 
+      // Propagate the derivatives of DO with respect to the parameters
+      if (sensitivity) {
+         double denominator = 1 + (0.5 * (dt[i] * avgkDO));
+         double retention = 1 - (0.5 * (dt[i] * avgkDO));
+         double avgkDOSchmidt = 0.5 * (kDoSchmidt[i] + kDoSchmidt[i + 1]);
+         sensitivityDo_.dailyGPP[i + 1] =
+            (
+               sensitivityDo_.dailyGPP[i] * retention +
+               parDist[i] * ratioDoCFix
+            ) / denominator;
+         sensitivityDo_.dailyER[i + 1] =
+            (
+               sensitivityDo_.dailyER[i] * retention +
+               dt[i] * ratioDoCResp
+            ) / denominator;
+         sensitivityDo_.k600[i + 1] =
+            (
+               sensitivityDo_.k600[i] * retention +
+               dt[i] * avgkDOSchmidt * 0.5 * (
+                  satDo[i] - dox[i] + satDo[i + 1] -
+                  dox[i + 1]
+               )
+            ) / denominator;
+      }
+   }
+
+   if (diagnostics) {
+      cFixation[lastIndex] = 0;
+      cRespiration[lastIndex] = 0;
+
+      doProduction[lastIndex] = 0;
+      doConsumption[lastIndex] = 0;
+      doEquilibration[lastIndex] = 0;
+   }
+}
+
+template <bool sensitivity, bool diagnostics>
+void MetabCrankNicolsonDo::scanSteps()
+{
+   const double dailyGPP = dailyGPP_;
+   const double dailyER = dailyER_;
+   const double k600 = k600_;
+   const double ratioDoCFix = ratioDoCFix_;
+   const double ratioDoCResp = ratioDoCResp_;
+   const double* dt = dt_;
+   const double* parDist = parDist_;
+   const double* satDo = satDo_;
+   const double* kDoSchmidt = kDoSchmidt_;
+   double* retention = scanRetention_;
+   double* dox = outputDo_.dox;
+   int lastIndex = length_ - 1;
+
+   // The DO concentration at the end of each time step is the retained
+   // fraction of the DO at its start plus the input over the step. The
+   // inputs are stored in dox until the scan replaces them with the
+   // concentrations. Without a dependence between time steps, the loop
+   // can be vectorized.
+   dox[0] = initialDO_;
+   for (int i = 0; i < lastIndex; i++) {
+      double avgkDO =
+         k600 * 0.5 * (kDoSchmidt[i] + kDoSchmidt[i + 1]);
+      double denominator = 1 + (0.5 * (dt[i] * avgkDO));
+      retention[i] = (1 - (0.5 * (dt[i] * avgkDO))) / denominator;
+      dox[i + 1] =
+         (
+            dailyGPP * parDist[i] * ratioDoCFix +
+            dailyER * dt[i] * ratioDoCResp +
+            dt[i] * avgkDO * 0.5 * (satDo[i] + satDo[i + 1])
+         ) / denominator;
+   }
+   linearScan(scanThreads_, length_, retention, dox);
+
+   if (diagnostics) {
+      double* cFixation = output_.cFixation;
+      double* cRespiration = output_.cRespiration;
+      double* doProduction = outputDo_.doProduction;
+      double* doConsumption = outputDo_.doConsumption;
+      double* doEquilibration = outputDo_.doEquilibration;
+      double* kDo = kDo_;
+      kDo[0] = k600 * kDoSchmidt[0];
+      for (int i = 0; i < lastIndex; i++) {
+         double avgkDO =
+            k600 * 0.5 * (kDoSchmidt[i] + kDoSchmidt[i + 1]);
+         cFixation[i] = dailyGPP * parDist[i];
+         cRespiration[i] = dailyER * dt[i];
+         doProduction[i] = cFixation[i] * ratioDoCFix;
+         doConsumption[i] = cRespiration[i] * ratioDoCResp;
+         kDo[i + 1] = k600 * kDoSchmidt[i + 1];
+         doEquilibration[i] =
+            dt[i] *
+            avgkDO *
+            0.5 * (satDo[i] - dox[i] + satDo[i + 1]);
+      }
+
+      cFixation[lastIndex] = 0;
+      cRespiration[lastIndex] = 0;
+
+      doProduction[lastIndex] = 0;
+      doConsumption[lastIndex] = 0;
+      doEquilibration[lastIndex] = 0;
+   }
+
+   // The sensitivities follow recurrences with the same retention
+   if (sensitivity) {
+      sensitivityDo_.dailyGPP[0] = 0;
+      sensitivityDo_.dailyER[0] = 0;
+      sensitivityDo_.k600[0] = 0;
+      for (int i = 0; i < lastIndex; i++) {
+         double avgkDOSchmidt = 0.5 * (kDoSchmidt[i] + kDoSchmidt[i + 1]);
+         double denominator = 1 + (0.5 * (dt[i] * k600 * avgkDOSchmidt));
+         sensitivityDo_.dailyGPP[i + 1] =
+            parDist[i] * ratioDoCFix / denominator;
+         sensitivityDo_.dailyER[i + 1] =
+            dt[i] * ratioDoCResp / denominator;
+         sensitivityDo_.k600[i + 1] =
+            dt[i] * avgkDOSchmidt * 0.5 * (
+               satDo[i] - dox[i] + satDo[i + 1] -
+               dox[i + 1]
+            ) / denominator;
+      }
+      linearScan(scanThreads_, length_, retention, sensitivityDo_.dailyGPP);
+      linearScan(scanThreads_, length_, retention, sensitivityDo_.dailyER);
+      linearScan(scanThreads_, length_, retention, sensitivityDo_.k600);
+   }
+}
+
+void MetabCrankNicolsonDo::calcParDist()
+{
+   int lastIndex = length_ - 1;
+   for(int i = 0; i < lastIndex; i++) {
       parDist_[i] = parDistCalculator_.calc(
          dt_[i],
          parAvg_[i]
       );
-      output_.cFixation[i] = dailyGPP_ * parDist_[i];
-      output_.cRespiration[i] = dailyER_ * dt_[i];
-
-      outputDo_.doProduction[i] =
-         output_.cFixation[i] * ratioDoCFix_;
-      outputDo_.doConsumption[i] =
-         output_.cRespiration[i] * ratioDoCResp_;
-
-      kDo_[i + 1] = kSchmidtDoCalculator_(temp_[i + 1], k600_);
-      avgkDO = 0.5 * (kDo_[i] + kDo_[i + 1]);
-      outputDo_.doEquilibration[i] =
-         dt_[i] *
-         avgkDO *
-         0.5 * (satDo_[i] - outputDo_.dox[i] + satDo_[i + 1]);
    }
+   parDist_[lastIndex] = 0;
+}
 
-   long prevLastIndex = lastIndex - 1;
-   outputDo_.dox[lastIndex] =
-      (
-         outputDo_.dox[prevLastIndex] +
-         outputDo_.doProduction[prevLastIndex] +
-         outputDo_.doConsumption[prevLastIndex] +
-         outputDo_.doEquilibration[prevLastIndex]
-      ) /
-      (
-         1 + (0.5 * (dt_[prevLastIndex] * avgkDO))
-      );
+void MetabCrankNicolsonDo::runBatch
+(
+   int numSets,
+   const double* dailyGPP,
+   const double* dailyER,
+   const double* k600,
+   const double* ratioDoCFix,
+   const double* ratioDoCResp,
+   double* dox
+)
+{
+   int lastIndex = length_ - 1;
+   for(int first = 0; first < numSets; first += batchLanes) {
+      int numLanes = numSets - first < batchLanes ?
+         numSets - first : batchLanes;
 
-   parDist_[lastIndex] = 0;
-   output_.cFixation[lastIndex] = 0;
-   output_.cRespiration[lastIndex] = 0;
+      // Unused lanes repeat the first set of the block so the
+      // lanes can be advanced without branches
+      double gpp[batchLanes];
+      double er[batchLanes];
+      double k[batchLanes];
+      double ratioFix[batchLanes];
+      double ratioResp[batchLanes];
+      double x[batchLanes];
+      for(int lane = 0; lane < batchLanes; lane++) {
+         int set = first + (lane < numLanes ? lane : 0);
+         gpp[lane] = dailyGPP[set];
+         er[lane] = dailyER[set];
+         k[lane] = k600[set];
+         ratioFix[lane] = ratioDoCFix ? ratioDoCFix[set] : ratioDoCFix_;
+         ratioResp[lane] = ratioDoCResp ? ratioDoCResp[set] : ratioDoCResp_;
+         x[lane] = initialDO_;
+      }
+
+      double* blockDox = dox + (long)first * length_;
+      for(int i = 0; i < lastIndex; i++) {
+         for(int lane = 0; lane < numLanes; lane++) {
+            blockDox[(long)lane * length_ + i] = x[lane];
+         }
+         for(int lane = 0; lane < batchLanes; lane++) {
+            double production = gpp[lane] * parDist_[i] * ratioFix[lane];
+            double consumption = er[lane] * dt_[i] * ratioResp[lane];
+            double avgkDO = 0.5 *
+               (k[lane] * kDoSchmidt_[i] + k[lane] * kDoSchmidt_[i + 1]);
+            double equilibration =
+               dt_[i] * avgkDO * 0.5 * (satDo_[i] - x[lane] + satDo_[i + 1]);
+            x[lane] =
+               (x[lane] + production + consumption + equilibration) /
+               (1 + (0.5 * (dt_[i] * avgkDO)));
+         }
+      }
+      for(int lane = 0; lane < numLanes; lane++) {
+         blockDox[(long)lane * length_ + lastIndex] = x[lane];
+      }
+   }
+}
 
-   outputDo_.doProduction[lastIndex] = 0;
-   outputDo_.doConsumption[lastIndex] = 0;
-   outputDo_.doEquilibration[lastIndex] = 0;
+Metab* MetabCrankNicolsonDo::clone()
+{
+   MetabCrankNicolsonDo* model = new MetabCrankNicolsonDo();
+   model->initializeCopy(this);
+   return model;
 }
@@ -6,9 +6,15 @@ void MetabCrankNicolsonDoDic::run()
    // Run the base class DO model
    MetabCrankNicolsonDo::run();
 
-   // Set the first elements for henry's coefficient and DIC
-   carbonateEq_.reset(temp_[0], 0);
-   kH_[0] = carbonateEq_.kHenryCO2;
+   // Fluxes of DIC are carried between time steps in local variables,
+   // and only stored when the diagnostic output is requested. Carbon
+   // fixation and respiration are recalculated from the parameters
+   // because the DO model may not have stored them.
+   bool diagnostics = !predictionsOnly_;
+
+   // Set the first elements for carbonate constants and DIC
+   carbonateEq_.copyConstants(carbonateConstants_[0]);
+   carbonateEq_.lastpH = -1;
 
    outputDic_.dic[0] = initialDIC_;
 
@@ -27,26 +33,31 @@ void MetabCrankNicolsonDoDic::run()
 
    double lastCO2Deficit =
       kH_[0] * (pCO2air_[0] - outputDic_.pCO2[0]);
-   carbonateEq_.reset(temp_[1], 0);
-   double nextCO2Sat = carbonateEq_.kHenryCO2 * pCO2air_[1];
+   double nextCO2Sat = kH_[1] * pCO2air_[1];
 
    // Calculate initial dic inputs and outputs
-   outputDic_.dicProduction[0] =
-      output_.cRespiration[0] * ratioDicCResp_;
-   outputDic_.dicConsumption[0] =
-      output_.cFixation[0] * ratioDicCFix_;
-
-   kCO2_[0] = kSchmidtCO2Calculator_(temp_[0], k600_);
-   kCO2_[1] = kSchmidtCO2Calculator_(temp_[1], k600_);
-   double avgkCO2 = 0.5 * (kCO2_[0] + kCO2_[1]);
-   outputDic_.co2Equilibration[0] =
+   double production = dailyER_ * dt_[0] * ratioDicCResp_;
+   double consumption = dailyGPP_ * parDist_[0] * ratioDicCFix_;
+
+   double lastk = k600_ * kCO2Schmidt_[0];
+   double nextk = k600_ * kCO2Schmidt_[1];
+   double avgkCO2 = 0.5 * (lastk + nextk);
+   double equilibration =
       dt_[0] *
       avgkCO2 *
       0.5 * (lastCO2Deficit + nextCO2Sat);
+   if (diagnostics) {
+      outputDic_.dicProduction[0] = production;
+      outputDic_.dicConsumption[0] = consumption;
+      kCO2_[0] = lastk;
+      kCO2_[1] = nextk;
+      outputDic_.co2Equilibration[0] = equilibration;
+   }
+   lastk = nextk;
 
    int lastIndex = length_ - 1;
    for(int i = 1; i < lastIndex; i++) {
-      kH_[i] = carbonateEq_.kHenryCO2;
+      carbonateEq_.copyConstants(carbonateConstants_[i]);
 
       long prevIndex = i - 1;
       proposeDic_info info;
@@ -54,19 +65,32 @@ void MetabCrankNicolsonDoDic::run()
       info.alkalinity = alkalinity_[i];
       info.kCO2 = avgkCO2;
       info.dt = dt_[prevIndex];
+      info.gwAlpha = -1;
       info.target =
          outputDic_.dic[prevIndex] +
-         outputDic_.dicProduction[prevIndex] +
-         outputDic_.dicConsumption[prevIndex] +
-         outputDic_.co2Equilibration[prevIndex];
-
-      outputDic_.dic[i] = Brent_fmin(
-         minDIC,
-         maxDIC,
-         proposeDic,
-         &info,
-         tolerance
-      );
+         production +
+         consumption +
+         equilibration;
+
+      if (dicSolver_ == CarbonateEq::newton) {
+         // Seed from an explicit predictor using the previous pCO2
+         outputDic_.dic[i] = newtonDic(
+            &info,
+            info.target -
+               0.5 * info.dt * avgkCO2 * kH_[i] * outputDic_.pCO2[prevIndex],
+            minDIC,
+            maxDIC,
+            tolerance
+         );
+      } else {
+         outputDic_.dic[i] = Brent_fmin(
+            minDIC,
+            maxDIC,
+            proposeDic,
+            &info,
+            tolerance
+         );
+      }
 
       carbonateEq_.optfCO2FromDICTotalAlk(
          outputDic_.dic[i] * 1e-6,
@@ -81,23 +105,27 @@ void MetabCrankNicolsonDoDic::run()
 
       lastCO2Deficit =
          kH_[i] * (pCO2air_[i] - outputDic_.pCO2[i]);
-      carbonateEq_.reset(temp_[i + 1], 0);
-      nextCO2Sat = carbonateEq_.kHenryCO2 * pCO2air_[i + 1];
+      nextCO2Sat = kH_[i + 1] * pCO2air_[i + 1];
 
-      outputDic_.dicProduction[i] =
-         output_.cRespiration[i] * ratioDicCResp_;
-      outputDic_.dicConsumption[i] =
-         output_.cFixation[i] * ratioDicCFix_;
+      production = dailyER_ * dt_[i] * ratioDicCResp_;
+      consumption = dailyGPP_ * parDist_[i] * ratioDicCFix_;
 
-      kCO2_[i + 1] = kSchmidtCO2Calculator_(temp_[i + 1], k600_);
-      avgkCO2 = 0.5 * (kCO2_[i] + kCO2_[i + 1]);
-      outputDic_.co2Equilibration[i] =
+      nextk = k600_ * kCO2Schmidt_[i + 1];
+      avgkCO2 = 0.5 * (lastk + nextk);
+      equilibration =
          dt_[i] *
          avgkCO2 *
          0.5 * (lastCO2Deficit + nextCO2Sat);
+      lastk = nextk;
+      if (diagnostics) {
+         outputDic_.dicProduction[i] = production;
+         outputDic_.dicConsumption[i] = consumption;
+         kCO2_[i + 1] = nextk;
+         outputDic_.co2Equilibration[i] = equilibration;
+      }
    }
 
-   kH_[lastIndex] = carbonateEq_.kHenryCO2;
+   carbonateEq_.copyConstants(carbonateConstants_[lastIndex]);
 
    long prevLastIndex = lastIndex - 1;
    proposeDic_info info;
@@ -105,19 +133,32 @@ void MetabCrankNicolsonDoDic::run()
    info.alkalinity = alkalinity_[lastIndex];
    info.kCO2 = avgkCO2;
    info.dt = dt_[prevLastIndex];
+   info.gwAlpha = -1;
    info.target =
       outputDic_.dic[prevLastIndex] +
-      outputDic_.dicProduction[prevLastIndex] +
-      outputDic_.dicConsumption[prevLastIndex] +
-      outputDic_.co2Equilibration[prevLastIndex];
-
-   outputDic_.dic[lastIndex] = Brent_fmin(
-      minDIC,
-      maxDIC,
-      proposeDic,
-      &info,
-      tolerance
-   );
+      production +
+      consumption +
+      equilibration;
+
+   if (dicSolver_ == CarbonateEq::newton) {
+      outputDic_.dic[lastIndex] = newtonDic(
+         &info,
+         info.target -
+            0.5 * info.dt * avgkCO2 * kH_[lastIndex] *
+            outputDic_.pCO2[prevLastIndex],
+         minDIC,
+         maxDIC,
+         tolerance
+      );
+   } else {
+      outputDic_.dic[lastIndex] = Brent_fmin(
+         minDIC,
+         maxDIC,
+         proposeDic,
+         &info,
+         tolerance
+      );
+   }
 
    carbonateEq_.optfCO2FromDICTotalAlk(
       outputDic_.dic[lastIndex] * 1e-6,
@@ -130,7 +171,19 @@ void MetabCrankNicolsonDoDic::run()
    outputDic_.pCO2[lastIndex] = dicOptim[1];
    outputDic_.pH[lastIndex] = dicOptim[0];
 
-   outputDic_.dicProduction[lastIndex] = 0;
-   outputDic_.dicConsumption[lastIndex] = 0;
-   outputDic_.co2Equilibration[lastIndex] = 0;
+   if (diagnostics) {
+      outputDic_.dicProduction[lastIndex] = 0;
+      outputDic_.dicConsumption[lastIndex] = 0;
+      outputDic_.co2Equilibration[lastIndex] = 0;
+   }
+}
+
+Metab* MetabCrankNicolsonDoDic::clone()
+{
+   MetabCrankNicolsonDoDic* model = new MetabCrankNicolsonDoDic();
+   model->MetabDoDic::initializeCopy(this);
+   model->minDIC = minDIC;
+   model->maxDIC = maxDIC;
+   model->tolerance = tolerance;
+   return model;
 }
@@ -1,4 +1,6 @@
 #include "metabc.h"
+#include <cmath>
+#include <cstring>
 
 MetabDo::MetabDo() :
    Metab()
@@ -6,22 +8,7 @@ MetabDo::MetabDo() :
 
 MetabDo::~MetabDo()
 {
-   delete[] time_;
-   delete[] temp_;
-   delete[] par_;
-   delete[] airPressure_;
-   delete[] gwDO_;
-
-   delete[] dt_;
-   delete[] satDo_;
-   delete[] kDo_;
-   delete[] parAvg_;
-   delete[] parDist_;
-
-   delete[] outputDo_.dox;
-   delete[] outputDo_.doProduction;
-   delete[] outputDo_.doConsumption;
-   delete[] outputDo_.doEquilibration;
+   delete[] superpositionObsDO_;
 }
 
 void MetabDo::initialize
@@ -52,32 +39,38 @@ void MetabDo::initialize
       gwAlpha
    );
 
-   // Allocate memory
-   time_ = new double[length_];
-   temp_ = new double[length_];
-   par_ = new double[length_];
-   airPressure_ = new double[length_];
+   // Store the forcing arrays
+   time_ = storeInput(time);
+   temp_ = storeInput(temp);
+   par_ = storeInput(par);
+   airPressure_ = storeInput(airPressure);
 
    if (gwAlpha_ && gwDO) {
-      gwDO_ = new double[length_];
-      for(int i = 0; i < length_; i++) {
-         gwDO_[i] = gwDO[i];
-      }
+      gwDO_ = storeInput(gwDO);
    } else {
       gwDO_ = nullptr;
    }
 
-   dt_ = new double[length_];
-   satDo_ = new double[length_];
-   kDo_ = new double[length_];
-   parAvg_ = new double[length_];
-   parDist_ = new double[length_];
+   dt_ = arena_.allocate(length_);
+   satDo_ = arena_.allocate(length_);
+   kDo_ = arena_.allocate(length_);
+   kDoSchmidt_ = arena_.allocate(length_);
+   sensitivityDo_.dailyGPP = arena_.allocate(length_);
+   sensitivityDo_.dailyER = arena_.allocate(length_);
+   sensitivityDo_.k600 = arena_.allocate(length_);
+   doBasisForcing_ = arena_.allocate(length_);
+   doBasisGPP_ = arena_.allocate(length_);
+   doBasisER_ = arena_.allocate(length_);
+   parAvg_ = arena_.allocate(length_);
+   parDist_ = arena_.allocate(length_);
+   parTilt_ = arena_.allocate(length_);
+   scanRetention_ = arena_.allocate(length_);
 
    // Allocate output
-   outputDo_.dox = new double[length_];
-   outputDo_.doProduction = new double[length_];
-   outputDo_.doConsumption = new double[length_];
-   outputDo_.doEquilibration = new double[length_];
+   outputDo_.dox = arena_.allocate(length_);
+   outputDo_.doProduction = arena_.allocate(length_);
+   outputDo_.doConsumption = arena_.allocate(length_);
+   outputDo_.doEquilibration = arena_.allocate(length_);
 
    // Set attributes
    ratioDoCFix_ = ratioDoCFix;
@@ -85,37 +78,32 @@ void MetabDo::initialize
    initialDO_ = initialDO;
    stdAirPressure_ = stdAirPressure;
 
-   for(int i = 0; i < length_; i++) {
-      time_[i] = time[i];
-      temp_[i] = temp[i];
-      par_[i] = par[i];
-      airPressure_[i] = airPressure[i];
-   }
-
    int lastIndex = length_ - 1;
 
    // Calculate the values at times or over time steps
-   double densityWater;
    for(int i = 0; i < lastIndex; i++) {
       dt_[i] = time_[i + 1] - time_[i];
       parAvg_[i] = 0.5 * (par_[i] + par_[i + 1]);
-
-      densityWater = densityCalculator_(temp_[i]);
-      satDo_[i] = satDoCalculator_(
-         temp_[i],
-         densityWater,
-         airPressure_[i] / stdAirPressure
-      );
    }
    dt_[lastIndex] = 0;
    parAvg_[lastIndex] = 0;
 
-   densityWater = densityCalculator_(temp_[lastIndex]);
-   satDo_[lastIndex] = satDoCalculator_(
-      temp_[lastIndex],
-      densityWater,
-      airPressure_[lastIndex] / stdAirPressure
-   );
+   // The array kernels are used unless a calculator has been replaced
+   if (
+      densityCalculator_ == densityWaterCalc &&
+      satDoCalculator_ == satDoCalc
+   ) {
+      satDoCalcArray(length_, temp_, airPressure_, stdAirPressure, satDo_);
+   } else {
+      for(int i = 0; i < length_; i++) {
+         double densityWater = densityCalculator_(temp_[i]);
+         satDo_[i] = satDoCalculator_(
+            temp_[i],
+            densityWater,
+            airPressure_[i] / stdAirPressure
+         );
+      }
+   }
 
    // Calculate a total par by integration if the
    // total PAR is not provided (i.e. totalPAR argument
@@ -131,4 +119,257 @@ void MetabDo::initialize
    }
    parDistCalculator_.initialize(parTotal_);
 
+   // Gas exchange rates scale linearly with k600, so only the
+   // temperature dependent ratios are stored and runs multiply
+   // them by the current k600
+   if (kSchmidtDoCalculator_ == kSchmidtDoCalc) {
+      kSchmidtDoCalcArray(length_, temp_, 1, kDoSchmidt_);
+   } else {
+      for(int i = 0; i < length_; i++) {
+         kDoSchmidt_[i] = kSchmidtDoCalculator_(temp_[i], 1);
+      }
+   }
+
+   calcParDist();
+
+   // Any superposition basis and observations belong to previous forcing
+   superpositionk600_ = -1;
+   delete[] superpositionObsDO_;
+   superpositionObsDO_ = nullptr;
+}
+
+void MetabDo::calcParDist()
+{
+   int lastIndex = length_ - 1;
+   for(int i = 0; i < lastIndex; i++) {
+      parDist_[i] = parDistCalculator_.calc(
+         dt_[i],
+         par_[i]
+      );
+   }
+   parDist_[lastIndex] = 0;
+}
+
+void MetabDo::calcSuperposition()
+{
+   // Save the metabolism parameters
+   double dailyGPP = dailyGPP_;
+   double dailyER = dailyER_;
+   double ratioDoCFix = ratioDoCFix_;
+   double ratioDoCResp = ratioDoCResp_;
+
+   // Trajectory with no metabolism
+   dailyGPP_ = 0;
+   dailyER_ = 0;
+   run();
+   for(int i = 0; i < length_; i++) {
+      doBasisForcing_[i] = outputDo_.dox[i];
+   }
+
+   // Response to a unit of DO production per day
+   dailyGPP_ = 1;
+   ratioDoCFix_ = 1;
+   run();
+   for(int i = 0; i < length_; i++) {
+      doBasisGPP_[i] = outputDo_.dox[i] - doBasisForcing_[i];
+   }
+
+   // Response to a unit of DO consumption per day
+   dailyGPP_ = 0;
+   dailyER_ = 1;
+   ratioDoCResp_ = 1;
+   run();
+   for(int i = 0; i < length_; i++) {
+      doBasisER_[i] = outputDo_.dox[i] - doBasisForcing_[i];
+   }
+
+   // Restore the metabolism parameters
+   dailyGPP_ = dailyGPP;
+   dailyER_ = dailyER;
+   ratioDoCFix_ = ratioDoCFix;
+   ratioDoCResp_ = ratioDoCResp;
+   superpositionk600_ = k600_;
+
+   // Leave the output of the restored parameters rather than of the
+   // last basis trajectory
+   run();
+
+   // Update the inner products with the observations
+   if (superpositionObsDO_) {
+      setSuperpositionObs(superpositionObsDO_);
+   }
+}
+
+void MetabDo::runSuperposition()
+{
+   if (k600_ != superpositionk600_) {
+      calcSuperposition();
+   }
+
+   double production = dailyGPP_ * ratioDoCFix_;
+   double consumption = dailyER_ * ratioDoCResp_;
+   for(int i = 0; i < length_; i++) {
+      outputDo_.dox[i] =
+         doBasisForcing_[i] +
+         production * doBasisGPP_[i] +
+         consumption * doBasisER_[i];
+   }
+}
+
+void MetabDo::setSuperpositionObs(double* obsDO)
+{
+   if (!superpositionObsDO_) {
+      superpositionObsDO_ = new double[length_];
+   }
+   if (obsDO != superpositionObsDO_) {
+      for(int i = 0; i < length_; i++) {
+         superpositionObsDO_[i] = obsDO[i];
+      }
+   }
+   if (superpositionk600_ < 0) {
+      return;
+   }
+
+   // Sums of products of the residuals with no metabolism (a) and
+   // the production (g) and consumption (e) responses
+   double aa = 0, ag = 0, ae = 0, gg = 0, ge = 0, ee = 0;
+   for(int i = 0; i < length_; i++) {
+      if (std::isnan(superpositionObsDO_[i])) {
+         continue;
+      }
+      double a = superpositionObsDO_[i] - doBasisForcing_[i];
+      aa += a * a;
+      ag += a * doBasisGPP_[i];
+      ae += a * doBasisER_[i];
+      gg += doBasisGPP_[i] * doBasisGPP_[i];
+      ge += doBasisGPP_[i] * doBasisER_[i];
+      ee += doBasisER_[i] * doBasisER_[i];
+   }
+   superpositionProducts_[0] = aa;
+   superpositionProducts_[1] = ag;
+   superpositionProducts_[2] = ae;
+   superpositionProducts_[3] = gg;
+   superpositionProducts_[4] = ge;
+   superpositionProducts_[5] = ee;
+}
+
+double MetabDo::superpositionSSE()
+{
+   if (!superpositionObsDO_) {
+      return NAN;
+   }
+   if (k600_ != superpositionk600_) {
+      calcSuperposition();
+   }
+
+   double g = dailyGPP_ * ratioDoCFix_;
+   double e = dailyER_ * ratioDoCResp_;
+   double* p = superpositionProducts_;
+   double sse =
+      p[0] -
+      2 * (g * p[1] + e * p[2]) +
+      g * g * p[3] +
+      2 * g * e * p[4] +
+      e * e * p[5];
+
+   // Guard against round off for nearly exact fits
+   return sse > 0 ? sse : 0;
+}
+
+void MetabDo::runBatch
+(
+   int numSets,
+   const double* dailyGPP,
+   const double* dailyER,
+   const double* k600,
+   const double* ratioDoCFix,
+   const double* ratioDoCResp,
+   double* dox
+)
+{
+   // Save the parameters
+   double saveGPP = dailyGPP_;
+   double saveER = dailyER_;
+   double savek600 = k600_;
+   double saveRatioDoCFix = ratioDoCFix_;
+   double saveRatioDoCResp = ratioDoCResp_;
+
+   for(int set = 0; set < numSets; set++) {
+      dailyGPP_ = dailyGPP[set];
+      dailyER_ = dailyER[set];
+      k600_ = k600[set];
+      if (ratioDoCFix) ratioDoCFix_ = ratioDoCFix[set];
+      if (ratioDoCResp) ratioDoCResp_ = ratioDoCResp[set];
+      run();
+
+      double* setDox = dox + (long)set * length_;
+      for(int i = 0; i < length_; i++) {
+         setDox[i] = outputDo_.dox[i];
+      }
+   }
+
+   // Restore the parameters
+   dailyGPP_ = saveGPP;
+   dailyER_ = saveER;
+   k600_ = savek600;
+   ratioDoCFix_ = saveRatioDoCFix;
+   ratioDoCResp_ = saveRatioDoCResp;
+
+   // Leave the output of the restored parameters rather than of the
+   // last parameter set
+   if (numSets > 0) {
+      run();
+   }
+}
+
+void MetabDo::initializeCopy(MetabDo* model)
+{
+   copySettings(model);
+   MetabDo::initialize(
+      model->dailyGPP_,
+      model->ratioDoCFix_,
+      model->dailyER_,
+      model->ratioDoCResp_,
+      model->k600_,
+      model->initialDO_,
+      model->time_,
+      model->temp_,
+      model->par_,
+      model->parTotal_,
+      model->airPressure_,
+      model->stdAirPressure_,
+      model->length_,
+      model->gwAlpha_,
+      model->gwDO_
+   );
+}
+
+int MetabDo::arenaArrays()
+{
+   return Metab::arenaArrays() + 23;
+}
+
+double** MetabDo::getOutputSlot(const char* name)
+{
+   if (!strcmp(name, "dox")) return &outputDo_.dox;
+   if (!strcmp(name, "doProduction")) return &outputDo_.doProduction;
+   if (!strcmp(name, "doConsumption")) return &outputDo_.doConsumption;
+   if (!strcmp(name, "doEquilibration")) return &outputDo_.doEquilibration;
+   if (!strcmp(name, "k")) return &kDo_;
+   if (!strcmp(name, "dt")) return &dt_;
+   if (!strcmp(name, "doSat")) return &satDo_;
+   return Metab::getOutputSlot(name);
+}
+
+Metab_OutputKind MetabDo::getOutputKind(const char* name)
+{
+   if (!strcmp(name, "dox")) return outputPrediction;
+   if (!strcmp(name, "dt")) return outputConstant;
+   if (!strcmp(name, "doSat")) return outputConstant;
+   return Metab::getOutputKind(name);
+}
+
+MetabDo_Sensitivity* MetabDo::getDoSensitivity()
+{
+   return &sensitivityDo_;
 }
@@ -1,4 +1,5 @@
 #include "metabc.h"
+#include <cstring>
 
 MetabDoDic::MetabDoDic()
 {
@@ -7,19 +8,7 @@ MetabDoDic::MetabDoDic()
 
 MetabDoDic::~MetabDoDic()
 {
-   delete[] pCO2air_;
-   delete[] alkalinity_;
-   delete[] gwDIC_;
-
-   delete[] kCO2_;
-   delete[] kH_;
-
-   delete[] outputDic_.pCO2;
-   delete[] outputDic_.dic;
-   delete[] outputDic_.dicProduction;
-   delete[] outputDic_.dicConsumption;
-   delete[] outputDic_.co2Equilibration;
-   delete[] outputDic_.pH;
+   delete[] carbonateConstants_;
 }
 
 void MetabDoDic::initialize
@@ -65,41 +54,49 @@ void MetabDoDic::initialize
       gwDO
    );
 
-   // Allocate memory for array attributes
-   pCO2air_ = new double[length_];
-   alkalinity_ = new double[length_];
+   // Store the forcing arrays and allocate memory for array attributes
+   pCO2air_ = storeInput(pCO2air);
+   alkalinity_ = storeInput(alkalinity);
 
    if (gwAlpha_ && gwDIC) {
-      gwDIC_ = new double[length_];
-      for(int i = 0; i < length_; i++) {
-         gwDIC_[i] = gwDIC[i];
-      }
+      gwDIC_ = storeInput(gwDIC);
    } else {
       gwDIC_ = nullptr;
    }
 
-   kCO2_ = new double[length_];
-   kH_ = new double[length_];
+   kCO2_ = arena_.allocate(length_);
+   kH_ = arena_.allocate(length_);
+   kCO2Schmidt_ = arena_.allocate(length_);
+   delete[] carbonateConstants_;
+   carbonateConstants_ = new CarbonateEq[length_];
 
-   outputDic_.pCO2 = new double[length_];
-   outputDic_.dic = new double[length_];
-   outputDic_.dicProduction = new double[length_];
-   outputDic_.dicConsumption = new double[length_];
-   outputDic_.co2Equilibration = new double[length_];
-   outputDic_.pH = new double[length_];
+   outputDic_.pCO2 = arena_.allocate(length_);
+   outputDic_.dic = arena_.allocate(length_);
+   outputDic_.dicProduction = arena_.allocate(length_);
+   outputDic_.dicConsumption = arena_.allocate(length_);
+   outputDic_.co2Equilibration = arena_.allocate(length_);
+   outputDic_.pH = arena_.allocate(length_);
 
    // Assign attribute values
    ratioDicCFix_ = ratioDicCFix;
    ratioDicCResp_ = ratioDicCResp;
    initialDIC_ = initialDIC;
 
-   // Copy array values into attributes
+   // Carbonate equilibrium constants only depend on temperature,
+   // so they are calculated once rather than on every run
    for(int i = 0; i < length_; i++) {
-      pCO2air_[i] = pCO2air[i];
-      alkalinity_[i] = alkalinity[i];
+      carbonateConstants_[i].reset(temp_[i], 0);
+      kH_[i] = carbonateConstants_[i].kHenryCO2;
+   }
+   if (kSchmidtCO2Calculator_ == kSchmidtCO2Calc) {
+      kSchmidtCO2CalcArray(length_, temp_, 1, kCO2Schmidt_);
+   } else {
+      for(int i = 0; i < length_; i++) {
+         kCO2Schmidt_[i] = kSchmidtCO2Calculator_(temp_[i], 1);
+      }
    }
 
-   carbonateEq_.reset(temp_[0], 0);
+   carbonateEq_.copyConstants(carbonateConstants_[0]);
 }
 
 void MetabDoDic::setkSchmidtCO2Calculator
@@ -109,3 +106,122 @@ void MetabDoDic::setkSchmidtCO2Calculator
 {
    kSchmidtCO2Calculator_ = function;
 }
+
+void MetabDoDic::runBatchDic
+(
+   int numSets,
+   const double* dailyGPP,
+   const double* dailyER,
+   const double* k600,
+   const double* ratioDoCFix,
+   const double* ratioDoCResp,
+   const double* ratioDicCFix,
+   const double* ratioDicCResp,
+   double* dox,
+   double* dic,
+   double* pCO2,
+   double* pH
+)
+{
+   // Save the parameters
+   double saveGPP = dailyGPP_;
+   double saveER = dailyER_;
+   double savek600 = k600_;
+   double saveRatioDoCFix = ratioDoCFix_;
+   double saveRatioDoCResp = ratioDoCResp_;
+   double saveRatioDicCFix = ratioDicCFix_;
+   double saveRatioDicCResp = ratioDicCResp_;
+
+   for(int set = 0; set < numSets; set++) {
+      dailyGPP_ = dailyGPP[set];
+      dailyER_ = dailyER[set];
+      k600_ = k600[set];
+      if (ratioDoCFix) ratioDoCFix_ = ratioDoCFix[set];
+      if (ratioDoCResp) ratioDoCResp_ = ratioDoCResp[set];
+      if (ratioDicCFix) ratioDicCFix_ = ratioDicCFix[set];
+      if (ratioDicCResp) ratioDicCResp_ = ratioDicCResp[set];
+      run();
+
+      long offset = (long)set * length_;
+      for(int i = 0; i < length_; i++) {
+         dox[offset + i] = outputDo_.dox[i];
+         dic[offset + i] = outputDic_.dic[i];
+         pCO2[offset + i] = outputDic_.pCO2[i];
+         pH[offset + i] = outputDic_.pH[i];
+      }
+   }
+
+   // Restore the parameters
+   dailyGPP_ = saveGPP;
+   dailyER_ = saveER;
+   k600_ = savek600;
+   ratioDoCFix_ = saveRatioDoCFix;
+   ratioDoCResp_ = saveRatioDoCResp;
+   ratioDicCFix_ = saveRatioDicCFix;
+   ratioDicCResp_ = saveRatioDicCResp;
+
+   // Leave the output of the restored parameters rather than of the
+   // last parameter set
+   if (numSets > 0) {
+      run();
+   }
+}
+
+void MetabDoDic::initializeCopy(MetabDoDic* model)
+{
+   copySettings(model);
+   kSchmidtCO2Calculator_ = model->kSchmidtCO2Calculator_;
+   MetabDoDic::initialize(
+      model->dailyGPP_,
+      model->ratioDoCFix_,
+      model->dailyER_,
+      model->ratioDoCResp_,
+      model->k600_,
+      model->initialDO_,
+      model->time_,
+      model->temp_,
+      model->par_,
+      model->parTotal_,
+      model->airPressure_,
+      model->stdAirPressure_,
+      model->length_,
+      model->ratioDicCFix_,
+      model->ratioDicCResp_,
+      model->initialDIC_,
+      model->pCO2air_,
+      model->alkalinity_,
+      model->gwAlpha_,
+      model->gwDO_,
+      model->gwDIC_
+   );
+   carbonateEq_.pHSolver = model->carbonateEq_.pHSolver;
+   carbonateEq_.warmStartWidth = model->carbonateEq_.warmStartWidth;
+   dicSolver_ = model->dicSolver_;
+}
+
+int MetabDoDic::arenaArrays()
+{
+   return MetabDo::arenaArrays() + 12;
+}
+
+double** MetabDoDic::getOutputSlot(const char* name)
+{
+   if (!strcmp(name, "pCO2")) return &outputDic_.pCO2;
+   if (!strcmp(name, "dic")) return &outputDic_.dic;
+   if (!strcmp(name, "dicProduction")) return &outputDic_.dicProduction;
+   if (!strcmp(name, "dicConsumption")) return &outputDic_.dicConsumption;
+   if (!strcmp(name, "co2Equilibration")) return &outputDic_.co2Equilibration;
+   if (!strcmp(name, "kCO2")) return &kCO2_;
+   if (!strcmp(name, "pH")) return &outputDic_.pH;
+   if (!strcmp(name, "kH")) return &kH_;
+   return MetabDo::getOutputSlot(name);
+}
+
+Metab_OutputKind MetabDoDic::getOutputKind(const char* name)
+{
+   if (!strcmp(name, "pCO2")) return outputPrediction;
+   if (!strcmp(name, "dic")) return outputPrediction;
+   if (!strcmp(name, "pH")) return outputPrediction;
+   if (!strcmp(name, "kH")) return outputConstant;
+   return MetabDo::getOutputKind(name);
+}
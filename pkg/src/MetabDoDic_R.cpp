@@ -75,6 +75,12 @@ SEXP MetabDoDic_initialize(
          REAL(alkalinity)
       );
    }
+   Metab_keepInputs(
+      baseExtPointer,
+      basePointer,
+      {time, temp, par, airPressure, pCO2air, alkalinity, gwAlpha, gwDO, gwDIC}
+   );
+
    return R_NilValue;
 }
 
@@ -122,40 +128,139 @@ SEXP MetabDoDic_setRatioDicCResp(SEXP baseExternalPointer, SEXP value)
    return out;
 }
 
-SEXP MetabDoDic_getSummary(SEXP baseExternalPointer)
+SEXP MetabDoDic_setpHWarmStart(SEXP baseExternalPointer, SEXP value)
 {
-   MetabDoDic* basePointer =
-      (MetabDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   MetabDoDic* model = (MetabDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->carbonateEq_.warmStartWidth;
+   model->carbonateEq_.warmStartWidth = asReal(value);
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP MetabDoDic_setpHSolver(SEXP baseExternalPointer, SEXP value)
+{
+   MetabDoDic* model = (MetabDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   CarbonateEq::Solver solver = Metab_asSolver(value);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->carbonateEq_.pHSolver;
+   model->carbonateEq_.pHSolver = solver;
 
-   return MetabDoDic_getSummary(basePointer);
+   UNPROTECT(1);
+   return out;
 }
 
-SEXP MetabDoDic_getSummary(MetabDoDic* basePointer)
+SEXP MetabDoDic_setDicSolver(SEXP baseExternalPointer, SEXP value)
+{
+   MetabDoDic* model = (MetabDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   CarbonateEq::Solver solver = Metab_asSolver(value);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->dicSolver_;
+   model->dicSolver_ = solver;
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP MetabDoDic_runBatch
+(
+   SEXP baseExternalPointer,
+   SEXP dailyGPP,
+   SEXP dailyER,
+   SEXP k600,
+   SEXP ratioDoCFix,
+   SEXP ratioDoCResp,
+   SEXP ratioDicCFix,
+   SEXP ratioDicCResp
+)
+{
+   MetabDoDic* model = (MetabDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   int numSets = length(dailyGPP);
+   Metab_checkParamSets(
+      numSets,
+      {dailyGPP, dailyER, k600},
+      {ratioDoCFix, ratioDoCResp, ratioDicCFix, ratioDicCResp}
+   );
+
+   // Batches run the model itself, which must not write into output
+   // that R already holds
+   Metab_claimOutputs(baseExternalPointer, model, true);
+   SEXP dox = PROTECT(allocMatrix(REALSXP, model->length_, numSets));
+   SEXP dic = PROTECT(allocMatrix(REALSXP, model->length_, numSets));
+   SEXP pCO2 = PROTECT(allocMatrix(REALSXP, model->length_, numSets));
+   SEXP pH = PROTECT(allocMatrix(REALSXP, model->length_, numSets));
+   model->runBatchDic(
+      numSets,
+      REAL(dailyGPP),
+      REAL(dailyER),
+      REAL(k600),
+      isNull(ratioDoCFix) ? nullptr : REAL(ratioDoCFix),
+      isNull(ratioDoCResp) ? nullptr : REAL(ratioDoCResp),
+      isNull(ratioDicCFix) ? nullptr : REAL(ratioDicCFix),
+      isNull(ratioDicCResp) ? nullptr : REAL(ratioDicCResp),
+      REAL(dox),
+      REAL(dic),
+      REAL(pCO2),
+      REAL(pH)
+   );
+
+   SEXP vecOutput = PROTECT(allocVector(VECSXP, 4));
+   SET_VECTOR_ELT(vecOutput, 0, dox);
+   SET_VECTOR_ELT(vecOutput, 1, dic);
+   SET_VECTOR_ELT(vecOutput, 2, pCO2);
+   SET_VECTOR_ELT(vecOutput, 3, pH);
+
+   SEXP vecOutput_names = PROTECT(allocVector(VECSXP, 4));
+   SET_VECTOR_ELT(vecOutput_names, 0, install("dox"));
+   SET_VECTOR_ELT(vecOutput_names, 1, install("dic"));
+   SET_VECTOR_ELT(vecOutput_names, 2, install("pCO2"));
+   SET_VECTOR_ELT(vecOutput_names, 3, install("pH"));
+
+   setAttrib(vecOutput, install("names"), vecOutput_names);
+
+   UNPROTECT(6);
+   return vecOutput;
+}
+
+SEXP MetabDoDic_getSummary(SEXP baseExternalPointer)
+{
+   MetabDoDic* basePointer = (MetabDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   return MetabDoDic_getSummary(baseExternalPointer, basePointer);
+}
+
+SEXP MetabDoDic_getSummary(SEXP baseExternalPointer, MetabDoDic* basePointer)
 {
    MetabDo* basePointerDo = dynamic_cast <MetabDo*> (basePointer);
-   SEXP oldVec = PROTECT(MetabDo_getSummary(basePointerDo));
+   SEXP oldVec = PROTECT(MetabDo_getSummary(baseExternalPointer, basePointerDo));
 
    SEXP vecOutput = PROTECT(VECTOR_ELT(oldVec, 0));
    SEXP vecOutputDO = PROTECT(VECTOR_ELT(oldVec, 1));
 
-   SEXP pCO2 = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP dic = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP dicProduction = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP dicConsumption = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP co2Equilibration = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP kCO2 = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP pH = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP kH = PROTECT(allocVector(REALSXP, basePointer->length_));
-   for(int i = 0; i < basePointer->length_; i++) {
-      REAL(pCO2)[i] = basePointer->outputDic_.pCO2[i];
-      REAL(dic)[i] = basePointer->outputDic_.dic[i];
-      REAL(dicProduction)[i] = basePointer->outputDic_.dicProduction[i];
-      REAL(dicConsumption)[i] = basePointer->outputDic_.dicConsumption[i];
-      REAL(co2Equilibration)[i] = basePointer->outputDic_.co2Equilibration[i];
-      REAL(kCO2)[i] = basePointer->kCO2_[i];
-      REAL(pH)[i] = basePointer->outputDic_.pH[i];
-      REAL(kH)[i] = basePointer->kH_[i];
-   }
+   SEXP pCO2 = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "pCO2")
+   );
+   SEXP dic = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "dic")
+   );
+   SEXP dicProduction = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "dicProduction")
+   );
+   SEXP dicConsumption = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "dicConsumption")
+   );
+   SEXP co2Equilibration = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "co2Equilibration")
+   );
+   SEXP kCO2 = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "kCO2")
+   );
+   SEXP pH = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "pH")
+   );
+   SEXP kH = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "kH", true)
+   );
 
    SEXP vecOutputDIC = PROTECT(allocVector(VECSXP, 8));
    SET_VECTOR_ELT(vecOutputDIC, 0, pCO2);
@@ -178,6 +283,7 @@ SEXP MetabDoDic_getSummary(MetabDoDic* basePointer)
    SET_VECTOR_ELT(vecOutputDIC_names, 7, install("kH"));
 
    setAttrib(vecOutputDIC, install("names"), vecOutputDIC_names);
+   Metab_setDataFrame(vecOutputDIC, basePointer->length_);
 
    SEXP vec = PROTECT(allocVector(VECSXP, 3));
    SET_VECTOR_ELT(vec, 0, vecOutput);
@@ -60,6 +60,12 @@ SEXP MetabDo_initialize
       );
    }
 
+   Metab_keepInputs(
+      baseExtPointer,
+      basePointer,
+      {time, temp, par, airPressure, gwAlpha, gwDO}
+   );
+
    return R_NilValue;
 }
 
@@ -88,34 +94,39 @@ SEXP MetabDo_setRatioDoCResp(SEXP baseExternalPointer, SEXP value)
 SEXP MetabDo_getSummary(SEXP baseExtPointer)
 {
    MetabDo* basePointer = (MetabDo*)R_ExternalPtrAddr(baseExtPointer);
-   return MetabDo_getSummary(basePointer);
+   return MetabDo_getSummary(baseExtPointer, basePointer);
 }
 
-SEXP MetabDo_getSummary(MetabDo* basePointer)
+SEXP MetabDo_getSummary(SEXP baseExtPointer, MetabDo* basePointer)
 {
-   SEXP dt = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP cFixation = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP cRespiration = PROTECT(allocVector(REALSXP, basePointer->length_));
-
-   SEXP dox = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP doSat = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP doProduction = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP doConsumption = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP k = PROTECT(allocVector(REALSXP, basePointer->length_));
-   SEXP doEquilibration = PROTECT(allocVector(REALSXP, basePointer->length_));
-
-   for(int i = 0; i < basePointer->length_; i++) {
-      REAL(dt)[i] = basePointer->dt_[i];
-      REAL(cFixation)[i] = basePointer->output_.cFixation[i];
-      REAL(cRespiration)[i] = basePointer->output_.cRespiration[i];
-
-      REAL(dox)[i] = basePointer->outputDo_.dox[i];
-      REAL(doSat)[i] = basePointer->satDo_[i];
-      REAL(doProduction)[i] = basePointer->outputDo_.doProduction[i];
-      REAL(doConsumption)[i] = basePointer->outputDo_.doConsumption[i];
-      REAL(k)[i] = basePointer->kDo_[i];
-      REAL(doEquilibration)[i] = basePointer->outputDo_.doEquilibration[i];
-   }
+   SEXP dt = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "dt", true)
+   );
+   SEXP cFixation = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "cFixation")
+   );
+   SEXP cRespiration = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "cRespiration")
+   );
+
+   SEXP dox = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "dox")
+   );
+   SEXP doSat = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "doSat", true)
+   );
+   SEXP doProduction = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "doProduction")
+   );
+   SEXP doConsumption = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "doConsumption")
+   );
+   SEXP k = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "k")
+   );
+   SEXP doEquilibration = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "doEquilibration")
+   );
 
    SEXP vecOutput = PROTECT(allocVector(VECSXP, 3));
    SET_VECTOR_ELT(vecOutput, 0, dt);
@@ -128,6 +139,7 @@ SEXP MetabDo_getSummary(MetabDo* basePointer)
    SET_VECTOR_ELT(vecOutput_names, 2, install("cRespiration"));
 
    setAttrib(vecOutput, install("names"), vecOutput_names);
+   Metab_setDataFrame(vecOutput, basePointer->length_);
 
    SEXP vecOutputDO = PROTECT(allocVector(VECSXP, 6));
    SET_VECTOR_ELT(vecOutputDO, 0, dox);
@@ -146,6 +158,7 @@ SEXP MetabDo_getSummary(MetabDo* basePointer)
    SET_VECTOR_ELT(vecOutputDO_names, 5, install("doEquilibration"));
 
    setAttrib(vecOutputDO, install("names"), vecOutputDO_names);
+   Metab_setDataFrame(vecOutputDO, basePointer->length_);
 
    SEXP vec = PROTECT(allocVector(VECSXP, 2));
    SET_VECTOR_ELT(vec, 0, vecOutput);
@@ -185,3 +198,74 @@ SEXP MetabDo_getDt(SEXP externalPointer)
    UNPROTECT(1);
    return out;
 }
+
+SEXP MetabDo_runSuperposition(SEXP baseExternalPointer)
+{
+   MetabDo* model = (MetabDo*)R_ExternalPtrAddr(baseExternalPointer);
+   Metab_claimOutputs(baseExternalPointer, model, true);
+   model->runSuperposition();
+
+   SEXP out = PROTECT(allocVector(REALSXP, model->length_));
+   for (int i = 0; i < model->length_; i++) {
+      REAL(out)[i] = model->outputDo_.dox[i];
+   }
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP MetabDo_setSuperpositionObs(SEXP baseExternalPointer, SEXP obsDO)
+{
+   MetabDo* model = (MetabDo*)R_ExternalPtrAddr(baseExternalPointer);
+   model->setSuperpositionObs(REAL(obsDO));
+
+   return R_NilValue;
+}
+
+SEXP MetabDo_getSuperpositionSSE(SEXP baseExternalPointer)
+{
+   MetabDo* model = (MetabDo*)R_ExternalPtrAddr(baseExternalPointer);
+   // Calculating the basis runs the model
+   Metab_claimOutputs(baseExternalPointer, model, true);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->superpositionSSE();
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP MetabDo_runBatch
+(
+   SEXP baseExternalPointer,
+   SEXP dailyGPP,
+   SEXP dailyER,
+   SEXP k600,
+   SEXP ratioDoCFix,
+   SEXP ratioDoCResp
+)
+{
+   MetabDo* model = (MetabDo*)R_ExternalPtrAddr(baseExternalPointer);
+   int numSets = length(dailyGPP);
+   Metab_checkParamSets(
+      numSets,
+      {dailyGPP, dailyER, k600},
+      {ratioDoCFix, ratioDoCResp}
+   );
+
+   // Batches run the model itself, which must not write into output
+   // that R already holds
+   Metab_claimOutputs(baseExternalPointer, model, true);
+   SEXP dox = PROTECT(allocMatrix(REALSXP, model->length_, numSets));
+   model->runBatch(
+      numSets,
+      REAL(dailyGPP),
+      REAL(dailyER),
+      REAL(k600),
+      isNull(ratioDoCFix) ? nullptr : REAL(ratioDoCFix),
+      isNull(ratioDoCResp) ? nullptr : REAL(ratioDoCResp),
+      REAL(dox)
+   );
+
+   UNPROTECT(1);
+   return dox;
+}
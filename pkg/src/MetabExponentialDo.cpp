@@ -0,0 +1,180 @@
+#include "metabc.h"
+#include <cmath>
+
+void MetabExponentialDo::run()
+{
+   if (predictionsOnly_) {
+      selectSteps<false>();
+   } else {
+      selectSteps<true>();
+   }
+}
+
+template <bool diagnostics>
+void MetabExponentialDo::selectSteps()
+{
+   if (gwDO_) {
+      if (calcSensitivity_) {
+         runSteps<true, true, diagnostics>();
+      } else {
+         runSteps<true, false, diagnostics>();
+      }
+   } else {
+      if (calcSensitivity_) {
+         runSteps<false, true, diagnostics>();
+      } else {
+         runSteps<false, false, diagnostics>();
+      }
+   }
+}
+
+template <bool groundwater, bool sensitivity, bool diagnostics>
+void MetabExponentialDo::runSteps()
+{
+   // Local copies of the parameters and arrays let the compiler
+   // keep them in registers, as the output arrays could otherwise
+   // alias the attributes of the object
+   const double dailyGPP = dailyGPP_;
+   const double dailyER = dailyER_;
+   const double k600 = k600_;
+   const double ratioDoCFix = ratioDoCFix_;
+   const double ratioDoCResp = ratioDoCResp_;
+   const double* dt = dt_;
+   const double* parDist = parDist_;
+   const double* parTilt = parTilt_;
+   const double* satDo = satDo_;
+   const double* kDoSchmidt = kDoSchmidt_;
+   double* cFixation = output_.cFixation;
+   double* cRespiration = output_.cRespiration;
+   double* doProduction = outputDo_.doProduction;
+   double* doConsumption = outputDo_.doConsumption;
+   double* doEquilibration = outputDo_.doEquilibration;
+   double* kDo = kDo_;
+   double* dox = outputDo_.dox;
+   int lastIndex = length_ - 1;
+
+   // Set the initial oxygen concentration
+   dox[0] = initialDO_;
+   if (diagnostics) {
+      kDo[0] = k600 * kDoSchmidt[0];
+   }
+   if (sensitivity) {
+      sensitivityDo_.dailyGPP[0] = 0;
+      sensitivityDo_.dailyER[0] = 0;
+      sensitivityDo_.k600[0] = 0;
+   }
+
+   // Over each time step, DO relaxes towards the balance of the forcing
+   // at the total rate of gas exchange and groundwater turnover, which
+   // are held constant at their averages over the step. Production and
+   // the DO saturation concentration vary linearly over the step. The
+   // change in DO at the initial rate scaled by phi1, plus the tilt of
+   // the linear inputs scaled by (phi2 - phi1 / 2), is the exact change
+   // over the step. \sa phiCalc()
+   for (int i = 0; i < lastIndex; i++) {
+      double fixation = dailyGPP * parDist[i];
+      double respiration = dailyER * dt[i];
+
+      double production = fixation * ratioDoCFix;
+      double consumption = respiration * ratioDoCResp;
+
+      double avgkDOSchmidt = 0.5 * (kDoSchmidt[i] + kDoSchmidt[i + 1]);
+      double avgkDO = k600 * avgkDOSchmidt;
+      double avgSatDo = 0.5 * (satDo[i] + satDo[i + 1]);
+      double diffSatDo = satDo[i + 1] - satDo[i];
+
+      // Inputs of DO over the step if the DO concentration were zero,
+      // the tilt of the inputs (the change in their rate over the step
+      // times the length of the step), and the product of the total
+      // rate and the length of the step
+      double forcing = production + consumption + dt[i] * avgkDO * avgSatDo;
+      double productionTilt = ratioDoCFix * parTilt[i];
+      double tilt =
+         dailyGPP * productionTilt +
+         dt[i] * avgkDO * diffSatDo;
+      double rate = avgkDO;
+      if (groundwater) {
+         forcing += dt[i] * gwAlpha_[i] * gwDO_[i];
+         rate += gwAlpha_[i];
+      }
+      double x = dt[i] * rate;
+      double change = forcing - x * dox[i];
+
+      double phi[3];
+      phiCalc(x, phi);
+      double tiltWeight = phi[1] - 0.5 * phi[0];
+      dox[i + 1] = dox[i] + phi[0] * change + tiltWeight * tilt;
+
+      if (diagnostics) {
+         double avgDo =
+            dox[i] +
+            phi[1] * change +
+            (phi[2] - 0.5 * phi[1]) * tilt;
+         cFixation[i] = fixation;
+         cRespiration[i] = respiration;
+         doProduction[i] = production;
+         doConsumption[i] = consumption;
+         kDo[i + 1] = k600 * kDoSchmidt[i + 1];
+         doEquilibration[i] = dt[i] * avgkDO * (avgSatDo - avgDo);
+      }
+
+      // Propagate the derivatives of DO with respect to the parameters,
+      // where DO at the end of the step is retention * dox[i] +
+      // phi1 * forcing + tiltWeight * tilt. The derivatives of the phi
+      // functions with respect to x are phi'(k) = k * phi(k + 1) - phi(k).
+      if (sensitivity) {
+         double retention = 1 - x * phi[0];
+         double dxdk600 = dt[i] * avgkDOSchmidt;
+         double dTiltWeight = 2 * phi[2] - 1.5 * phi[1] + 0.5 * phi[0];
+         sensitivityDo_.dailyGPP[i + 1] =
+            sensitivityDo_.dailyGPP[i] * retention +
+            phi[0] * parDist[i] * ratioDoCFix +
+            tiltWeight * productionTilt;
+         sensitivityDo_.dailyER[i + 1] =
+            sensitivityDo_.dailyER[i] * retention +
+            phi[0] * dt[i] * ratioDoCResp;
+         sensitivityDo_.k600[i + 1] =
+            sensitivityDo_.k600[i] * retention +
+            dxdk600 * (
+               (phi[1] - phi[0]) * forcing -
+               retention * dox[i] +
+               phi[0] * avgSatDo +
+               dTiltWeight * tilt +
+               tiltWeight * diffSatDo
+            );
+      }
+   }
+
+   if (diagnostics) {
+      cFixation[lastIndex] = 0;
+      cRespiration[lastIndex] = 0;
+
+      doProduction[lastIndex] = 0;
+      doConsumption[lastIndex] = 0;
+      doEquilibration[lastIndex] = 0;
+   }
+}
+
+void MetabExponentialDo::calcParDist()
+{
+   int lastIndex = length_ - 1;
+   for(int i = 0; i < lastIndex; i++) {
+      parDist_[i] = parDistCalculator_.calc(
+         dt_[i],
+         parAvg_[i]
+      );
+      parTilt_[i] = parDistCalculator_.calc(
+         dt_[i],
+         par_[i + 1] - par_[i]
+      );
+   }
+   parDist_[lastIndex] = 0;
+   parTilt_[lastIndex] = 0;
+}
+
+Metab* MetabExponentialDo::clone()
+{
+   MetabExponentialDo* model = new MetabExponentialDo();
+   model->initializeCopy(this);
+   return model;
+}
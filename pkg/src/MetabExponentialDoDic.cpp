@@ -0,0 +1,108 @@
+#include "metabc.h"
+#include <cmath>
+
+void MetabExponentialDoDic::run()
+{
+   // Run the base class DO model
+   MetabExponentialDo::run();
+
+   // Fluxes of DIC are only stored when the diagnostic output is
+   // requested. Carbon fixation and respiration are recalculated from
+   // the parameters because the DO model may not have stored them.
+   bool diagnostics = !predictionsOnly_;
+
+   carbonateEq_.lastpH = -1;
+   outputDic_.dic[0] = initialDIC_;
+
+   int lastIndex = length_ - 1;
+   double dicOptim[3];
+   for(int i = 0; i < lastIndex; i++) {
+      // Carbonate equilibrium at the start of the step, with the
+      // derivative of pCO2 with respect to DIC
+      carbonateEq_.copyConstants(carbonateConstants_[i]);
+      carbonateEq_.optfCO2DerivFromDICTotalAlk(
+         outputDic_.dic[i] * 1e-6,
+         alkalinity_[i] * 1e-6,
+         1e-5,
+         2,
+         12,
+         dicOptim
+      );
+      outputDic_.pCO2[i] = dicOptim[1];
+      outputDic_.pH[i] = dicOptim[0];
+
+      double production = dailyER_ * dt_[i] * ratioDicCResp_;
+      double consumption = dailyGPP_ * parDist_[i] * ratioDicCFix_;
+
+      double avgkCO2 =
+         k600_ * 0.5 * (kCO2Schmidt_[i] + kCO2Schmidt_[i + 1]);
+      double satCO2 = kH_[i] * pCO2air_[i];
+      double nextSatCO2 = kH_[i + 1] * pCO2air_[i + 1];
+      double co2 = kH_[i] * outputDic_.pCO2[i];
+
+      // Aqueous CO2 is linearized in DIC, so DIC relaxes towards the
+      // balance of the forcing at the total rate of gas exchange and
+      // groundwater turnover, with consumption and the saturation
+      // concentration of CO2 varying linearly over the step.
+      // \sa MetabExponentialDo::runSteps()
+      double change =
+         production +
+         consumption +
+         dt_[i] * avgkCO2 * (0.5 * (satCO2 + nextSatCO2) - co2);
+      double tilt =
+         dailyGPP_ * ratioDicCFix_ * parTilt_[i] +
+         dt_[i] * avgkCO2 * (nextSatCO2 - satCO2);
+      double derivCO2 = kH_[i] * dicOptim[2] * 1e-6;
+      double rate = avgkCO2 * derivCO2;
+      if (gwDIC_) {
+         change +=
+            dt_[i] * gwAlpha_[i] * (gwDIC_[i] - outputDic_.dic[i]);
+         rate += gwAlpha_[i];
+      }
+
+      double phi[3];
+      phiCalc(dt_[i] * rate, phi);
+      outputDic_.dic[i + 1] =
+         outputDic_.dic[i] +
+         phi[0] * change +
+         (phi[1] - 0.5 * phi[0]) * tilt;
+
+      if (diagnostics) {
+         double avgCO2 =
+            co2 +
+            derivCO2 * (phi[1] * change + (phi[2] - 0.5 * phi[1]) * tilt);
+         outputDic_.dicProduction[i] = production;
+         outputDic_.dicConsumption[i] = consumption;
+         kCO2_[i] = k600_ * kCO2Schmidt_[i];
+         outputDic_.co2Equilibration[i] =
+            dt_[i] * avgkCO2 * (0.5 * (satCO2 + nextSatCO2) - avgCO2);
+      }
+   }
+
+   carbonateEq_.copyConstants(carbonateConstants_[lastIndex]);
+   carbonateEq_.optfCO2FromDICTotalAlk(
+      outputDic_.dic[lastIndex] * 1e-6,
+      alkalinity_[lastIndex] * 1e-6,
+      1e-5,
+      2,
+      12,
+      dicOptim
+   );
+   outputDic_.pCO2[lastIndex] = dicOptim[1];
+   outputDic_.pH[lastIndex] = dicOptim[0];
+
+   if (diagnostics) {
+      outputDic_.dicProduction[lastIndex] = 0;
+      outputDic_.dicConsumption[lastIndex] = 0;
+
+      kCO2_[lastIndex] = k600_ * kCO2Schmidt_[lastIndex];
+      outputDic_.co2Equilibration[lastIndex] = 0;
+   }
+}
+
+Metab* MetabExponentialDoDic::clone()
+{
+   MetabExponentialDoDic* model = new MetabExponentialDoDic();
+   model->MetabDoDic::initializeCopy(this);
+   return model;
+}
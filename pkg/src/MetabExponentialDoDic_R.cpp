@@ -0,0 +1,13 @@
+#include "metabc_R.h"
+
+SEXP MetabExponentialDoDic_constructor()
+{
+   return Metab_constructor<MetabExponentialDoDic, MetabDoDic>();
+}
+
+SEXP MetabExponentialDoDic_destructor(SEXP externalPointer)
+{
+   finalizerExternalPointer<MetabExponentialDoDic>(externalPointer);
+
+   return R_NilValue;
+}
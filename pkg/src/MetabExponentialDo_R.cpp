@@ -0,0 +1,13 @@
+#include "metabc_R.h"
+
+SEXP MetabExponentialDo_constructor()
+{
+   return Metab_constructor<MetabExponentialDo, MetabDo>();
+}
+
+SEXP MetabExponentialDo_destructor(SEXP externalPointer)
+{
+   finalizerExternalPointer<MetabExponentialDo>(externalPointer);
+
+   return R_NilValue;
+}
@@ -3,78 +3,278 @@
 
 void MetabForwardEulerDo::run()
 {
+   if (predictionsOnly_) {
+      selectSteps<false>();
+   } else {
+      selectSteps<true>();
+   }
+}
+
+template <bool diagnostics>
+void MetabForwardEulerDo::selectSteps()
+{
+   if (scanThreads_ != 1) {
+      if (gwDO_) {
+         if (calcSensitivity_) {
+            scanSteps<true, true, diagnostics>();
+         } else {
+            scanSteps<true, false, diagnostics>();
+         }
+      } else {
+         if (calcSensitivity_) {
+            scanSteps<false, true, diagnostics>();
+         } else {
+            scanSteps<false, false, diagnostics>();
+         }
+      }
+   } else if (gwDO_) {
+      if (calcSensitivity_) {
+         runSteps<true, true, diagnostics>();
+      } else {
+         runSteps<true, false, diagnostics>();
+      }
+   } else {
+      if (calcSensitivity_) {
+         runSteps<false, true, diagnostics>();
+      } else {
+         runSteps<false, false, diagnostics>();
+      }
+   }
+}
+
+template <bool groundwater, bool sensitivity, bool diagnostics>
+void MetabForwardEulerDo::runSteps()
+{
+   // Local copies of the parameters and arrays let the compiler
+   // keep them in registers, as the output arrays could otherwise
+   // alias the attributes of the object
+   const double dailyGPP = dailyGPP_;
+   const double dailyER = dailyER_;
+   const double k600 = k600_;
+   const double ratioDoCFix = ratioDoCFix_;
+   const double ratioDoCResp = ratioDoCResp_;
+   const double* dt = dt_;
+   const double* parDist = parDist_;
+   const double* satDo = satDo_;
+   const double* kDoSchmidt = kDoSchmidt_;
+   double* cFixation = output_.cFixation;
+   double* cRespiration = output_.cRespiration;
+   double* doProduction = outputDo_.doProduction;
+   double* doConsumption = outputDo_.doConsumption;
+   double* doEquilibration = outputDo_.doEquilibration;
+   double* kDo = kDo_;
+   double* dox = outputDo_.dox;
+   int lastIndex = length_ - 1;
+
    // Set the initial oxygen concentration
-   outputDo_.dox[0] = initialDO_;
-
-   // Calculate effects on effective organic carbon
-   parDist_[0] = parDistCalculator_.calc(
-      dt_[0],
-      par_[0]
-   );
-   output_.cFixation[0] = dailyGPP_ * parDist_[0];
-   output_.cRespiration[0] = dailyER_ * dt_[0];
-
-   outputDo_.doProduction[0] =
-      output_.cFixation[0] * ratioDoCFix_;
-   outputDo_.doConsumption[0] =
-      output_.cRespiration[0] * ratioDoCResp_;
-
-   kDo_[0] = kSchmidtDoCalculator_(temp_[0], k600_);
-   outputDo_.doEquilibration[0] =
-      dt_[0] * kDo_[0] * (satDo_[0] - outputDo_.dox[0]);
-
-   // Loop through time steps
+   dox[0] = initialDO_;
+   if (sensitivity) {
+      sensitivityDo_.dailyGPP[0] = 0;
+      sensitivityDo_.dailyER[0] = 0;
+      sensitivityDo_.k600[0] = 0;
+   }
+
+   // Loop through time steps, calculating the fluxes over each
+   // time step and the resulting DO concentration at its end.
+   // The PAR distribution and the temperature dependence of gas
+   // exchange are calculated once by initialize(). Fluxes are only
+   // stored when the diagnostic output is requested.
+   for (int i = 0; i < lastIndex; i++) {
+      double fixation = dailyGPP * parDist[i];
+      double respiration = dailyER * dt[i];
+
+      double production = fixation * ratioDoCFix;
+      double consumption = respiration * ratioDoCResp;
+
+      double k = k600 * kDoSchmidt[i];
+      double equilibration = dt[i] * k * (satDo[i] - dox[i]);
+
+      if (diagnostics) {
+         cFixation[i] = fixation;
+         cRespiration[i] = respiration;
+         doProduction[i] = production;
+         doConsumption[i] = consumption;
+         kDo[i] = k;
+         doEquilibration[i] = equilibration;
+      }
+
+      dox[i + 1] =
+         dox[i] +
+         production +
+         consumption +
+         equilibration;
+      if (groundwater) {
+         dox[i + 1] += dt[i] * gwAlpha_[i] * (gwDO_[i] - dox[i]);
+      }
+
+      // Propagate the derivatives of DO with respect to the parameters
+      if (sensitivity) {
+         double retention = 1 - dt[i] * k;
+         if (groundwater) {
+            retention -= dt[i] * gwAlpha_[i];
+         }
+         sensitivityDo_.dailyGPP[i + 1] =
+            sensitivityDo_.dailyGPP[i] * retention +
+            parDist[i] * ratioDoCFix;
+         sensitivityDo_.dailyER[i + 1] =
+            sensitivityDo_.dailyER[i] * retention +
+            dt[i] * ratioDoCResp;
+         sensitivityDo_.k600[i + 1] =
+            sensitivityDo_.k600[i] * retention +
+            dt[i] * kDoSchmidt[i] * (satDo[i] - dox[i]);
+      }
+   }
+
+   if (diagnostics) {
+      cFixation[lastIndex] = 0;
+      cRespiration[lastIndex] = 0;
+
+      doConsumption[lastIndex] = 0;
+      doProduction[lastIndex] = 0;
+      kDo[lastIndex] = k600 * kDoSchmidt[lastIndex];
+      doEquilibration[lastIndex] = 0;
+   }
+}
+
+template <bool groundwater, bool sensitivity, bool diagnostics>
+void MetabForwardEulerDo::scanSteps()
+{
+   const double dailyGPP = dailyGPP_;
+   const double dailyER = dailyER_;
+   const double k600 = k600_;
+   const double ratioDoCFix = ratioDoCFix_;
+   const double ratioDoCResp = ratioDoCResp_;
+   const double* dt = dt_;
+   const double* parDist = parDist_;
+   const double* satDo = satDo_;
+   const double* kDoSchmidt = kDoSchmidt_;
+   double* retention = scanRetention_;
+   double* dox = outputDo_.dox;
    int lastIndex = length_ - 1;
-   for (int i = 1; i < lastIndex; i++) {
-      long prevIndex = i - 1;
-      outputDo_.dox[i] =
-         outputDo_.dox[prevIndex] +
-         outputDo_.doProduction[prevIndex] +
-         outputDo_.doConsumption[prevIndex] +
-         outputDo_.doEquilibration[prevIndex];
-      if (gwDO_) {
-         outputDo_.dox[i] +=
-            dt_[prevIndex] * gwAlpha_[prevIndex] *
-            (gwDO_[prevIndex] - outputDo_.dox[prevIndex]);
+
+   // The DO concentration at the end of each time step is the retained
+   // fraction of the DO at its start plus the input over the step. The
+   // inputs are stored in dox until the scan replaces them with the
+   // concentrations. Without a dependence between time steps, the loop
+   // can be vectorized.
+   dox[0] = initialDO_;
+   for (int i = 0; i < lastIndex; i++) {
+      double k = k600 * kDoSchmidt[i];
+      retention[i] = 1 - dt[i] * k;
+      dox[i + 1] =
+         dailyGPP * parDist[i] * ratioDoCFix +
+         dailyER * dt[i] * ratioDoCResp +
+         dt[i] * k * satDo[i];
+      if (groundwater) {
+         retention[i] -= dt[i] * gwAlpha_[i];
+         dox[i + 1] += dt[i] * gwAlpha_[i] * gwDO_[i];
+      }
+   }
+   linearScan(scanThreads_, length_, retention, dox);
+
+   if (diagnostics) {
+      double* cFixation = output_.cFixation;
+      double* cRespiration = output_.cRespiration;
+      double* doProduction = outputDo_.doProduction;
+      double* doConsumption = outputDo_.doConsumption;
+      double* doEquilibration = outputDo_.doEquilibration;
+      double* kDo = kDo_;
+      for (int i = 0; i < lastIndex; i++) {
+         double k = k600 * kDoSchmidt[i];
+         cFixation[i] = dailyGPP * parDist[i];
+         cRespiration[i] = dailyER * dt[i];
+         doProduction[i] = cFixation[i] * ratioDoCFix;
+         doConsumption[i] = cRespiration[i] * ratioDoCResp;
+         kDo[i] = k;
+         doEquilibration[i] = dt[i] * k * (satDo[i] - dox[i]);
       }
 
-      parDist_[i] = parDistCalculator_.calc(
-         dt_[i],
-         par_[i]
-      );
-      output_.cFixation[i] = dailyGPP_ * parDist_[i];
-      output_.cRespiration[i] = dailyER_ * dt_[i];
-
-      outputDo_.doProduction[i] =
-         output_.cFixation[i] * ratioDoCFix_;
-      outputDo_.doConsumption[i] =
-         output_.cRespiration[i] * ratioDoCResp_;
-
-      kDo_[i] = kSchmidtDoCalculator_(temp_[i], k600_);
-      outputDo_.doEquilibration[i] =
-         dt_[i] * kDo_[i] * (satDo_[i] - outputDo_.dox[i]);
+      cFixation[lastIndex] = 0;
+      cRespiration[lastIndex] = 0;
+
+      doConsumption[lastIndex] = 0;
+      doProduction[lastIndex] = 0;
+      kDo[lastIndex] = k600 * kDoSchmidt[lastIndex];
+      doEquilibration[lastIndex] = 0;
    }
 
-   long prevLastIndex = lastIndex - 1;
-   outputDo_.dox[lastIndex] =
-      outputDo_.dox[prevLastIndex] +
-      outputDo_.doProduction[prevLastIndex] +
-      outputDo_.doConsumption[prevLastIndex] +
-      outputDo_.doEquilibration[prevLastIndex];
-   if (gwDO_) {
-      outputDo_.dox[lastIndex] +=
-         dt_[prevLastIndex] * gwAlpha_[prevLastIndex] *
-         (gwDO_[prevLastIndex] - outputDo_.dox[prevLastIndex]);
+   // The sensitivities follow recurrences with the same retention
+   if (sensitivity) {
+      sensitivityDo_.dailyGPP[0] = 0;
+      sensitivityDo_.dailyER[0] = 0;
+      sensitivityDo_.k600[0] = 0;
+      for (int i = 0; i < lastIndex; i++) {
+         sensitivityDo_.dailyGPP[i + 1] = parDist[i] * ratioDoCFix;
+         sensitivityDo_.dailyER[i + 1] = dt[i] * ratioDoCResp;
+         sensitivityDo_.k600[i + 1] =
+            dt[i] * kDoSchmidt[i] * (satDo[i] - dox[i]);
+      }
+      linearScan(scanThreads_, length_, retention, sensitivityDo_.dailyGPP);
+      linearScan(scanThreads_, length_, retention, sensitivityDo_.dailyER);
+      linearScan(scanThreads_, length_, retention, sensitivityDo_.k600);
    }
+}
 
-   parDist_[lastIndex] = 0;
-   output_.cFixation[lastIndex] = 0;
-   output_.cRespiration[lastIndex] = 0;
+void MetabForwardEulerDo::runBatch
+(
+   int numSets,
+   const double* dailyGPP,
+   const double* dailyER,
+   const double* k600,
+   const double* ratioDoCFix,
+   const double* ratioDoCResp,
+   double* dox
+)
+{
+   int lastIndex = length_ - 1;
+   for(int first = 0; first < numSets; first += batchLanes) {
+      int numLanes = numSets - first < batchLanes ?
+         numSets - first : batchLanes;
 
-   outputDo_.doConsumption[lastIndex] = 0;
-   outputDo_.doProduction[lastIndex] = 0;
+      // Unused lanes repeat the first set of the block so the
+      // lanes can be advanced without branches
+      double gpp[batchLanes];
+      double er[batchLanes];
+      double k[batchLanes];
+      double ratioFix[batchLanes];
+      double ratioResp[batchLanes];
+      double x[batchLanes];
+      for(int lane = 0; lane < batchLanes; lane++) {
+         int set = first + (lane < numLanes ? lane : 0);
+         gpp[lane] = dailyGPP[set];
+         er[lane] = dailyER[set];
+         k[lane] = k600[set];
+         ratioFix[lane] = ratioDoCFix ? ratioDoCFix[set] : ratioDoCFix_;
+         ratioResp[lane] = ratioDoCResp ? ratioDoCResp[set] : ratioDoCResp_;
+         x[lane] = initialDO_;
+      }
 
-   kDo_[lastIndex] = kSchmidtDoCalculator_(temp_[lastIndex], k600_);
-   outputDo_.doEquilibration[lastIndex] = 0;
+      double* blockDox = dox + (long)first * length_;
+      for(int i = 0; i < lastIndex; i++) {
+         for(int lane = 0; lane < numLanes; lane++) {
+            blockDox[(long)lane * length_ + i] = x[lane];
+         }
+         double gw = gwDO_ ? dt_[i] * gwAlpha_[i] : 0;
+         double gwConc = gwDO_ ? gwDO_[i] : 0;
+         for(int lane = 0; lane < batchLanes; lane++) {
+            double production = gpp[lane] * parDist_[i] * ratioFix[lane];
+            double consumption = er[lane] * dt_[i] * ratioResp[lane];
+            double equilibration =
+               dt_[i] * (k[lane] * kDoSchmidt_[i]) * (satDo_[i] - x[lane]);
+            x[lane] =
+               x[lane] + production + consumption + equilibration +
+               gw * (gwConc - x[lane]);
+         }
+      }
+      for(int lane = 0; lane < numLanes; lane++) {
+         blockDox[(long)lane * length_ + lastIndex] = x[lane];
+      }
+   }
+}
 
+Metab* MetabForwardEulerDo::clone()
+{
+   MetabForwardEulerDo* model = new MetabForwardEulerDo();
+   model->initializeCopy(this);
+   return model;
 }
@@ -6,9 +6,15 @@ void MetabForwardEulerDoDic::run()
    // Run the base class DO model
    MetabForwardEulerDo::run();
 
-   // Set the first elements for henry's coefficient and DIC
-   carbonateEq_.reset(temp_[0], 0);
-   kH_[0] = carbonateEq_.kHenryCO2;
+   // Fluxes of DIC are carried between time steps in local variables,
+   // and only stored when the diagnostic output is requested. Carbon
+   // fixation and respiration are recalculated from the parameters
+   // because the DO model may not have stored them.
+   bool diagnostics = !predictionsOnly_;
+
+   // Set the first elements for carbonate constants and DIC
+   carbonateEq_.copyConstants(carbonateConstants_[0]);
+   carbonateEq_.lastpH = -1;
    outputDic_.dic[0] = initialDIC_;
 
    // Run the carbonate equilibrium for initial pH and pCO2
@@ -25,27 +31,29 @@ void MetabForwardEulerDoDic::run()
    outputDic_.pH[0] = dicOptim[0];
 
    // Calculate initial dic inputs and outputs
-   outputDic_.dicProduction[0] =
-      output_.cRespiration[0] * ratioDicCResp_;
-   outputDic_.dicConsumption[0] =
-      output_.cFixation[0] * ratioDicCFix_;
-
-   kCO2_[0] = kSchmidtCO2Calculator_(temp_[0], k600_);
-   outputDic_.co2Equilibration[0] =
-      dt_[0] * kCO2_[0] *
+   double production = dailyER_ * dt_[0] * ratioDicCResp_;
+   double consumption = dailyGPP_ * parDist_[0] * ratioDicCFix_;
+   double k = k600_ * kCO2Schmidt_[0];
+   double equilibration =
+      dt_[0] * k *
       kH_[0] * (pCO2air_[0] - outputDic_.pCO2[0]);
+   if (diagnostics) {
+      outputDic_.dicProduction[0] = production;
+      outputDic_.dicConsumption[0] = consumption;
+      kCO2_[0] = k;
+      outputDic_.co2Equilibration[0] = equilibration;
+   }
 
    int lastIndex = length_ - 1;
    for(int i = 1; i < lastIndex; i++) {
-      carbonateEq_.reset(temp_[i], 0);
-      kH_[i] = carbonateEq_.kHenryCO2;
+      carbonateEq_.copyConstants(carbonateConstants_[i]);
 
       long prevIndex = i - 1;
       outputDic_.dic[i] =
          outputDic_.dic[prevIndex] +
-         outputDic_.dicProduction[prevIndex] +
-         outputDic_.dicConsumption[prevIndex] +
-         outputDic_.co2Equilibration[prevIndex];
+         production +
+         consumption +
+         equilibration;
       if (gwDIC_) {
          outputDic_.dic[i] +=
             dt_[prevIndex] * gwAlpha_[prevIndex] *
@@ -63,26 +71,28 @@ void MetabForwardEulerDoDic::run()
       outputDic_.pCO2[i] = dicOptim[1];
       outputDic_.pH[i] = dicOptim[0];
 
-      outputDic_.dicProduction[i] =
-         output_.cRespiration[i] * ratioDicCResp_;
-      outputDic_.dicConsumption[i] =
-         output_.cFixation[i] * ratioDicCFix_;
-
-      kCO2_[i] = kSchmidtCO2Calculator_(temp_[i], k600_);
-      outputDic_.co2Equilibration[i] =
-         dt_[i] * kCO2_[i] *
+      production = dailyER_ * dt_[i] * ratioDicCResp_;
+      consumption = dailyGPP_ * parDist_[i] * ratioDicCFix_;
+      k = k600_ * kCO2Schmidt_[i];
+      equilibration =
+         dt_[i] * k *
          kH_[i] * (pCO2air_[i] - outputDic_.pCO2[i]);
+      if (diagnostics) {
+         outputDic_.dicProduction[i] = production;
+         outputDic_.dicConsumption[i] = consumption;
+         kCO2_[i] = k;
+         outputDic_.co2Equilibration[i] = equilibration;
+      }
    }
 
-   carbonateEq_.reset(temp_[lastIndex], 0);
-   kH_[lastIndex] = carbonateEq_.kHenryCO2;
+   carbonateEq_.copyConstants(carbonateConstants_[lastIndex]);
 
    long prevLastIndex = lastIndex - 1;
    outputDic_.dic[lastIndex] =
       outputDic_.dic[prevLastIndex] +
-      outputDic_.dicProduction[prevLastIndex] +
-      outputDic_.dicConsumption[prevLastIndex] +
-      outputDic_.co2Equilibration[prevLastIndex];
+      production +
+      consumption +
+      equilibration;
    if (gwDIC_) {
       outputDic_.dic[lastIndex] +=
          dt_[prevLastIndex] * gwAlpha_[prevLastIndex] *
@@ -100,9 +110,18 @@ void MetabForwardEulerDoDic::run()
    outputDic_.pCO2[lastIndex] = dicOptim[1];
    outputDic_.pH[lastIndex] = dicOptim[0];
 
-   outputDic_.dicProduction[lastIndex] = 0;
-   outputDic_.dicConsumption[lastIndex] = 0;
+   if (diagnostics) {
+      outputDic_.dicProduction[lastIndex] = 0;
+      outputDic_.dicConsumption[lastIndex] = 0;
 
-   kCO2_[lastIndex] = kSchmidtCO2Calculator_(temp_[lastIndex], k600_);
-   outputDic_.co2Equilibration[lastIndex] = 0;
+      kCO2_[lastIndex] = k600_ * kCO2Schmidt_[lastIndex];
+      outputDic_.co2Equilibration[lastIndex] = 0;
+   }
+}
+
+Metab* MetabForwardEulerDoDic::clone()
+{
+   MetabForwardEulerDoDic* model = new MetabForwardEulerDoDic();
+   model->MetabDoDic::initializeCopy(this);
+   return model;
 }
@@ -0,0 +1,288 @@
+// Copies the values of the parcels in a block into an array of lanes,
+// with unused lanes repeating the first parcel of the block
+static inline void gatherLanes
+(
+   const double* values,
+   int block,
+   int numLanes,
+   double* lanes
+)
+{
+   if (numLanes == batchLanes) {
+      for (int lane = 0; lane < batchLanes; lane++) {
+         lanes[lane] = values[block + lane];
+      }
+   } else {
+      for (int lane = 0; lane < batchLanes; lane++) {
+         lanes[lane] = values[block + (lane < numLanes ? lane : 0)];
+      }
+   }
+}
+
+// Copies the used lanes of a block into the values of the parcels
+static inline void scatterLanes
+(
+   const double* lanes,
+   int block,
+   int numLanes,
+   double* values
+)
+{
+   if (numLanes == batchLanes) {
+      for (int lane = 0; lane < batchLanes; lane++) {
+         values[block + lane] = lanes[lane];
+      }
+   } else {
+      for (int lane = 0; lane < numLanes; lane++) {
+         values[block + lane] = lanes[lane];
+      }
+   }
+}
+
+template <bool groundwater, bool sensitivity, bool diagnostics>
+void MetabLagrangeCN_runScalar
+(
+   const MetabLagrangeCN_Parcels& parcels,
+   int first,
+   int last
+)
+{
+   // Local copies of the parameters and arrays let the compiler
+   // keep them in registers, as the output arrays could otherwise
+   // alias the structure
+   const double dailyGPP = parcels.dailyGPP;
+   const double dailyER = parcels.dailyER;
+   const double k600 = parcels.k600;
+   const double ratioDoCFix = parcels.ratioDoCFix;
+   const double ratioDoCResp = parcels.ratioDoCResp;
+   const double* travelTimes = parcels.travelTimes;
+   const double* parDist = parcels.parDist;
+   const double* upstreamDO = parcels.upstreamDO;
+   const double* upstreamSatDo = parcels.upstreamSatDo;
+   const double* downstreamSatDo = parcels.downstreamSatDo;
+   const double* upstreamkDoSchmidt = parcels.upstreamkDoSchmidt;
+   const double* downstreamkDoSchmidt = parcels.downstreamkDoSchmidt;
+   const double* gwAlpha = parcels.gwAlpha;
+   const double* gwDO = parcels.gwDO;
+   double* cFixation = parcels.cFixation;
+   double* cRespiration = parcels.cRespiration;
+   double* doProduction = parcels.doProduction;
+   double* doConsumption = parcels.doConsumption;
+   double* doEquilibration = parcels.doEquilibration;
+   double* upstreamkDo = parcels.upstreamkDo;
+   double* downstreamkDo = parcels.downstreamkDo;
+   double* dox = parcels.dox;
+   double* sensitivityDailyGPP = parcels.sensitivityDailyGPP;
+   double* sensitivityDailyER = parcels.sensitivityDailyER;
+   double* sensitivityk600 = parcels.sensitivityk600;
+
+   for (int i = first; i < last; i++) {
+      double fixation = dailyGPP * parDist[i];
+      double respiration = dailyER * travelTimes[i];
+
+      double production = fixation * ratioDoCFix;
+      double consumption = respiration * ratioDoCResp;
+
+      double upstreamk = k600 * upstreamkDoSchmidt[i];
+      double downstreamk = k600 * downstreamkDoSchmidt[i];
+      double avgkDO = 0.5 * (upstreamk + downstreamk);
+      double equilibration =
+         travelTimes[i] *
+         avgkDO *
+         0.5 * (upstreamSatDo[i] - upstreamDO[i] + downstreamSatDo[i]);
+
+      if (diagnostics) {
+         cFixation[i] = fixation;
+         cRespiration[i] = respiration;
+         doProduction[i] = production;
+         doConsumption[i] = consumption;
+         upstreamkDo[i] = upstreamk;
+         downstreamkDo[i] = downstreamk;
+         doEquilibration[i] = equilibration;
+      }
+
+      double numerator =
+         upstreamDO[i] +
+         production +
+         consumption +
+         equilibration;
+      double denominator = 1 + (0.5 * (travelTimes[i] * avgkDO));
+
+      if (groundwater) {
+         numerator += travelTimes[i] * gwAlpha[i] *
+            (gwDO[i] - (0.5 * upstreamDO[i]));
+         denominator += 0.5 * (travelTimes[i] * gwAlpha[i]);
+      }
+
+      dox[i] = numerator / denominator;
+
+      // Derivatives of DO with respect to the parameters
+      if (sensitivity) {
+         double avgkDOSchmidt =
+            0.5 * (upstreamkDoSchmidt[i] + downstreamkDoSchmidt[i]);
+         sensitivityDailyGPP[i] = parDist[i] * ratioDoCFix / denominator;
+         sensitivityDailyER[i] = travelTimes[i] * ratioDoCResp / denominator;
+         sensitivityk600[i] =
+            travelTimes[i] * avgkDOSchmidt * 0.5 * (
+               upstreamSatDo[i] - upstreamDO[i] + downstreamSatDo[i] - dox[i]
+            ) / denominator;
+      }
+   }
+}
+
+template <bool groundwater, bool sensitivity, bool diagnostics>
+void MetabLagrangeCN_runLanes
+(
+   const MetabLagrangeCN_Parcels& parcels,
+   int first,
+   int last
+)
+{
+   const double dailyGPP = parcels.dailyGPP;
+   const double dailyER = parcels.dailyER;
+   const double k600 = parcels.k600;
+   const double ratioDoCFix = parcels.ratioDoCFix;
+   const double ratioDoCResp = parcels.ratioDoCResp;
+
+   for (int block = first; block < last; block += batchLanes) {
+      int numLanes = last - block < batchLanes ? last - block : batchLanes;
+
+      // Inputs of the parcels in the block are gathered into local
+      // arrays of lanes, so the loops below have a fixed number of
+      // iterations over arrays that cannot alias the output
+      double travelTime[batchLanes];
+      double parDist[batchLanes];
+      double upstreamDO[batchLanes];
+      double upstreamSatDo[batchLanes];
+      double downstreamSatDo[batchLanes];
+      double upstreamkDoSchmidt[batchLanes];
+      double downstreamkDoSchmidt[batchLanes];
+      double gwAlpha[batchLanes];
+      double gwDO[batchLanes];
+      gatherLanes(parcels.travelTimes, block, numLanes, travelTime);
+      gatherLanes(parcels.parDist, block, numLanes, parDist);
+      gatherLanes(parcels.upstreamDO, block, numLanes, upstreamDO);
+      gatherLanes(parcels.upstreamSatDo, block, numLanes, upstreamSatDo);
+      gatherLanes(parcels.downstreamSatDo, block, numLanes, downstreamSatDo);
+      gatherLanes(
+         parcels.upstreamkDoSchmidt,
+         block,
+         numLanes,
+         upstreamkDoSchmidt
+      );
+      gatherLanes(
+         parcels.downstreamkDoSchmidt,
+         block,
+         numLanes,
+         downstreamkDoSchmidt
+      );
+      if (groundwater) {
+         gatherLanes(parcels.gwAlpha, block, numLanes, gwAlpha);
+         gatherLanes(parcels.gwDO, block, numLanes, gwDO);
+      }
+
+      // Same arithmetic as MetabLagrangeCN_runScalar(), in the same
+      // order, so both give identical results
+      double fixation[batchLanes];
+      double respiration[batchLanes];
+      double production[batchLanes];
+      double consumption[batchLanes];
+      double upstreamk[batchLanes];
+      double downstreamk[batchLanes];
+      double equilibration[batchLanes];
+      double denominator[batchLanes];
+      double dox[batchLanes];
+      for (int lane = 0; lane < batchLanes; lane++) {
+         fixation[lane] = dailyGPP * parDist[lane];
+         respiration[lane] = dailyER * travelTime[lane];
+
+         production[lane] = fixation[lane] * ratioDoCFix;
+         consumption[lane] = respiration[lane] * ratioDoCResp;
+
+         upstreamk[lane] = k600 * upstreamkDoSchmidt[lane];
+         downstreamk[lane] = k600 * downstreamkDoSchmidt[lane];
+         double avgkDO = 0.5 * (upstreamk[lane] + downstreamk[lane]);
+         equilibration[lane] =
+            travelTime[lane] *
+            avgkDO *
+            0.5 * (
+               upstreamSatDo[lane] - upstreamDO[lane] + downstreamSatDo[lane]
+            );
+
+         double numerator =
+            upstreamDO[lane] +
+            production[lane] +
+            consumption[lane] +
+            equilibration[lane];
+         denominator[lane] = 1 + (0.5 * (travelTime[lane] * avgkDO));
+
+         if (groundwater) {
+            numerator += travelTime[lane] * gwAlpha[lane] *
+               (gwDO[lane] - (0.5 * upstreamDO[lane]));
+            denominator[lane] += 0.5 * (travelTime[lane] * gwAlpha[lane]);
+         }
+
+         dox[lane] = numerator / denominator[lane];
+      }
+      scatterLanes(dox, block, numLanes, parcels.dox);
+
+      if (diagnostics) {
+         scatterLanes(fixation, block, numLanes, parcels.cFixation);
+         scatterLanes(respiration, block, numLanes, parcels.cRespiration);
+         scatterLanes(production, block, numLanes, parcels.doProduction);
+         scatterLanes(consumption, block, numLanes, parcels.doConsumption);
+         scatterLanes(upstreamk, block, numLanes, parcels.upstreamkDo);
+         scatterLanes(downstreamk, block, numLanes, parcels.downstreamkDo);
+         scatterLanes(
+            equilibration,
+            block,
+            numLanes,
+            parcels.doEquilibration
+         );
+      }
+
+      // Derivatives of DO with respect to the parameters
+      if (sensitivity) {
+         double dGPP[batchLanes];
+         double dER[batchLanes];
+         double dk600[batchLanes];
+         for (int lane = 0; lane < batchLanes; lane++) {
+            double avgkDOSchmidt =
+               0.5 * (upstreamkDoSchmidt[lane] + downstreamkDoSchmidt[lane]);
+            dGPP[lane] = parDist[lane] * ratioDoCFix / denominator[lane];
+            dER[lane] = travelTime[lane] * ratioDoCResp / denominator[lane];
+            dk600[lane] =
+               travelTime[lane] * avgkDOSchmidt * 0.5 * (
+                  upstreamSatDo[lane] - upstreamDO[lane] +
+                  downstreamSatDo[lane] - dox[lane]
+               ) / denominator[lane];
+         }
+         scatterLanes(dGPP, block, numLanes, parcels.sensitivityDailyGPP);
+         scatterLanes(dER, block, numLanes, parcels.sensitivityDailyER);
+         scatterLanes(dk600, block, numLanes, parcels.sensitivityk600);
+      }
+   }
+}
+
+template <bool groundwater, bool sensitivity, bool diagnostics, bool lanes>
+void MetabLagrangeCN_run
+(
+   const MetabLagrangeCN_Parcels& parcels,
+   int first,
+   int last
+)
+{
+   if (lanes) {
+      MetabLagrangeCN_runLanes<groundwater, sensitivity, diagnostics>(
+         parcels,
+         first,
+         last
+      );
+   } else {
+      MetabLagrangeCN_runScalar<groundwater, sensitivity, diagnostics>(
+         parcels,
+         first,
+         last
+      );
+   }
+}
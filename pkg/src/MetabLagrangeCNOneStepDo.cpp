@@ -3,43 +3,91 @@
 
 void MetabLagrangeCNOneStepDo::run()
 {
-   // Loop through time steps
-   for (int i = 0; i < numParcels_; i++) {
-      parDist_[i] = parDistCalculator_.calc(
-         travelTimes_[i],
-         parAvg_[i]
-      );
-      output_.cFixation[i] = dailyGPP_ * parDist_[i];
-      output_.cRespiration[i] = dailyER_ * travelTimes_[i];
-
-      outputDo_.doProduction[i] =
-         output_.cFixation[i] * ratioDoCFix_;
-      outputDo_.doConsumption[i] =
-         output_.cRespiration[i] * ratioDoCResp_;
+   if (scalarParcels_) {
+      if (predictionsOnly_) {
+         selectParcels<false, false>();
+      } else {
+         selectParcels<true, false>();
+      }
+   } else {
+      if (predictionsOnly_) {
+         selectParcels<false, true>();
+      } else {
+         selectParcels<true, true>();
+      }
+   }
+}
 
-      upstreamkDo_[i] = kSchmidtDoCalculator_(upstreamTemp_[i], k600_);
-      downstreamkDo_[i] = kSchmidtDoCalculator_(downstreamTemp_[i], k600_);
-      double avgkDO = 0.5 * (upstreamkDo_[i] + downstreamkDo_[i]);
-      outputDo_.doEquilibration[i] =
-         travelTimes_[i] *
-         avgkDO *
-         0.5 * (upstreamSatDo_[i] - upstreamDO_[i] + downstreamSatDo_[i]);
+template <bool diagnostics, bool lanes>
+void MetabLagrangeCNOneStepDo::selectParcels()
+{
+   if (gwDO_) {
+      if (calcSensitivity_) {
+         runParcels<true, true, diagnostics, lanes>();
+      } else {
+         runParcels<true, false, diagnostics, lanes>();
+      }
+   } else {
+      if (calcSensitivity_) {
+         runParcels<false, true, diagnostics, lanes>();
+      } else {
+         runParcels<false, false, diagnostics, lanes>();
+      }
+   }
+}
 
-      double numerator =
-         upstreamDO_[i] +
-         outputDo_.doProduction[i] +
-         outputDo_.doConsumption[i] +
-         outputDo_.doEquilibration[i];
-      double denominator =
-         1 + (0.5 * (travelTimes_[i] * avgkDO));
+template <bool groundwater, bool sensitivity, bool diagnostics, bool lanes>
+void MetabLagrangeCNOneStepDo::runParcels()
+{
+   MetabLagrangeCN_Parcels parcels;
+   parcels.dailyGPP = dailyGPP_;
+   parcels.dailyER = dailyER_;
+   parcels.k600 = k600_;
+   parcels.ratioDoCFix = ratioDoCFix_;
+   parcels.ratioDoCResp = ratioDoCResp_;
+   parcels.travelTimes = travelTimes_;
+   parcels.parDist = parDist_;
+   parcels.upstreamDO = upstreamDO_;
+   parcels.upstreamSatDo = upstreamSatDo_;
+   parcels.downstreamSatDo = downstreamSatDo_;
+   parcels.upstreamkDoSchmidt = upstreamkDoSchmidt_;
+   parcels.downstreamkDoSchmidt = downstreamkDoSchmidt_;
+   parcels.gwAlpha = gwAlpha_;
+   parcels.gwDO = gwDO_;
+   parcels.dox = outputDo_.dox;
+   parcels.cFixation = output_.cFixation;
+   parcels.cRespiration = output_.cRespiration;
+   parcels.doProduction = outputDo_.doProduction;
+   parcels.doConsumption = outputDo_.doConsumption;
+   parcels.doEquilibration = outputDo_.doEquilibration;
+   parcels.upstreamkDo = upstreamkDo_;
+   parcels.downstreamkDo = downstreamkDo_;
+   parcels.sensitivityDailyGPP = sensitivityDo_.dailyGPP;
+   parcels.sensitivityDailyER = sensitivityDo_.dailyER;
+   parcels.sensitivityk600 = sensitivityDo_.k600;
 
-      if (gwDO_) {
-         numerator += travelTimes_[i] * gwAlpha_[i] *
-            (gwDO_[i] - (0.5 * upstreamDO_[i]));
-         denominator += 0.5 * (travelTimes_[i] * gwAlpha_[i]);
+   // Parcels are independent of each other, so chunks of parcels are
+   // run in parallel. The PAR distribution and the temperature
+   // dependence of gas exchange are calculated once by initialize().
+   // Fluxes are only stored when the diagnostic output is requested.
+   parallelChunks(
+      parcelThreads_,
+      numParcels_,
+      parcelChunkLength,
+      [&](int, int first, int last) {
+         MetabLagrangeCN_run<groundwater, sensitivity, diagnostics, lanes>(
+            parcels,
+            first,
+            last
+         );
       }
+   );
+}
 
-      outputDo_.dox[i] = numerator / denominator;
-   }
-
+Metab* MetabLagrangeCNOneStepDo::clone()
+{
+   MetabLagrangeCNOneStepDo* model = new MetabLagrangeCNOneStepDo();
+   model->scalarParcels_ = scalarParcels_;
+   model->initializeCopy(this);
+   return model;
 }
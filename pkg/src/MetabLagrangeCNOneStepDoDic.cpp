@@ -1,66 +1,117 @@
 #include "metabc.h"
 #include <cmath>
+#include <vector>
 
 void MetabLagrangeCNOneStepDoDic::run()
 {
    MetabLagrangeCNOneStepDo::run();
 
-   for(int i = 0; i < numParcels_; i++) {
-      double upstreamDeficit =
-         upstreamSatCO2_[i] - (upstreamkH_[i] * upstreampCO2_[i]);
+   // Fluxes of DIC are only stored when the diagnostic output is
+   // requested. Carbon fixation and respiration are recalculated from
+   // the parameters because the DO model may not have stored them.
+   bool diagnostics = !predictionsOnly_;
 
-      outputDic_.dicProduction[i] =
-         output_.cRespiration[i] * ratioDicCResp_;
-      outputDic_.dicConsumption[i] =
-         output_.cFixation[i] * ratioDicCFix_;
+   // Chunks of parcels are run in parallel, each thread with its own
+   // carbonate equilibrium workspace. Warm starts of the pH search
+   // follow the parcels of a chunk in order, starting afresh with each
+   // chunk so results do not depend on the number of threads.
+   std::vector<CarbonateEq> workspaces(
+      parallelThreads(parcelThreads_, numParcels_),
+      carbonateEq_
+   );
+   parallelChunks(
+      parcelThreads_,
+      numParcels_,
+      parcelChunkLength,
+      [&](int thread, int first, int last) {
+         CarbonateEq& carbonateEq = workspaces[thread];
+         carbonateEq.lastpH = -1;
+         for(int i = first; i < last; i++) {
+            double upstreamDeficit =
+               upstreamSatCO2_[i] - (upstreamkH_[i] * upstreampCO2_[i]);
 
-      upstreamkCO2_[i] = kSchmidtCO2Calculator_(upstreamTemp_[i], k600_);
-      downstreamkCO2_[i] = kSchmidtCO2Calculator_(downstreamTemp_[i], k600_);
-      double avgkCO2 = 0.5 * (upstreamkCO2_[i] + downstreamkCO2_[i]);
-      outputDic_.co2Equilibration[i] =
-         travelTimes_[i] *
-         avgkCO2 *
-         0.5 * (upstreamDeficit + downstreamSatCO2_[i]);
+            double production = dailyER_ * travelTimes_[i] * ratioDicCResp_;
+            double consumption = dailyGPP_ * parDist_[i] * ratioDicCFix_;
 
-      carbonateEq_.reset(downstreamTemp_[i], 0);
+            double upstreamk = k600_ * upstreamkCO2Schmidt_[i];
+            double downstreamk = k600_ * downstreamkCO2Schmidt_[i];
+            double avgkCO2 = 0.5 * (upstreamk + downstreamk);
+            double equilibration =
+               travelTimes_[i] *
+               avgkCO2 *
+               0.5 * (upstreamDeficit + downstreamSatCO2_[i]);
+            if (diagnostics) {
+               outputDic_.dicProduction[i] = production;
+               outputDic_.dicConsumption[i] = consumption;
+               upstreamkCO2_[i] = upstreamk;
+               downstreamkCO2_[i] = downstreamk;
+               outputDic_.co2Equilibration[i] = equilibration;
+            }
 
-      proposeDic_info info;
-      info.carbonateEq = &carbonateEq_;
-      info.alkalinity = downstreamAlkalinity_[i];
-      info.kCO2 = avgkCO2;
-      info.dt = travelTimes_[i];
-      info.target =
-         upstreamDIC_[i] +
-         outputDic_.dicProduction[i] +
-         outputDic_.dicConsumption[i] +
-         outputDic_.co2Equilibration[i];
-      if (gwDIC_) {
-         info.gwAlpha = gwAlpha_[i];
-         info.target +=
-            travelTimes_[i] * gwAlpha_[i] *
-            (gwDIC_[i] - 0.5 * upstreamDIC_[i]);
-      } else {
-         info.gwAlpha = -1;
-      }
+            carbonateEq.copyConstants(downstreamCarbonateConstants_[i]);
+
+            proposeDic_info info;
+            info.carbonateEq = &carbonateEq;
+            info.alkalinity = downstreamAlkalinity_[i];
+            info.kCO2 = avgkCO2;
+            info.dt = travelTimes_[i];
+            info.target =
+               upstreamDIC_[i] +
+               production +
+               consumption +
+               equilibration;
+            if (gwDIC_) {
+               info.gwAlpha = gwAlpha_[i];
+               info.target +=
+                  travelTimes_[i] * gwAlpha_[i] *
+                  (gwDIC_[i] - 0.5 * upstreamDIC_[i]);
+            } else {
+               info.gwAlpha = -1;
+            }
+
+            if (dicSolver_ == CarbonateEq::newton) {
+               // Seed from an explicit predictor using the upstream pCO2
+               outputDic_.dic[i] = newtonDic(
+                  &info,
+                  info.target -
+                     0.5 * info.dt * avgkCO2 *
+                        downstreamkH_[i] * upstreampCO2_[i],
+                  minDIC,
+                  maxDIC,
+                  tolerance
+               );
+            } else {
+               outputDic_.dic[i] = Brent_fmin(
+                  minDIC,
+                  maxDIC,
+                  proposeDic,
+                  &info,
+                  tolerance
+               );
+            }
 
-      outputDic_.dic[i] = Brent_fmin(
-         minDIC,
-         maxDIC,
-         proposeDic,
-         &info,
-         tolerance
-      );
+            double dicOptim[2];
+            carbonateEq.optfCO2FromDICTotalAlk(
+               outputDic_.dic[i] * 1e-6,
+               downstreamAlkalinity_[i] * 1e-6,
+               1e-5,
+               2,
+               12,
+               dicOptim
+            );
+            outputDic_.pCO2[i] = dicOptim[1];
+            outputDic_.pH[i] = dicOptim[0];
+         }
+      }
+   );
+}
 
-      double dicOptim[2];
-      carbonateEq_.optfCO2FromDICTotalAlk(
-         outputDic_.dic[i] * 1e-6,
-         downstreamAlkalinity_[i] * 1e-6,
-         1e-5,
-         2,
-         12,
-         dicOptim
-      );
-      outputDic_.pCO2[i] = dicOptim[1];
-      outputDic_.pH[i] = dicOptim[0];
-   }
+Metab* MetabLagrangeCNOneStepDoDic::clone()
+{
+   MetabLagrangeCNOneStepDoDic* model = new MetabLagrangeCNOneStepDoDic();
+   model->MetabLagrangeDoDic::initializeCopy(this);
+   model->minDIC = minDIC;
+   model->maxDIC = maxDIC;
+   model->tolerance = tolerance;
+   return model;
 }
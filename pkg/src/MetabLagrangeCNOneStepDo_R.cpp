@@ -11,3 +11,24 @@ SEXP MetabLagrangeCNOneStepDo_destructor(SEXP externalPointer)
 
    return R_NilValue;
 }
+
+SEXP MetabLagrangeCNOneStepDo_setScalarParcels
+(
+   SEXP metabExternalPointer,
+   SEXP value
+)
+{
+   // The setting belongs to the one step models of both the DO and the
+   // DO and DIC classes, which are reached through their common base
+   Metab* metab = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   MetabLagrangeCNOneStepDo* model =
+      dynamic_cast<MetabLagrangeCNOneStepDo*>(metab);
+   if (!model) {
+      error("Only one step Crank Nicolson models have a scalar parcel loop.");
+   }
+   SEXP out = PROTECT(ScalarLogical(model->scalarParcels_));
+   model->scalarParcels_ = asLogical(value);
+
+   UNPROTECT(1);
+   return out;
+}
@@ -1,36 +1,12 @@
 #include "metabc.h"
+#include <cstring>
 
 MetabLagrangeDo::MetabLagrangeDo() :
    Metab()
 {}
 
 MetabLagrangeDo::~MetabLagrangeDo()
-{
-   // Deallocate memory
-   delete[] upstreamDO_;
-   delete[] upstreamTime_;
-   delete[] downstreamTime_;
-   delete[] upstreamTemp_;
-   delete[] downstreamTemp_;
-   delete[] upstreamPAR_;
-   delete[] downstreamPAR_;
-   delete[] airPressure_;
-   delete[] gwDO_;
-
-   delete[] travelTimes_;
-   delete[] upstreamSatDo_;
-   delete[] downstreamSatDo_;
-   delete[] upstreamkDo_;
-   delete[] downstreamkDo_;
-   delete[] parAvg_;
-   delete[] parDist_;
-
-   // Deallocate output
-   delete[] outputDo_.dox;
-   delete[] outputDo_.doProduction;
-   delete[] outputDo_.doConsumption;
-   delete[] outputDo_.doEquilibration;
-}
+{}
 
 void MetabLagrangeDo::initialize
 (
@@ -65,38 +41,40 @@ void MetabLagrangeDo::initialize
 
    numParcels_ = numParcels;
 
-   // Allocate memory
-   upstreamDO_ = new double[numParcels_];
-   upstreamTime_ = new double[numParcels_];
-   downstreamTime_ = new double[numParcels_];
-   upstreamTemp_ = new double[numParcels_];
-   downstreamTemp_ = new double[numParcels_];
-   upstreamPAR_ = new double[numParcels_];
-   downstreamPAR_ = new double[numParcels_];
-   airPressure_ = new double[numParcels_];
+   // Store the forcing arrays
+   upstreamDO_ = storeInput(upstreamDO);
+   upstreamTime_ = storeInput(upstreamTime);
+   downstreamTime_ = storeInput(downstreamTime);
+   upstreamTemp_ = storeInput(upstreamTemp);
+   downstreamTemp_ = storeInput(downstreamTemp);
+   upstreamPAR_ = storeInput(upstreamPAR);
+   downstreamPAR_ = storeInput(downstreamPAR);
+   airPressure_ = storeInput(airPressure);
 
    if (gwAlpha_ && gwDO) {
-      gwDO_ = new double[numParcels_];
-      for(int i = 0; i < numParcels_; i++) {
-         gwDO_[i] = gwDO[i];
-      }
+      gwDO_ = storeInput(gwDO);
    } else {
       gwDO_ = nullptr;
    }
 
-   travelTimes_ = new double[numParcels_];
-   upstreamSatDo_ = new double[numParcels_];
-   downstreamSatDo_ = new double[numParcels_];
-   upstreamkDo_ = new double[numParcels_];
-   downstreamkDo_ = new double[numParcels_];
-   parAvg_ = new double[numParcels_];
-   parDist_ = new double[numParcels_];
+   travelTimes_ = arena_.allocate(numParcels_);
+   upstreamSatDo_ = arena_.allocate(numParcels_);
+   downstreamSatDo_ = arena_.allocate(numParcels_);
+   upstreamkDo_ = arena_.allocate(numParcels_);
+   downstreamkDo_ = arena_.allocate(numParcels_);
+   upstreamkDoSchmidt_ = arena_.allocate(numParcels_);
+   downstreamkDoSchmidt_ = arena_.allocate(numParcels_);
+   sensitivityDo_.dailyGPP = arena_.allocate(numParcels_);
+   sensitivityDo_.dailyER = arena_.allocate(numParcels_);
+   sensitivityDo_.k600 = arena_.allocate(numParcels_);
+   parAvg_ = arena_.allocate(numParcels_);
+   parDist_ = arena_.allocate(numParcels_);
 
    // Allocate output
-   outputDo_.dox = new double[numParcels_];
-   outputDo_.doProduction = new double[numParcels_];
-   outputDo_.doConsumption = new double[numParcels_];
-   outputDo_.doEquilibration = new double[numParcels_];
+   outputDo_.dox = arena_.allocate(numParcels_);
+   outputDo_.doProduction = arena_.allocate(numParcels_);
+   outputDo_.doConsumption = arena_.allocate(numParcels_);
+   outputDo_.doEquilibration = arena_.allocate(numParcels_);
 
    // Set the attributes
    ratioDoCFix_ = ratioDoCFix;
@@ -106,39 +84,64 @@ void MetabLagrangeDo::initialize
    // Length of time vector is one larger than the number of time steps
    lengthTimeVector_ = timeSteps + 1;
 
-   // Calculate values over travel times or at upstream
-   // and downstream times
-   double densityWater;
+   // Travel times and average PAR over travel times
    for(int i = 0; i < numParcels_; i++) {
-      // Copy array values to attributes
-      upstreamDO_[i] = upstreamDO[i];
-      upstreamTime_[i] = upstreamTime[i];
-      downstreamTime_[i] = downstreamTime[i];
-      upstreamTemp_[i] = upstreamTemp[i];
-      downstreamTemp_[i] = downstreamTemp[i];
-      upstreamPAR_[i] = upstreamPAR[i];
-      downstreamPAR_[i] = downstreamPAR[i];
-      airPressure_[i] = airPressure[i];
-
-      // Travel times and average PAR over travel times
       travelTimes_[i] = downstreamTime_[i] - upstreamTime_[i];
       parAvg_[i] = 0.5 * (upstreamPAR_[i] + downstreamPAR_[i]);
+   }
 
-      // Sat DO and gas exchange rates passing the upstream end
-      densityWater = densityCalculator_(upstreamTemp_[i]);
-      upstreamSatDo_[i] = satDoCalculator_(
-         upstreamTemp_[i],
-         densityWater,
-         airPressure_[i] / stdAirPressure
+   // Sat DO passing the upstream and downstream ends, using the array
+   // kernels unless a calculator has been replaced
+   if (
+      densityCalculator_ == densityWaterCalc &&
+      satDoCalculator_ == satDoCalc
+   ) {
+      satDoCalcArray(
+         numParcels_,
+         upstreamTemp_,
+         airPressure_,
+         stdAirPressure,
+         upstreamSatDo_
+      );
+      satDoCalcArray(
+         numParcels_,
+         downstreamTemp_,
+         airPressure_,
+         stdAirPressure,
+         downstreamSatDo_
       );
+   } else {
+      for(int i = 0; i < numParcels_; i++) {
+         double densityWater = densityCalculator_(upstreamTemp_[i]);
+         upstreamSatDo_[i] = satDoCalculator_(
+            upstreamTemp_[i],
+            densityWater,
+            airPressure_[i] / stdAirPressure
+         );
+         densityWater = densityCalculator_(downstreamTemp_[i]);
+         downstreamSatDo_[i] = satDoCalculator_(
+            downstreamTemp_[i],
+            densityWater,
+            airPressure_[i] / stdAirPressure
+         );
+      }
+   }
 
-      // Sat DO and gas exchange rates passing the downstream end
-      densityWater = densityCalculator_(downstreamTemp_[i]);
-      downstreamSatDo_[i] = satDoCalculator_(
-         downstreamTemp_[i],
-         densityWater,
-         airPressure_[i] / stdAirPressure
+   // Temperature dependence of gas exchange, scaled by k600 in run()
+   if (kSchmidtDoCalculator_ == kSchmidtDoCalc) {
+      kSchmidtDoCalcArray(numParcels_, upstreamTemp_, 1, upstreamkDoSchmidt_);
+      kSchmidtDoCalcArray(
+         numParcels_,
+         downstreamTemp_,
+         1,
+         downstreamkDoSchmidt_
       );
+   } else {
+      for(int i = 0; i < numParcels_; i++) {
+         upstreamkDoSchmidt_[i] = kSchmidtDoCalculator_(upstreamTemp_[i], 1);
+         downstreamkDoSchmidt_[i] =
+            kSchmidtDoCalculator_(downstreamTemp_[i], 1);
+      }
    }
 
    // Calculate a total par by integration if the
@@ -160,4 +163,77 @@ void MetabLagrangeDo::initialize
       parTotal_ = parTotal;
    }
    parDistCalculator_.initialize(parTotal_);
+
+   // Distribution of GPP over the parcels does not depend on the parameters
+   for(int i = 0; i < numParcels_; i++) {
+      parDist_[i] = parDistCalculator_.calc(
+         travelTimes_[i],
+         parAvg_[i]
+      );
+   }
+
+   initializeParcels();
+}
+
+void MetabLagrangeDo::initializeParcels()
+{
+}
+
+void MetabLagrangeDo::initializeCopy(MetabLagrangeDo* model)
+{
+   copySettings(model);
+   MetabLagrangeDo::initialize(
+      model->dailyGPP_,
+      model->ratioDoCFix_,
+      model->dailyER_,
+      model->ratioDoCResp_,
+      model->k600_,
+      model->upstreamDO_,
+      model->upstreamTime_,
+      model->downstreamTime_,
+      model->upstreamTemp_,
+      model->downstreamTemp_,
+      model->upstreamPAR_,
+      model->downstreamPAR_,
+      model->parTotal_,
+      model->airPressure_,
+      model->stdAirPressure_,
+      model->numParcels_,
+      model->lengthTimeVector_ - 1,
+      model->gwAlpha_,
+      model->gwDO_
+   );
+}
+
+int MetabLagrangeDo::arenaArrays()
+{
+   return Metab::arenaArrays() + 25;
+}
+
+double** MetabLagrangeDo::getOutputSlot(const char* name)
+{
+   if (!strcmp(name, "dox")) return &outputDo_.dox;
+   if (!strcmp(name, "doProduction")) return &outputDo_.doProduction;
+   if (!strcmp(name, "doConsumption")) return &outputDo_.doConsumption;
+   if (!strcmp(name, "doEquilibration")) return &outputDo_.doEquilibration;
+   if (!strcmp(name, "upstreamkDo")) return &upstreamkDo_;
+   if (!strcmp(name, "downstreamkDo")) return &downstreamkDo_;
+   if (!strcmp(name, "travelTimes")) return &travelTimes_;
+   if (!strcmp(name, "upstreamDoSat")) return &upstreamSatDo_;
+   if (!strcmp(name, "downstreamDoSat")) return &downstreamSatDo_;
+   return Metab::getOutputSlot(name);
+}
+
+Metab_OutputKind MetabLagrangeDo::getOutputKind(const char* name)
+{
+   if (!strcmp(name, "dox")) return outputPrediction;
+   if (!strcmp(name, "travelTimes")) return outputConstant;
+   if (!strcmp(name, "upstreamDoSat")) return outputConstant;
+   if (!strcmp(name, "downstreamDoSat")) return outputConstant;
+   return Metab::getOutputKind(name);
+}
+
+MetabDo_Sensitivity* MetabLagrangeDo::getDoSensitivity()
+{
+   return &sensitivityDo_;
 }
@@ -1,4 +1,5 @@
 #include "metabc.h"
+#include <cstring>
 
 MetabLagrangeDoDic::MetabLagrangeDoDic()
 {
@@ -7,27 +8,7 @@ MetabLagrangeDoDic::MetabLagrangeDoDic()
 
 MetabLagrangeDoDic::~MetabLagrangeDoDic()
 {
-   delete[] upstreamDIC_;
-   delete[] pCO2air_;
-   delete[] upstreamAlkalinity_;
-   delete[] downstreamAlkalinity_;
-   delete[] gwDIC_;
-
-   delete[] upstreampCO2_;
-   delete[] upstreampH_;
-   delete[] upstreamSatCO2_;
-   delete[] downstreamSatCO2_;
-   delete[] upstreamkCO2_;
-   delete[] downstreamkCO2_;
-   delete[] upstreamkH_;
-   delete[] downstreamkH_;
-
-   delete[] outputDic_.pCO2;
-   delete[] outputDic_.dic;
-   delete[] outputDic_.dicProduction;
-   delete[] outputDic_.dicConsumption;
-   delete[] outputDic_.co2Equilibration;
-   delete[] outputDic_.pH;
+   delete[] downstreamCarbonateConstants_;
 }
 
 void MetabLagrangeDoDic::initialize
@@ -82,65 +63,98 @@ void MetabLagrangeDoDic::initialize
       gwDO
    );
 
-   upstreamDIC_ = new double[numParcels_];
-   pCO2air_ = new double[numParcels_];
-   upstreamAlkalinity_ = new double[numParcels_];
-   downstreamAlkalinity_ = new double[numParcels_];
+   upstreamDIC_ = storeInput(upstreamDIC);
+   pCO2air_ = storeInput(pCO2air);
+   upstreamAlkalinity_ = storeInput(upstreamAlkalinity);
+   downstreamAlkalinity_ = storeInput(downstreamAlkalinity);
 
    if (gwAlpha_ && gwDIC) {
-      gwDIC_ = new double[length_];
-      for(int i = 0; i < length_; i++) {
-         gwDIC_[i] = gwDIC[i];
-      }
+      gwDIC_ = storeInput(gwDIC);
    } else {
       gwDIC_ = nullptr;
    }
 
-   upstreampCO2_ = new double[numParcels_];
-   upstreampH_ = new double[numParcels_];
-   upstreamSatCO2_ = new double[numParcels_];
-   downstreamSatCO2_ = new double[numParcels_];
-   upstreamkCO2_ = new double[numParcels_];
-   downstreamkCO2_ = new double[numParcels_];
-   upstreamkH_ = new double[numParcels_];
-   downstreamkH_ = new double[numParcels_];
-
-   outputDic_.pCO2 = new double[numParcels_];
-   outputDic_.dic = new double[numParcels_];
-   outputDic_.dicProduction = new double[numParcels_];
-   outputDic_.dicConsumption = new double[numParcels_];
-   outputDic_.co2Equilibration = new double[numParcels_];
-   outputDic_.pH = new double[numParcels_];
+   upstreampCO2_ = arena_.allocate(numParcels_);
+   upstreampH_ = arena_.allocate(numParcels_);
+   upstreamSatCO2_ = arena_.allocate(numParcels_);
+   downstreamSatCO2_ = arena_.allocate(numParcels_);
+   upstreamkCO2_ = arena_.allocate(numParcels_);
+   downstreamkCO2_ = arena_.allocate(numParcels_);
+   upstreamkCO2Schmidt_ = arena_.allocate(numParcels_);
+   downstreamkCO2Schmidt_ = arena_.allocate(numParcels_);
+   upstreamkH_ = arena_.allocate(numParcels_);
+   downstreamkH_ = arena_.allocate(numParcels_);
+   delete[] downstreamCarbonateConstants_;
+   downstreamCarbonateConstants_ = new CarbonateEq[numParcels_];
+
+   outputDic_.pCO2 = arena_.allocate(numParcels_);
+   outputDic_.dic = arena_.allocate(numParcels_);
+   outputDic_.dicProduction = arena_.allocate(numParcels_);
+   outputDic_.dicConsumption = arena_.allocate(numParcels_);
+   outputDic_.co2Equilibration = arena_.allocate(numParcels_);
+   outputDic_.pH = arena_.allocate(numParcels_);
 
    // Set the attributes
    ratioDicCFix_ = ratioDicCFix;
    ratioDicCResp_ = ratioDicCResp;
 
-   for(int i = 0; i < numParcels_; i++) {
-      // Copy array values into attributes
-      upstreamDIC_[i] = upstreamDIC[i];
-      pCO2air_[i] = pCO2air[i];
-      upstreamAlkalinity_[i] = upstreamAlkalinity[i];
-      downstreamAlkalinity_[i] = downstreamAlkalinity[i];
-
-      carbonateEq_.reset(upstreamTemp_[i], 0);
-      double equil[2];
-      carbonateEq_.optfCO2FromDICTotalAlk(
-         upstreamDIC_[i] * 1e-6,
-         upstreamAlkalinity_[i] * 1e-6,
-         1e-5,
-         2,
-         12,
-         equil
+   // Speciation of the upstream water is solved for chunks of parcels
+   // in parallel, each thread with its own carbonate equilibrium
+   // workspace \sa MetabLagrangeCNOneStepDoDic::run()
+   std::vector<CarbonateEq> workspaces(
+      parallelThreads(parcelThreads_, numParcels_),
+      carbonateEq_
+   );
+   parallelChunks(
+      parcelThreads_,
+      numParcels_,
+      parcelChunkLength,
+      [&](int thread, int first, int last) {
+         CarbonateEq& carbonateEq = workspaces[thread];
+         carbonateEq.lastpH = -1;
+         for(int i = first; i < last; i++) {
+            carbonateEq.reset(upstreamTemp_[i], 0);
+            double equil[2];
+            carbonateEq.optfCO2FromDICTotalAlk(
+               upstreamDIC_[i] * 1e-6,
+               upstreamAlkalinity_[i] * 1e-6,
+               1e-5,
+               2,
+               12,
+               equil
+            );
+            upstreampH_[i] = equil[0];
+            upstreampCO2_[i] = equil[1];
+            upstreamkH_[i] = carbonateEq.kHenryCO2;
+            upstreamSatCO2_[i] = upstreamkH_[i] * pCO2air_[i];
+
+            downstreamCarbonateConstants_[i].reset(downstreamTemp_[i], 0);
+            downstreamkH_[i] = downstreamCarbonateConstants_[i].kHenryCO2;
+            downstreamSatCO2_[i] = downstreamkH_[i] * pCO2air_[i];
+         }
+      }
+   );
+
+   if (kSchmidtCO2Calculator_ == kSchmidtCO2Calc) {
+      kSchmidtCO2CalcArray(
+         numParcels_,
+         upstreamTemp_,
+         1,
+         upstreamkCO2Schmidt_
+      );
+      kSchmidtCO2CalcArray(
+         numParcels_,
+         downstreamTemp_,
+         1,
+         downstreamkCO2Schmidt_
       );
-      upstreampH_[i] = equil[0];
-      upstreampCO2_[i] = equil[1];
-      upstreamkH_[i] = carbonateEq_.kHenryCO2;
-      upstreamSatCO2_[i] = upstreamkH_[i] * pCO2air_[i];
-
-      carbonateEq_.reset(downstreamTemp_[i], 0);
-      downstreamkH_[i] = carbonateEq_.kHenryCO2;
-      downstreamSatCO2_[i] = downstreamkH_[i] * pCO2air_[i];
+   } else {
+      for(int i = 0; i < numParcels_; i++) {
+         upstreamkCO2Schmidt_[i] =
+            kSchmidtCO2Calculator_(upstreamTemp_[i], 1);
+         downstreamkCO2Schmidt_[i] =
+            kSchmidtCO2Calculator_(downstreamTemp_[i], 1);
+      }
    }
 }
 
@@ -151,3 +165,67 @@ void MetabLagrangeDoDic::setkSchmidtCO2Calculator
 {
    kSchmidtCO2Calculator_ = function;
 }
+
+void MetabLagrangeDoDic::initializeCopy(MetabLagrangeDoDic* model)
+{
+   copySettings(model);
+   kSchmidtCO2Calculator_ = model->kSchmidtCO2Calculator_;
+   MetabLagrangeDoDic::initialize(
+      model->dailyGPP_,
+      model->ratioDoCFix_,
+      model->dailyER_,
+      model->ratioDoCResp_,
+      model->k600_,
+      model->upstreamDO_,
+      model->upstreamTime_,
+      model->downstreamTime_,
+      model->upstreamTemp_,
+      model->downstreamTemp_,
+      model->upstreamPAR_,
+      model->downstreamPAR_,
+      model->parTotal_,
+      model->airPressure_,
+      model->stdAirPressure_,
+      model->numParcels_,
+      model->lengthTimeVector_ - 1,
+      model->ratioDicCFix_,
+      model->ratioDicCResp_,
+      model->upstreamDIC_,
+      model->pCO2air_,
+      model->upstreamAlkalinity_,
+      model->downstreamAlkalinity_,
+      model->gwAlpha_,
+      model->gwDO_,
+      model->gwDIC_
+   );
+   carbonateEq_.pHSolver = model->carbonateEq_.pHSolver;
+   carbonateEq_.warmStartWidth = model->carbonateEq_.warmStartWidth;
+   dicSolver_ = model->dicSolver_;
+}
+
+int MetabLagrangeDoDic::arenaArrays()
+{
+   return MetabLagrangeDo::arenaArrays() + 21;
+}
+
+double** MetabLagrangeDoDic::getOutputSlot(const char* name)
+{
+   if (!strcmp(name, "pCO2")) return &outputDic_.pCO2;
+   if (!strcmp(name, "dic")) return &outputDic_.dic;
+   if (!strcmp(name, "dicProduction")) return &outputDic_.dicProduction;
+   if (!strcmp(name, "dicConsumption")) return &outputDic_.dicConsumption;
+   if (!strcmp(name, "co2Equilibration")) return &outputDic_.co2Equilibration;
+   if (!strcmp(name, "downstreamkCO2")) return &downstreamkCO2_;
+   if (!strcmp(name, "downstreampH")) return &outputDic_.pH;
+   if (!strcmp(name, "downstreamkH")) return &downstreamkH_;
+   return MetabLagrangeDo::getOutputSlot(name);
+}
+
+Metab_OutputKind MetabLagrangeDoDic::getOutputKind(const char* name)
+{
+   if (!strcmp(name, "pCO2")) return outputPrediction;
+   if (!strcmp(name, "dic")) return outputPrediction;
+   if (!strcmp(name, "downstreampH")) return outputPrediction;
+   if (!strcmp(name, "downstreamkH")) return outputConstant;
+   return MetabLagrangeDo::getOutputKind(name);
+}
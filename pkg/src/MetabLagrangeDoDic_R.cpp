@@ -92,6 +92,17 @@ SEXP MetabLagrangeDoDic_initialize(
       );
    }
 
+   Metab_keepInputs(
+      baseExtPointer,
+      basePointer,
+      {
+         upstreamDO, upstreamTime, downstreamTime, upstreamTemp,
+         downstreamTemp, upstreamPAR, downstreamPAR, airPressure,
+         upstreamDIC, pCO2air, upstreamAlkalinity, downstreamAlkalinity,
+         gwAlpha, gwDO, gwDIC
+      }
+   );
+
    return R_NilValue;
 }
 
@@ -139,40 +150,81 @@ SEXP MetabLagrangeDoDic_setRatioDicCResp(SEXP baseExternalPointer, SEXP value)
    return out;
 }
 
+SEXP MetabLagrangeDoDic_setpHWarmStart(SEXP baseExternalPointer, SEXP value)
+{
+   MetabLagrangeDoDic* model = (MetabLagrangeDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->carbonateEq_.warmStartWidth;
+   model->carbonateEq_.warmStartWidth = asReal(value);
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP MetabLagrangeDoDic_setpHSolver(SEXP baseExternalPointer, SEXP value)
+{
+   MetabLagrangeDoDic* model = (MetabLagrangeDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   CarbonateEq::Solver solver = Metab_asSolver(value);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->carbonateEq_.pHSolver;
+   model->carbonateEq_.pHSolver = solver;
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP MetabLagrangeDoDic_setDicSolver(SEXP baseExternalPointer, SEXP value)
+{
+   MetabLagrangeDoDic* model = (MetabLagrangeDoDic*)R_ExternalPtrAddr(baseExternalPointer);
+   CarbonateEq::Solver solver = Metab_asSolver(value);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->dicSolver_;
+   model->dicSolver_ = solver;
+
+   UNPROTECT(1);
+   return out;
+}
+
 SEXP MetabLagrangeDoDic_getSummary(SEXP baseExternalPointer)
 {
    MetabLagrangeDoDic* basePointer =
       (MetabLagrangeDoDic*)R_ExternalPtrAddr(baseExternalPointer);
 
-   return MetabLagrangeDoDic_getSummary(basePointer);
+   return MetabLagrangeDoDic_getSummary(baseExternalPointer, basePointer);
 }
 
-SEXP MetabLagrangeDoDic_getSummary(MetabLagrangeDoDic* basePointer)
+SEXP MetabLagrangeDoDic_getSummary(SEXP baseExternalPointer, MetabLagrangeDoDic* basePointer)
 {
    MetabLagrangeDo* basePointerDo = dynamic_cast <MetabLagrangeDo*> (basePointer);
-   SEXP oldVec = PROTECT(MetabLagrangeDo_getSummary(basePointerDo));
+   SEXP oldVec = PROTECT(MetabLagrangeDo_getSummary(baseExternalPointer, basePointerDo));
 
    SEXP vecOutput = PROTECT(VECTOR_ELT(oldVec, 0));
    SEXP vecOutputDO = PROTECT(VECTOR_ELT(oldVec, 1));
 
-   SEXP pCO2 = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP dic = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP dicProduction = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP dicConsumption = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP co2Equilibration = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP kCO2 = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP pH = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP kH = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   for(int i = 0; i < basePointer->numParcels_; i++) {
-      REAL(pCO2)[i] = basePointer->outputDic_.pCO2[i];
-      REAL(dic)[i] = basePointer->outputDic_.dic[i];
-      REAL(dicProduction)[i] = basePointer->outputDic_.dicProduction[i];
-      REAL(dicConsumption)[i] = basePointer->outputDic_.dicConsumption[i];
-      REAL(co2Equilibration)[i] = basePointer->outputDic_.co2Equilibration[i];
-      REAL(kCO2)[i] = basePointer->downstreamkCO2_[i];
-      REAL(pH)[i] = basePointer->outputDic_.pH[i];
-      REAL(kH)[i] = basePointer->downstreamkH_[i];
-   }
+   SEXP pCO2 = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "pCO2")
+   );
+   SEXP dic = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "dic")
+   );
+   SEXP dicProduction = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "dicProduction")
+   );
+   SEXP dicConsumption = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "dicConsumption")
+   );
+   SEXP co2Equilibration = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "co2Equilibration")
+   );
+   SEXP kCO2 = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "downstreamkCO2")
+   );
+   SEXP pH = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "downstreampH")
+   );
+   SEXP kH = PROTECT(
+      Metab_summaryColumn(baseExternalPointer, basePointer, "downstreamkH", true)
+   );
 
    SEXP vecOutputDIC = PROTECT(allocVector(VECSXP, 8));
    SET_VECTOR_ELT(vecOutputDIC, 0, pCO2);
@@ -195,6 +247,7 @@ SEXP MetabLagrangeDoDic_getSummary(MetabLagrangeDoDic* basePointer)
    SET_VECTOR_ELT(vecOutputDIC_names, 7, install("downstreamkH"));
 
    setAttrib(vecOutputDIC, install("names"), vecOutputDIC_names);
+   Metab_setDataFrame(vecOutputDIC, basePointer->length_);
 
    SEXP vec = PROTECT(allocVector(VECSXP, 3));
    SET_VECTOR_ELT(vec, 0, vecOutput);
@@ -72,6 +72,16 @@ SEXP MetabLagrangeDo_initialize(
       );
    }
 
+   Metab_keepInputs(
+      baseExtPointer,
+      basePointer,
+      {
+         upstreamDO, upstreamTime, downstreamTime, upstreamTemp,
+         downstreamTemp, upstreamPAR, downstreamPAR, airPressure,
+         gwAlpha, gwDO
+      }
+   );
+
    return R_NilValue;
 }
 
@@ -100,38 +110,49 @@ SEXP MetabLagrangeDo_setRatioDoCResp(SEXP baseExternalPointer, SEXP value)
 SEXP MetabLagrangeDo_getSummary(SEXP baseExtPointer)
 {
    MetabLagrangeDo* basePointer = (MetabLagrangeDo*)R_ExternalPtrAddr(baseExtPointer);
-   return MetabLagrangeDo_getSummary(basePointer);
+   return MetabLagrangeDo_getSummary(baseExtPointer, basePointer);
 }
 
-SEXP MetabLagrangeDo_getSummary(MetabLagrangeDo* basePointer)
+SEXP MetabLagrangeDo_getSummary
+(
+   SEXP baseExtPointer,
+   MetabLagrangeDo* basePointer
+)
 {
-   SEXP travelTimes = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP cFixation = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP cRespiration = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-
-   SEXP dox = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP upstreamDoSat = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP downstreamDoSat = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP doProduction = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP doConsumption = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP upstreamkDo = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP downstreamkDo = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-   SEXP doEquilibration = PROTECT(allocVector(REALSXP, basePointer->numParcels_));
-
-   for(int i = 0; i < basePointer->numParcels_; i++) {
-      REAL(travelTimes)[i] = basePointer->travelTimes_[i];
-      REAL(cFixation)[i] = basePointer->output_.cFixation[i];
-      REAL(cRespiration)[i] = basePointer->output_.cRespiration[i];
-
-      REAL(dox)[i] = basePointer->outputDo_.dox[i];
-      REAL(upstreamDoSat)[i] = basePointer->upstreamSatDo_[i];
-      REAL(downstreamDoSat)[i] = basePointer->downstreamSatDo_[i];
-      REAL(doProduction)[i] = basePointer->outputDo_.doProduction[i];
-      REAL(doConsumption)[i] = basePointer->outputDo_.doConsumption[i];
-      REAL(upstreamkDo)[i] = basePointer->upstreamkDo_[i];
-      REAL(downstreamkDo)[i] = basePointer->upstreamkDo_[i];
-      REAL(doEquilibration)[i] = basePointer->outputDo_.doEquilibration[i];
-   }
+   SEXP travelTimes = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "travelTimes", true)
+   );
+   SEXP cFixation = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "cFixation")
+   );
+   SEXP cRespiration = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "cRespiration")
+   );
+
+   SEXP dox = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "dox")
+   );
+   SEXP upstreamDoSat = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "upstreamDoSat", true)
+   );
+   SEXP downstreamDoSat = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "downstreamDoSat", true)
+   );
+   SEXP doProduction = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "doProduction")
+   );
+   SEXP doConsumption = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "doConsumption")
+   );
+   SEXP upstreamkDo = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "upstreamkDo")
+   );
+   SEXP downstreamkDo = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "downstreamkDo")
+   );
+   SEXP doEquilibration = PROTECT(
+      Metab_summaryColumn(baseExtPointer, basePointer, "doEquilibration")
+   );
 
    SEXP vecOutput = PROTECT(allocVector(VECSXP, 3));
    SET_VECTOR_ELT(vecOutput, 0, travelTimes);
@@ -144,6 +165,7 @@ SEXP MetabLagrangeDo_getSummary(MetabLagrangeDo* basePointer)
    SET_VECTOR_ELT(vecOutput_names, 2, install("cRespiration"));
 
    setAttrib(vecOutput, install("names"), vecOutput_names);
+   Metab_setDataFrame(vecOutput, basePointer->numParcels_);
 
    SEXP vecOutputDO = PROTECT(allocVector(VECSXP, 8));
    SET_VECTOR_ELT(vecOutputDO, 0, dox);
@@ -166,6 +188,7 @@ SEXP MetabLagrangeDo_getSummary(MetabLagrangeDo* basePointer)
    SET_VECTOR_ELT(vecOutputDO_names, 7, install("doEquilibration"));
 
    setAttrib(vecOutputDO, install("names"), vecOutputDO_names);
+   Metab_setDataFrame(vecOutputDO, basePointer->numParcels_);
 
    SEXP vec = PROTECT(allocVector(VECSXP, 2));
    SET_VECTOR_ELT(vec, 0, vecOutput);
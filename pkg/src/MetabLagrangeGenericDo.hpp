@@ -1,4 +1,194 @@
+template <class T>
+MetabLagrangeGenericDo<T>::~MetabLagrangeGenericDo()
+{
+   for (T* model : parcelModels_) {
+      delete model;
+   }
+}
+
+template <class T>
+void MetabLagrangeGenericDo<T>::initializeParcelModel(T* model, int parcel)
+{
+   int length = lengthTimeVector_;
+   std::vector<double> time(length);
+   std::vector<double> temp(length);
+   std::vector<double> par(length);
+   std::vector<double> airPressure(length, airPressure_[parcel]);
+   std::vector<double> gwAlpha;
+   std::vector<double> gwDO;
+
+   // Forcing varies linearly over the travel time of the parcel
+   int lastIndex = length - 1;
+   for (int j = 0; j < length; j++) {
+      double fraction = lastIndex > 0 ? double(j) / lastIndex : 0;
+      time[j] = upstreamTime_[parcel] + fraction * travelTimes_[parcel];
+      temp[j] = upstreamTemp_[parcel] +
+         fraction * (downstreamTemp_[parcel] - upstreamTemp_[parcel]);
+      par[j] = upstreamPAR_[parcel] +
+         fraction * (downstreamPAR_[parcel] - upstreamPAR_[parcel]);
+   }
+   if (gwDO_) {
+      gwAlpha.assign(length, gwAlpha_[parcel]);
+      gwDO.assign(length, gwDO_[parcel]);
+   }
+
+   // GPP is distributed with the total PAR of the whole analysis,
+   // so the parcel models share the basis of parDist_
+   model->densityCalculator_ = densityCalculator_;
+   model->satDoCalculator_ = satDoCalculator_;
+   model->kSchmidtDoCalculator_ = kSchmidtDoCalculator_;
+   model->parDistCalculator_ = parDistCalculator_;
+   model->scanThreads_ = 1;
+   model->initialize(
+      dailyGPP_,
+      ratioDoCFix_,
+      dailyER_,
+      ratioDoCResp_,
+      k600_,
+      upstreamDO_[parcel],
+      time.data(),
+      temp.data(),
+      par.data(),
+      parTotal_,
+      airPressure.data(),
+      stdAirPressure_,
+      length,
+      gwDO_ ? gwAlpha.data() : nullptr,
+      gwDO_ ? gwDO.data() : nullptr
+   );
+}
+
+template <class T>
+void MetabLagrangeGenericDo<T>::initializeParcels()
+{
+   if (parcelModels_.empty()) {
+      parcelModels_.push_back(new T());
+   }
+
+   // The parcel arrays that do not depend on the parameters are
+   // calculated once by the first model of the pool
+   int length = lengthTimeVector_;
+   long size = long(numParcels_) * length;
+   parcelDt_.resize(size);
+   parcelPar_.resize(size);
+   parcelParDist_.resize(size);
+   parcelParTilt_.resize(size);
+   parcelSatDo_.resize(size);
+   parcelkDoSchmidt_.resize(size);
+   T* model = parcelModels_[0];
+   for (int i = 0; i < numParcels_; i++) {
+      initializeParcelModel(model, i);
+      long offset = long(i) * length;
+      for (int j = 0; j < length; j++) {
+         parcelDt_[offset + j] = model->dt_[j];
+         parcelPar_[offset + j] = model->par_[j];
+         parcelParDist_[offset + j] = model->parDist_[j];
+         parcelParTilt_[offset + j] = model->parTilt_[j];
+         parcelSatDo_[offset + j] = model->satDo_[j];
+         parcelkDoSchmidt_[offset + j] = model->kDoSchmidt_[j];
+      }
+   }
+
+   // Other models of the pool need arrays of the new length
+   for (size_t m = 1; m < parcelModels_.size(); m++) {
+      initializeParcelModel(parcelModels_[m], 0);
+   }
+}
+
 template <class T>
 void MetabLagrangeGenericDo<T>::run()
 {
+   // Grow the pool to one model for each thread, keeping the models
+   // of earlier runs
+   int numThreads = parallelThreads(parcelThreads_, numParcels_);
+   while (int(parcelModels_.size()) < numThreads) {
+      T* model = new T();
+      initializeParcelModel(model, 0);
+      parcelModels_.push_back(model);
+   }
+
+   int length = lengthTimeVector_;
+   int lastIndex = length - 1;
+   bool diagnostics = !predictionsOnly_;
+   bool groundwater = gwDO_ != nullptr;
+
+   // Parcels are independent of each other, so chunks of parcels are
+   // run in parallel, each thread with its own model from the pool.
+   // The forcing of the model is pointed at the arrays of each parcel
+   // calculated by initializeParcels().
+   parallelChunks(
+      parcelThreads_,
+      numParcels_,
+      parcelChunkLength,
+      [&](int thread, int first, int last) {
+         T* model = parcelModels_[thread];
+         model->dailyGPP_ = dailyGPP_;
+         model->dailyER_ = dailyER_;
+         model->k600_ = k600_;
+         model->ratioDoCFix_ = ratioDoCFix_;
+         model->ratioDoCResp_ = ratioDoCResp_;
+         model->calcSensitivity_ = calcSensitivity_;
+         model->predictionsOnly_ = predictionsOnly_;
+         for (int i = first; i < last; i++) {
+            long offset = long(i) * length;
+            model->initialDO_ = upstreamDO_[i];
+            model->dt_ = &parcelDt_[offset];
+            model->par_ = &parcelPar_[offset];
+            model->parDist_ = &parcelParDist_[offset];
+            model->parTilt_ = &parcelParTilt_[offset];
+            model->satDo_ = &parcelSatDo_[offset];
+            model->kDoSchmidt_ = &parcelkDoSchmidt_[offset];
+            if (groundwater) {
+               for (int j = 0; j < length; j++) {
+                  model->gwAlpha_[j] = gwAlpha_[i];
+                  model->gwDO_[j] = gwDO_[i];
+               }
+            }
+
+            model->run();
+
+            outputDo_.dox[i] = model->outputDo_.dox[lastIndex];
+
+            // Fluxes are totaled over the travel time of the parcel
+            if (diagnostics) {
+               double fixation = 0;
+               double respiration = 0;
+               double production = 0;
+               double consumption = 0;
+               double equilibration = 0;
+               for (int j = 0; j < lastIndex; j++) {
+                  fixation += model->output_.cFixation[j];
+                  respiration += model->output_.cRespiration[j];
+                  production += model->outputDo_.doProduction[j];
+                  consumption += model->outputDo_.doConsumption[j];
+                  equilibration += model->outputDo_.doEquilibration[j];
+               }
+               output_.cFixation[i] = fixation;
+               output_.cRespiration[i] = respiration;
+               outputDo_.doProduction[i] = production;
+               outputDo_.doConsumption[i] = consumption;
+               outputDo_.doEquilibration[i] = equilibration;
+               upstreamkDo_[i] = k600_ * upstreamkDoSchmidt_[i];
+               downstreamkDo_[i] = k600_ * downstreamkDoSchmidt_[i];
+            }
+
+            if (calcSensitivity_) {
+               sensitivityDo_.dailyGPP[i] =
+                  model->sensitivityDo_.dailyGPP[lastIndex];
+               sensitivityDo_.dailyER[i] =
+                  model->sensitivityDo_.dailyER[lastIndex];
+               sensitivityDo_.k600[i] =
+                  model->sensitivityDo_.k600[lastIndex];
+            }
+         }
+      }
+   );
+}
+
+template <class T>
+Metab* MetabLagrangeGenericDo<T>::clone()
+{
+   MetabLagrangeGenericDo<T>* model = new MetabLagrangeGenericDo<T>();
+   model->initializeCopy(this);
+   return model;
 }
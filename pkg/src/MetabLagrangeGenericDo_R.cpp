@@ -1,13 +1,28 @@
 #include "metabc_R.h"
 
-SEXP MetabLagrangeGenericDo_constructor_CN()
+// Parcel engines are named MetabLagrange<type>Do like the other
+// Lagrangian models, so the R class finds them from its type argument
+
+SEXP MetabLagrangeGenericCNDo_constructor()
 {
    return Metab_constructor<MetabLagrangeGenericDo<MetabCrankNicolsonDo>, MetabLagrangeDo>();
 }
 
-SEXP MetabLagrangeGenericDo_destructor_CN(SEXP externalPointer)
+SEXP MetabLagrangeGenericCNDo_destructor(SEXP externalPointer)
 {
    finalizerExternalPointer<MetabLagrangeGenericDo<MetabCrankNicolsonDo>>(externalPointer);
 
    return R_NilValue;
 }
+
+SEXP MetabLagrangeGenericExponentialDo_constructor()
+{
+   return Metab_constructor<MetabLagrangeGenericDo<MetabExponentialDo>, MetabLagrangeDo>();
+}
+
+SEXP MetabLagrangeGenericExponentialDo_destructor(SEXP externalPointer)
+{
+   finalizerExternalPointer<MetabLagrangeGenericDo<MetabExponentialDo>>(externalPointer);
+
+   return R_NilValue;
+}
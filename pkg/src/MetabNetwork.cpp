@@ -0,0 +1,414 @@
+#include "metabc.h"
+#include <algorithm>
+#include <cmath>
+
+MetabNetwork::MetabNetwork(int numThreads)
+{
+   if (numThreads < 1) {
+      numThreads = std::thread::hardware_concurrency();
+   }
+   if (numThreads < 1) {
+      numThreads = 1;
+   }
+   numThreads_ = numThreads;
+   segmentStart_.push_back(0);
+}
+
+int MetabNetwork::addSegment
+(
+   int upstreamSegment,
+   MetabParcels& parcels,
+   const double* observedDO,
+   double ratioDoCFix,
+   double ratioDoCResp,
+   double parTotal,
+   double stdAirPressure,
+   const double* gwAlpha,
+   const double* gwDO
+)
+{
+   // The values of the parcels that do not depend on the parameters
+   // are calculated by a model of the segment
+   MetabLagrangeCNOneStepDo model;
+   parcels.initialize(
+      &model,
+      0,
+      ratioDoCFix,
+      0,
+      ratioDoCResp,
+      0,
+      parTotal,
+      stdAirPressure,
+      1
+   );
+
+   int segment = numSegments_;
+   int numParcels = parcels.numParcels_;
+   upstreamSegment_.push_back(upstreamSegment);
+   segmentDepth_.push_back(
+      upstreamSegment < 0 ? 0 : segmentDepth_[upstreamSegment] + 1
+   );
+   dailyGPP_.push_back(0);
+   dailyER_.push_back(0);
+   k600_.push_back(0);
+   ratioDoCFix_.push_back(ratioDoCFix);
+   ratioDoCResp_.push_back(ratioDoCResp);
+
+   travelTimes_.insert(
+      travelTimes_.end(),
+      model.travelTimes_,
+      model.travelTimes_ + numParcels
+   );
+   parDist_.insert(
+      parDist_.end(),
+      model.parDist_,
+      model.parDist_ + numParcels
+   );
+   upstreamDO_.insert(
+      upstreamDO_.end(),
+      model.upstreamDO_,
+      model.upstreamDO_ + numParcels
+   );
+   upstreamSatDo_.insert(
+      upstreamSatDo_.end(),
+      model.upstreamSatDo_,
+      model.upstreamSatDo_ + numParcels
+   );
+   downstreamSatDo_.insert(
+      downstreamSatDo_.end(),
+      model.downstreamSatDo_,
+      model.downstreamSatDo_ + numParcels
+   );
+   upstreamkDoSchmidt_.insert(
+      upstreamkDoSchmidt_.end(),
+      model.upstreamkDoSchmidt_,
+      model.upstreamkDoSchmidt_ + numParcels
+   );
+   downstreamkDoSchmidt_.insert(
+      downstreamkDoSchmidt_.end(),
+      model.downstreamkDoSchmidt_,
+      model.downstreamkDoSchmidt_ + numParcels
+   );
+   downstreamTime_.insert(
+      downstreamTime_.end(),
+      parcels.downstreamTime_.begin(),
+      parcels.downstreamTime_.begin() + numParcels
+   );
+   groundwater_.push_back(gwAlpha && gwDO);
+   for(int i = 0; i < numParcels; i++) {
+      int index = parcels.downstreamIndex_[i];
+      observedDO_.push_back(observedDO ? observedDO[index] : NAN);
+      gwAlpha_.push_back(groundwater_[segment] ? gwAlpha[index] : 0);
+      gwDO_.push_back(groundwater_[segment] ? gwDO[index] : 0);
+   }
+
+   // Parcels entering the segment are linked to the parcels leaving the
+   // segment upstream on either side of their entry times
+   for(int i = 0; i < numParcels; i++) {
+      int link = -1;
+      double fraction = 0;
+      if (upstreamSegment >= 0) {
+         const double* times = downstreamTime_.data();
+         int linkFirst = segmentStart_[upstreamSegment];
+         int linkLast = segmentStart_[upstreamSegment + 1] - 1;
+         double entryTime = parcels.upstreamTime_[i];
+         if (entryTime >= times[linkFirst] && entryTime <= times[linkLast]) {
+            link = int(
+               std::upper_bound(
+                  times + linkFirst,
+                  times + linkLast + 1,
+                  entryTime
+               ) - times
+            ) - 1;
+            if (times[link] != entryTime) {
+               fraction = (entryTime - times[link]) /
+                  (times[link + 1] - times[link]);
+            }
+         }
+      }
+      linkParcel_.push_back(link);
+      linkFraction_.push_back(fraction);
+   }
+
+   numSegments_++;
+   numParcels_ += numParcels;
+   segmentStart_.push_back(numParcels_);
+   entryDO_.resize(numParcels_);
+   dox_.resize(numParcels_);
+   sensitivityDailyGPP_.resize(numParcels_);
+   sensitivityDailyER_.resize(numParcels_);
+   sensitivityk600_.resize(numParcels_);
+   arrangeLevels();
+
+   return segment;
+}
+
+void MetabNetwork::arrangeLevels()
+{
+   int numLevels = 0;
+   for(int s = 0; s < numSegments_; s++) {
+      numLevels = std::max(numLevels, segmentDepth_[s] + 1);
+   }
+
+   levelSegments_.clear();
+   levelStart_.clear();
+   rangeSegment_.clear();
+   rangeFirst_.clear();
+   rangeLast_.clear();
+   levelRangeStart_.clear();
+   for(int level = 0; level < numLevels; level++) {
+      levelStart_.push_back(int(levelSegments_.size()));
+      levelRangeStart_.push_back(int(rangeSegment_.size()));
+      for(int s = 0; s < numSegments_; s++) {
+         if (segmentDepth_[s] != level) {
+            continue;
+         }
+         levelSegments_.push_back(s);
+         for(
+            int first = segmentStart_[s];
+            first < segmentStart_[s + 1];
+            first += parcelChunkLength
+         ) {
+            rangeSegment_.push_back(s);
+            rangeFirst_.push_back(first);
+            rangeLast_.push_back(
+               std::min(first + parcelChunkLength, segmentStart_[s + 1])
+            );
+         }
+      }
+   }
+   levelStart_.push_back(int(levelSegments_.size()));
+   levelRangeStart_.push_back(int(rangeSegment_.size()));
+}
+
+void MetabNetwork::runParcels
+(
+   int segment,
+   int first,
+   int last,
+   bool sensitivity
+)
+{
+   // The parcels of the segment upstream, which are finished before this
+   // segment is run, provide the DO entering a chained segment
+   const double* upstreamDO = upstreamDO_.data();
+   if (chained_) {
+      const double* dox = dox_.data();
+      for (int i = first; i < last; i++) {
+         int link = linkParcel_[i];
+         if (link < 0) {
+            entryDO_[i] = upstreamDO_[i];
+         } else if (linkFraction_[i] == 0) {
+            entryDO_[i] = dox[link];
+         } else {
+            entryDO_[i] =
+               dox[link] + linkFraction_[i] * (dox[link + 1] - dox[link]);
+         }
+      }
+      upstreamDO = entryDO_.data();
+   }
+
+   MetabLagrangeCN_Parcels parcels;
+   parcels.dailyGPP = dailyGPP_[segment];
+   parcels.dailyER = dailyER_[segment];
+   parcels.k600 = k600_[segment];
+   parcels.ratioDoCFix = ratioDoCFix_[segment];
+   parcels.ratioDoCResp = ratioDoCResp_[segment];
+   parcels.travelTimes = travelTimes_.data();
+   parcels.parDist = parDist_.data();
+   parcels.upstreamDO = upstreamDO;
+   parcels.upstreamSatDo = upstreamSatDo_.data();
+   parcels.downstreamSatDo = downstreamSatDo_.data();
+   parcels.upstreamkDoSchmidt = upstreamkDoSchmidt_.data();
+   parcels.downstreamkDoSchmidt = downstreamkDoSchmidt_.data();
+   parcels.gwAlpha = gwAlpha_.data();
+   parcels.gwDO = gwDO_.data();
+   parcels.dox = dox_.data();
+   parcels.sensitivityDailyGPP = sensitivityDailyGPP_.data();
+   parcels.sensitivityDailyER = sensitivityDailyER_.data();
+   parcels.sensitivityk600 = sensitivityk600_.data();
+
+   if (groundwater_[segment]) {
+      if (sensitivity) {
+         MetabLagrangeCN_run<true, true, false, true>(parcels, first, last);
+      } else {
+         MetabLagrangeCN_run<true, false, false, true>(parcels, first, last);
+      }
+   } else {
+      if (sensitivity) {
+         MetabLagrangeCN_run<false, true, false, true>(parcels, first, last);
+      } else {
+         MetabLagrangeCN_run<false, false, false, true>(parcels, first, last);
+      }
+   }
+}
+
+void MetabNetwork::runSegment(int segment, bool sensitivity)
+{
+   runParcels(
+      segment,
+      segmentStart_[segment],
+      segmentStart_[segment + 1],
+      sensitivity
+   );
+}
+
+void MetabNetwork::run(bool sensitivity)
+{
+   // Ranges of one level only depend on the levels upstream, and all
+   // ranges are independent if the segments are not chained
+   int numLevels = chained_ ? int(levelRangeStart_.size()) - 1 : 1;
+   for(int level = 0; level < numLevels; level++) {
+      int levelFirst = chained_ ? levelRangeStart_[level] : 0;
+      int levelLast = chained_ ?
+         levelRangeStart_[level + 1] : int(rangeSegment_.size());
+      parallelFor(
+         numThreads_,
+         levelLast - levelFirst,
+         [&](int, int index) {
+            int range = levelFirst + index;
+            runParcels(
+               rangeSegment_[range],
+               rangeFirst_[range],
+               rangeLast_[range],
+               sensitivity
+            );
+         }
+      );
+   }
+}
+
+double MetabNetwork::calcSSE(int segment, double* gradient)
+{
+   double sse = 0;
+   if (gradient) {
+      gradient[0] = 0;
+      gradient[1] = 0;
+      gradient[2] = 0;
+   }
+   for(int i = segmentStart_[segment]; i < segmentStart_[segment + 1]; i++) {
+      if (std::isnan(observedDO_[i])) {
+         continue;
+      }
+      double error = dox_[i] - observedDO_[i];
+      sse += error * error;
+      if (gradient) {
+         gradient[0] += 2 * error * sensitivityDailyGPP_[i];
+         gradient[1] += 2 * error * sensitivityDailyER_[i];
+         gradient[2] += 2 * error * sensitivityk600_[i];
+      }
+   }
+   return sse;
+}
+
+//! Segment and parameter settings passed through the minimizers
+struct MetabNetwork_Fit {
+   MetabNetwork* network;
+   int segment;
+   const bool* estimate;
+   double par[3];
+   int evaluations;
+};
+
+//! Sets the parameters of a segment from the values of the estimated parameters
+static void setFitParameters(MetabNetwork_Fit* fit, const double* x)
+{
+   for(int p = 0, k = 0; p < 3; p++) {
+      if (fit->estimate[p]) fit->par[p] = x[k++];
+   }
+   fit->network->dailyGPP_[fit->segment] = fit->par[0];
+   fit->network->dailyER_[fit->segment] = fit->par[1];
+   fit->network->k600_[fit->segment] = fit->par[2];
+}
+
+//! Objective function of the estimated parameters used by the minimizers
+static double fitObjective(const double* x, double* gradient, void* info)
+{
+   MetabNetwork_Fit* fit = (MetabNetwork_Fit*)info;
+   setFitParameters(fit, x);
+   fit->network->runSegment(fit->segment, gradient != nullptr);
+   fit->evaluations++;
+
+   if (!gradient) {
+      return fit->network->calcSSE(fit->segment);
+   }
+   double fullGradient[3];
+   double value = fit->network->calcSSE(fit->segment, fullGradient);
+   for(int p = 0, k = 0; p < 3; p++) {
+      if (fit->estimate[p]) gradient[k++] = fullGradient[p];
+   }
+   return value;
+}
+
+void MetabNetwork::fit
+(
+   int method,
+   const double* start,
+   const bool* estimate,
+   const double* lower,
+   const double* upper,
+   double reltol,
+   int maxit,
+   MetabOptim_Result* results
+)
+{
+   // Fits of the segments of one level only depend on the estimates of
+   // the levels upstream, and all fits are independent if the segments
+   // are not chained
+   int numLevels = chained_ ? int(levelStart_.size()) - 1 : 1;
+   for(int level = 0; level < numLevels; level++) {
+      int levelFirst = chained_ ? levelStart_[level] : 0;
+      int levelLast = chained_ ? levelStart_[level + 1] : numSegments_;
+      parallelFor(
+         numThreads_,
+         levelLast - levelFirst,
+         [&](int, int index) {
+            int segment = levelSegments_[levelFirst + index];
+            const double* segmentStart = start + 3 * segment;
+            MetabNetwork_Fit fit;
+            fit.network = this;
+            fit.segment = segment;
+            fit.estimate = estimate;
+            fit.evaluations = 0;
+
+            // Pack the estimated parameters and their bounds
+            double x[3];
+            double xLower[3];
+            double xUpper[3];
+            int n = 0;
+            for(int p = 0; p < 3; p++) {
+               fit.par[p] = segmentStart[p];
+               if (estimate[p]) {
+                  x[n] = segmentStart[p];
+                  xLower[n] = lower[p];
+                  xUpper[n] = upper[p];
+                  n++;
+               }
+            }
+
+            MetabOptim_Result result;
+            result.convergence = optimConverged;
+            if (n > 0) {
+               if (method == optimBFGSB) {
+                  BFGSB_fmin(n, x, xLower, xUpper, fitObjective, &fit,
+                     reltol, maxit, &result.convergence);
+               } else {
+                  NelderMead_fmin(n, x, xLower, xUpper, fitObjective, &fit,
+                     reltol, maxit, &result.convergence);
+               }
+            }
+
+            // Leave the segment with the output at the estimates, which
+            // is the DO entering the segments downstream
+            setFitParameters(&fit, x);
+            runSegment(segment, false);
+            result.value = calcSSE(segment);
+            for(int p = 0; p < 3; p++) {
+               result.par[p] = fit.par[p];
+            }
+            result.evaluations = fit.evaluations;
+            results[segment] = result;
+         }
+      );
+   }
+}
@@ -0,0 +1,238 @@
+#include "metabc_R.h"
+
+// Gets a list of the predicted DO of the parcels of each segment
+static SEXP MetabNetwork_dox(MetabNetwork* network)
+{
+   SEXP dox = PROTECT(allocVector(VECSXP, network->numSegments_));
+   for(int s = 0; s < network->numSegments_; s++) {
+      int first = network->segmentStart_[s];
+      int numParcels = network->segmentStart_[s + 1] - first;
+      SEXP segmentDox = allocVector(REALSXP, numParcels);
+      SET_VECTOR_ELT(dox, s, segmentDox);
+      for(int i = 0; i < numParcels; i++) {
+         REAL(segmentDox)[i] = network->dox_[first + i];
+      }
+   }
+   UNPROTECT(1);
+   return dox;
+}
+
+SEXP MetabNetwork_constructor(SEXP numThreads)
+{
+   MetabNetwork* network = new MetabNetwork(asInteger(numThreads));
+
+   SEXP networkExternalPointer = PROTECT(
+      R_MakeExternalPtr(network, R_NilValue, R_NilValue)
+   );
+   R_RegisterCFinalizer(
+      networkExternalPointer,
+      finalizerExternalPointer<MetabNetwork>
+   );
+
+   UNPROTECT(1);
+   return networkExternalPointer;
+}
+
+SEXP MetabNetwork_destructor(SEXP networkExternalPointer)
+{
+   finalizerExternalPointer<MetabNetwork>(networkExternalPointer);
+
+   return R_NilValue;
+}
+
+SEXP MetabNetwork_addSegment
+(
+   SEXP networkExternalPointer,
+   SEXP upstreamSegment,
+   SEXP upstreamTime,
+   SEXP upstreamDO,
+   SEXP upstreamTemp,
+   SEXP upstreamPAR,
+   SEXP downstreamTime,
+   SEXP downstreamDO,
+   SEXP downstreamTemp,
+   SEXP downstreamPAR,
+   SEXP airPressure,
+   SEXP travelTime,
+   SEXP ratioDoCFix,
+   SEXP ratioDoCResp,
+   SEXP parTotal,
+   SEXP stdAirPressure,
+   SEXP gwAlpha,
+   SEXP gwDO
+)
+{
+   MetabNetwork* network =
+      (MetabNetwork*)R_ExternalPtrAddr(networkExternalPointer);
+
+   // Segments are numbered from one in R, with zero for no segment
+   int upstreamIndex = asInteger(upstreamSegment) - 1;
+   if (upstreamIndex < -1 || upstreamIndex >= network->numSegments_) {
+      error("The upstream segment must be added before the segments downstream.");
+   }
+
+   MetabParcels_Series upstream;
+   MetabParcels_setSeries(
+      upstream,
+      upstreamTime,
+      {
+         {&upstream.dox, upstreamDO},
+         {&upstream.temp, upstreamTemp},
+         {&upstream.par, upstreamPAR}
+      },
+      "upstream"
+   );
+   // Groundwater input is given for each downstream time like the
+   // observations, and is disabled if either value is missing
+   MetabParcels_Series downstream;
+   const double* gwAlphaValues = nullptr;
+   const double* gwDOValues = nullptr;
+   MetabParcels_setSeries(
+      downstream,
+      downstreamTime,
+      {
+         {&downstream.dox, downstreamDO},
+         {&downstream.temp, downstreamTemp},
+         {&downstream.par, downstreamPAR},
+         {&downstream.airPressure, airPressure},
+         {&gwAlphaValues, gwAlpha},
+         {&gwDOValues, gwDO}
+      },
+      "downstream"
+   );
+
+   // Parcels leaving a segment are the upstream end of the segments
+   // downstream, so their times must be in order
+   MetabParcels_check(upstream, downstream, travelTime);
+   for(int i = 1; i < downstream.length; i++) {
+      if (!(downstream.time[i] > downstream.time[i - 1])) {
+         error("Times of the downstream series must be increasing.");
+      }
+   }
+   double ratioDoCFixValue = asReal(ratioDoCFix);
+   double ratioDoCRespValue = asReal(ratioDoCResp);
+   double parTotalValue = asReal(parTotal);
+   double stdAirPressureValue = asReal(stdAirPressure);
+   SEXP indices = PROTECT(allocVector(INTSXP, downstream.length));
+   MetabParcels* parcels = MetabParcels_build(upstream, downstream, travelTime);
+
+   network->addSegment(
+      upstreamIndex,
+      *parcels,
+      downstream.dox,
+      ratioDoCFixValue,
+      ratioDoCRespValue,
+      parTotalValue,
+      stdAirPressureValue,
+      gwAlphaValues,
+      gwDOValues
+   );
+
+   indices = MetabParcels_indices(parcels, indices);
+   UNPROTECT(1);
+   return indices;
+}
+
+SEXP MetabNetwork_run
+(
+   SEXP networkExternalPointer,
+   SEXP dailyGPP,
+   SEXP dailyER,
+   SEXP k600,
+   SEXP chained
+)
+{
+   MetabNetwork* network =
+      (MetabNetwork*)R_ExternalPtrAddr(networkExternalPointer);
+   int numSegments = network->numSegments_;
+   if (
+      length(dailyGPP) != numSegments ||
+      length(dailyER) != numSegments ||
+      length(k600) != numSegments
+   ) {
+      error("Parameters must have one value for each segment.");
+   }
+
+   for(int s = 0; s < numSegments; s++) {
+      network->dailyGPP_[s] = REAL(dailyGPP)[s];
+      network->dailyER_[s] = REAL(dailyER)[s];
+      network->k600_[s] = REAL(k600)[s];
+   }
+   network->chained_ = asLogical(chained);
+   network->run();
+
+   return MetabNetwork_dox(network);
+}
+
+SEXP MetabNetwork_fit
+(
+   SEXP networkExternalPointer,
+   SEXP start,
+   SEXP estimate,
+   SEXP lower,
+   SEXP upper,
+   SEXP method,
+   SEXP reltol,
+   SEXP maxit,
+   SEXP chained
+)
+{
+   MetabNetwork* network =
+      (MetabNetwork*)R_ExternalPtrAddr(networkExternalPointer);
+   int numSegments = network->numSegments_;
+   if (length(start) != 3 * numSegments) {
+      error("Starting values must have three values for each segment.");
+   }
+
+   bool estimateParams[3];
+   for(int p = 0; p < 3; p++) {
+      estimateParams[p] = LOGICAL(estimate)[p];
+   }
+   network->chained_ = asLogical(chained);
+
+   MetabOptim_Result* results = new MetabOptim_Result[numSegments];
+   network->fit(
+      asInteger(method),
+      REAL(start),
+      estimateParams,
+      REAL(lower),
+      REAL(upper),
+      asReal(reltol),
+      asInteger(maxit),
+      results
+   );
+
+   SEXP par = PROTECT(allocMatrix(REALSXP, numSegments, 3));
+   SEXP value = PROTECT(allocVector(REALSXP, numSegments));
+   SEXP evaluations = PROTECT(allocVector(INTSXP, numSegments));
+   SEXP convergence = PROTECT(allocVector(INTSXP, numSegments));
+   for(int s = 0; s < numSegments; s++) {
+      for(int p = 0; p < 3; p++) {
+         REAL(par)[s + p * numSegments] = results[s].par[p];
+      }
+      REAL(value)[s] = results[s].value;
+      INTEGER(evaluations)[s] = results[s].evaluations;
+      INTEGER(convergence)[s] = results[s].convergence;
+   }
+   delete[] results;
+   SEXP dox = PROTECT(MetabNetwork_dox(network));
+
+   SEXP vecOutput = PROTECT(allocVector(VECSXP, 5));
+   SET_VECTOR_ELT(vecOutput, 0, par);
+   SET_VECTOR_ELT(vecOutput, 1, value);
+   SET_VECTOR_ELT(vecOutput, 2, evaluations);
+   SET_VECTOR_ELT(vecOutput, 3, convergence);
+   SET_VECTOR_ELT(vecOutput, 4, dox);
+
+   SEXP vecOutput_names = PROTECT(allocVector(VECSXP, 5));
+   SET_VECTOR_ELT(vecOutput_names, 0, install("par"));
+   SET_VECTOR_ELT(vecOutput_names, 1, install("value"));
+   SET_VECTOR_ELT(vecOutput_names, 2, install("evaluations"));
+   SET_VECTOR_ELT(vecOutput_names, 3, install("convergence"));
+   SET_VECTOR_ELT(vecOutput_names, 4, install("dox"));
+
+   setAttrib(vecOutput, install("names"), vecOutput_names);
+
+   UNPROTECT(7);
+   return vecOutput;
+}
@@ -0,0 +1,119 @@
+#include "metabc.h"
+#include <cmath>
+
+void MetabObjective::clear()
+{
+   variables_.clear();
+}
+
+void MetabObjective::addVariable
+(
+   const char* name,
+   const double* obs,
+   int length,
+   const double* sigma,
+   int numSigma,
+   double weight
+)
+{
+   MetabObjective_Variable variable;
+   variable.name = name;
+   variable.obs.assign(obs, obs + length);
+   if (sigma) {
+      variable.sigma.assign(sigma, sigma + numSigma);
+   }
+   variable.weight = weight;
+   variables_.push_back(variable);
+}
+
+double MetabObjective::calc(Metab* model, double* components) const
+{
+   const double logTwoPi = log(2 * M_PI);
+
+   double total = 0;
+   for(size_t v = 0; v < variables_.size(); v++) {
+      const MetabObjective_Variable& variable = variables_[v];
+      double* values = model->getOutputVariable(variable.name.c_str());
+      int length = variable.obs.size();
+      bool missingSigma = type_ == gaussian && variable.sigma.empty();
+      if (!values || length > model->length_ || missingSigma) {
+         if (components) components[v] = NAN;
+         total = NAN;
+         continue;
+      }
+
+      const double* obs = variable.obs.data();
+      double sum = 0;
+      if (type_ == gaussian) {
+         // Standard deviations are either a single value or one for
+         // each observation
+         const double* sigma = variable.sigma.data();
+         bool perObs = (int)variable.sigma.size() == length;
+         double logSigma = log(sigma[0]);
+         for(int i = 0; i < length; i++) {
+            if (std::isnan(obs[i])) continue;
+            double s = perObs ? sigma[i] : sigma[0];
+            double z = (obs[i] - values[i]) / s;
+            sum +=
+               0.5 * (logTwoPi + z * z) +
+               (perObs ? log(s) : logSigma);
+         }
+      } else {
+         for(int i = 0; i < length; i++) {
+            if (std::isnan(obs[i])) continue;
+            double residual = obs[i] - values[i];
+            sum += residual * residual;
+         }
+      }
+
+      if (components) components[v] = sum;
+      total += variable.weight * sum;
+   }
+   return total;
+}
+
+bool MetabObjective::hasDoGradient(Metab* model) const
+{
+   if (variables_.empty() || !model->getDoSensitivity()) {
+      return false;
+   }
+   for(size_t v = 0; v < variables_.size(); v++) {
+      if (variables_[v].name != "dox") {
+         return false;
+      }
+   }
+   return true;
+}
+
+void MetabObjective::calcDoGradient(Metab* model, double* gradient) const
+{
+   MetabDo_Sensitivity* sensitivity = model->getDoSensitivity();
+   double* dox = model->getOutputVariable("dox");
+
+   gradient[0] = 0;
+   gradient[1] = 0;
+   gradient[2] = 0;
+   for(size_t v = 0; v < variables_.size(); v++) {
+      const MetabObjective_Variable& variable = variables_[v];
+      const double* obs = variable.obs.data();
+      const double* sigma = variable.sigma.data();
+      int length = variable.obs.size();
+      bool perObs = (int)variable.sigma.size() == length;
+      for(int i = 0; i < length; i++) {
+         if (std::isnan(obs[i])) continue;
+         // Derivative of the component with respect to the predicted DO
+         double residual = obs[i] - dox[i];
+         double dCompdDO;
+         if (type_ == gaussian) {
+            double s = perObs ? sigma[i] : sigma[0];
+            dCompdDO = -residual / (s * s);
+         } else {
+            dCompdDO = -2 * residual;
+         }
+         dCompdDO *= variable.weight;
+         gradient[0] += dCompdDO * sensitivity->dailyGPP[i];
+         gradient[1] += dCompdDO * sensitivity->dailyER[i];
+         gradient[2] += dCompdDO * sensitivity->k600[i];
+      }
+   }
+}
@@ -0,0 +1,258 @@
+#include "metabc.h"
+#include <cmath>
+
+// Fraction of the time between observations within which an entry time
+// is taken to match an observation, as times converted to days carry
+// rounding errors
+static const double matchFraction = 1e-9;
+
+// Value of a series interpolated between two elements, taking an element
+// exactly when the time matches it so a missing value in the other
+// element does not invalidate the parcel
+static inline double interpolate
+(
+   const double* values,
+   int index,
+   double fraction
+)
+{
+   if (fraction < matchFraction) {
+      return values[index];
+   }
+   if (fraction > 1 - matchFraction) {
+      return values[index + 1];
+   }
+   return values[index] + fraction * (values[index + 1] - values[index]);
+}
+
+void MetabParcels::build
+(
+   const MetabParcels_Series& upstream,
+   const MetabParcels_Series& downstream,
+   int travelTimeLength,
+   const double* travelTime
+)
+{
+   bool dic = upstream.dic != nullptr;
+   int length = downstream.length;
+
+   downstreamIndex_.resize(length);
+   upstreamTime_.resize(length);
+   downstreamTime_.resize(length);
+   upstreamTemp_.resize(length);
+   downstreamTemp_.resize(length);
+   upstreamPAR_.resize(length);
+   downstreamPAR_.resize(length);
+   upstreamDO_.resize(length);
+   airPressure_.resize(length);
+   if (dic) {
+      upstreamDIC_.resize(length);
+      pCO2air_.resize(length);
+      upstreamAlkalinity_.resize(length);
+      downstreamAlkalinity_.resize(length);
+   }
+
+   // Entry times mostly increase with the exit times, so the position in
+   // the upstream series is carried from one parcel to the next and only
+   // moves back if the travel time grows faster than the time between
+   // downstream observations
+   const double* times = upstream.time;
+   int lastUpstream = upstream.length - 1;
+
+   // Entry times within matchFraction of a step beyond either end of the
+   // upstream series are taken to match the end
+   double firstTolerance = 0;
+   double lastTolerance = 0;
+   if (lastUpstream > 0) {
+      firstTolerance = matchFraction * (times[1] - times[0]);
+      lastTolerance =
+         matchFraction * (times[lastUpstream] - times[lastUpstream - 1]);
+   }
+
+   int position = 0;
+   int parcel = 0;
+   for(int i = 0; i < length; i++) {
+      double duration = travelTime[travelTimeLength == 1 ? 0 : i];
+      double exitTime = downstream.time[i];
+      double entryTime = exitTime - duration;
+      if (
+         !(duration > 0) ||
+         lastUpstream < 0 ||
+         !(
+            entryTime >= times[0] - firstTolerance &&
+            entryTime <= times[lastUpstream] + lastTolerance
+         )
+      ) {
+         continue;
+      }
+      if (entryTime < times[0]) {
+         entryTime = times[0];
+      } else if (entryTime > times[lastUpstream]) {
+         entryTime = times[lastUpstream];
+      }
+      while (position < lastUpstream && times[position + 1] <= entryTime) {
+         position++;
+      }
+      while (times[position] > entryTime) {
+         position--;
+      }
+      double fraction = times[position] == entryTime ? 0 :
+         (entryTime - times[position]) /
+         (times[position + 1] - times[position]);
+
+      upstreamTime_[parcel] = entryTime;
+      downstreamTime_[parcel] = exitTime;
+      upstreamTemp_[parcel] = interpolate(upstream.temp, position, fraction);
+      downstreamTemp_[parcel] = downstream.temp[i];
+      upstreamPAR_[parcel] = interpolate(upstream.par, position, fraction);
+      downstreamPAR_[parcel] = downstream.par[i];
+      upstreamDO_[parcel] = interpolate(upstream.dox, position, fraction);
+      airPressure_[parcel] = downstream.airPressure[i];
+      bool valid =
+         std::isfinite(exitTime) &&
+         std::isfinite(upstreamTemp_[parcel]) &&
+         std::isfinite(downstreamTemp_[parcel]) &&
+         std::isfinite(upstreamPAR_[parcel]) &&
+         std::isfinite(downstreamPAR_[parcel]) &&
+         std::isfinite(upstreamDO_[parcel]) &&
+         std::isfinite(airPressure_[parcel]);
+      if (dic) {
+         upstreamDIC_[parcel] = interpolate(upstream.dic, position, fraction);
+         pCO2air_[parcel] = downstream.pCO2air[i];
+         upstreamAlkalinity_[parcel] =
+            interpolate(upstream.alkalinity, position, fraction);
+         downstreamAlkalinity_[parcel] = downstream.alkalinity[i];
+         valid = valid &&
+            std::isfinite(upstreamDIC_[parcel]) &&
+            std::isfinite(pCO2air_[parcel]) &&
+            std::isfinite(upstreamAlkalinity_[parcel]) &&
+            std::isfinite(downstreamAlkalinity_[parcel]);
+      }
+
+      // Values of an invalid parcel are overwritten by the next parcel
+      if (valid) {
+         downstreamIndex_[parcel] = i;
+         parcel++;
+      }
+   }
+
+   numParcels_ = parcel;
+}
+
+void MetabParcels::select
+(
+   const double* values,
+   std::vector<double>& parcelValues
+)
+{
+   if (!values) {
+      parcelValues.clear();
+      return;
+   }
+   parcelValues.resize(numParcels_);
+   for(int i = 0; i < numParcels_; i++) {
+      parcelValues[i] = values[downstreamIndex_[i]];
+   }
+}
+
+void MetabParcels::initialize
+(
+   MetabLagrangeDo* model,
+   double dailyGPP,
+   double ratioDoCFix,
+   double dailyER,
+   double ratioDoCResp,
+   double k600,
+   double parTotal,
+   double stdAirPressure,
+   int timeSteps,
+   const double* gwAlpha,
+   const double* gwDO
+)
+{
+   // Groundwater input is given for each downstream time
+   bool groundwater = gwAlpha && gwDO;
+   std::vector<double> parcelGwAlpha;
+   std::vector<double> parcelGwDO;
+   select(groundwater ? gwAlpha : nullptr, parcelGwAlpha);
+   select(groundwater ? gwDO : nullptr, parcelGwDO);
+
+   model->initialize(
+      dailyGPP,
+      ratioDoCFix,
+      dailyER,
+      ratioDoCResp,
+      k600,
+      upstreamDO_.data(),
+      upstreamTime_.data(),
+      downstreamTime_.data(),
+      upstreamTemp_.data(),
+      downstreamTemp_.data(),
+      upstreamPAR_.data(),
+      downstreamPAR_.data(),
+      parTotal,
+      airPressure_.data(),
+      stdAirPressure,
+      numParcels_,
+      timeSteps,
+      groundwater ? parcelGwAlpha.data() : nullptr,
+      groundwater ? parcelGwDO.data() : nullptr
+   );
+}
+
+void MetabParcels::initialize
+(
+   MetabLagrangeDoDic* model,
+   double dailyGPP,
+   double ratioDoCFix,
+   double dailyER,
+   double ratioDoCResp,
+   double k600,
+   double parTotal,
+   double stdAirPressure,
+   int timeSteps,
+   double ratioDicCFix,
+   double ratioDicCResp,
+   const double* gwAlpha,
+   const double* gwDO,
+   const double* gwDIC
+)
+{
+   // Groundwater input is given for each downstream time
+   bool groundwater = gwAlpha && gwDO && gwDIC;
+   std::vector<double> parcelGwAlpha;
+   std::vector<double> parcelGwDO;
+   std::vector<double> parcelGwDIC;
+   select(groundwater ? gwAlpha : nullptr, parcelGwAlpha);
+   select(groundwater ? gwDO : nullptr, parcelGwDO);
+   select(groundwater ? gwDIC : nullptr, parcelGwDIC);
+
+   model->initialize(
+      dailyGPP,
+      ratioDoCFix,
+      dailyER,
+      ratioDoCResp,
+      k600,
+      upstreamDO_.data(),
+      upstreamTime_.data(),
+      downstreamTime_.data(),
+      upstreamTemp_.data(),
+      downstreamTemp_.data(),
+      upstreamPAR_.data(),
+      downstreamPAR_.data(),
+      parTotal,
+      airPressure_.data(),
+      stdAirPressure,
+      numParcels_,
+      timeSteps,
+      ratioDicCFix,
+      ratioDicCResp,
+      upstreamDIC_.data(),
+      pCO2air_.data(),
+      upstreamAlkalinity_.data(),
+      downstreamAlkalinity_.data(),
+      groundwater ? parcelGwAlpha.data() : nullptr,
+      groundwater ? parcelGwDO.data() : nullptr,
+      groundwater ? parcelGwDIC.data() : nullptr
+   );
+}
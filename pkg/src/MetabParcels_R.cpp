@@ -0,0 +1,281 @@
+#include "metabc_R.h"
+
+// Checks the lengths of the vectors of a series and points the series at
+// them. Optional vectors that are R_NilValue are left as null pointers.
+void MetabParcels_setSeries
+(
+   MetabParcels_Series& series,
+   SEXP time,
+   std::initializer_list<std::pair<const double**, SEXP>> values,
+   const char* name
+)
+{
+   series.length = length(time);
+   series.time = REAL(time);
+   for(auto value : values) {
+      if (value.second == R_NilValue) {
+         continue;
+      }
+      if (length(value.second) != series.length) {
+         error("Values of the %s series must have one value for each time.", name);
+      }
+      *value.first = REAL(value.second);
+   }
+}
+
+// Checks the series and travel times before any parcels are built
+void MetabParcels_check
+(
+   const MetabParcels_Series& upstream,
+   const MetabParcels_Series& downstream,
+   SEXP travelTime
+)
+{
+   for(int i = 1; i < upstream.length; i++) {
+      if (!(upstream.time[i] > upstream.time[i - 1])) {
+         error("Times of the upstream series must be increasing.");
+      }
+   }
+   if (!isReal(travelTime)) {
+      error("Travel time must be numeric.");
+   }
+   int travelTimeLength = length(travelTime);
+   if (travelTimeLength != 1 && travelTimeLength != downstream.length) {
+      error("Travel time must be one value or one value for each downstream time.");
+   }
+}
+
+// Builds the parcels, which are deleted before signalling an error if
+// none of them are valid. The parcels are not R memory, so nothing that
+// can signal an R error may be called until MetabParcels_indices deletes
+// them.
+MetabParcels* MetabParcels_build
+(
+   const MetabParcels_Series& upstream,
+   const MetabParcels_Series& downstream,
+   SEXP travelTime
+)
+{
+   MetabParcels* parcels = new MetabParcels();
+   parcels->build(upstream, downstream, length(travelTime), REAL(travelTime));
+   if (parcels->numParcels_ == 0) {
+      delete parcels;
+      error("No valid parcels could be built from the series.");
+   }
+   return parcels;
+}
+
+// Writes the indices (from one) of the downstream observations of the
+// parcels into a vector allocated with one element for each downstream
+// time before the parcels were built, deletes the parcels, and returns
+// the indices shortened to the number of parcels
+SEXP MetabParcels_indices(MetabParcels* parcels, SEXP indices)
+{
+   int numParcels = parcels->numParcels_;
+   for(int i = 0; i < numParcels; i++) {
+      INTEGER(indices)[i] = parcels->downstreamIndex_[i] + 1;
+   }
+   delete parcels;
+
+   return lengthgets(indices, numParcels);
+}
+
+SEXP MetabParcels_initializeLagrangeDo(
+   SEXP baseExtPointer,
+   SEXP dailyGPP,
+   SEXP ratioDoCFix,
+   SEXP dailyER,
+   SEXP ratioDoCResp,
+   SEXP k600,
+   SEXP upstreamTime,
+   SEXP upstreamDO,
+   SEXP upstreamTemp,
+   SEXP upstreamPAR,
+   SEXP downstreamTime,
+   SEXP downstreamTemp,
+   SEXP downstreamPAR,
+   SEXP airPressure,
+   SEXP travelTime,
+   SEXP parTotal,
+   SEXP stdAirPressure,
+   SEXP timesteps,
+   SEXP gwAlpha,
+   SEXP gwDO
+)
+{
+   MetabLagrangeDo* basePointer =
+      (MetabLagrangeDo*)R_ExternalPtrAddr(baseExtPointer);
+
+   MetabParcels_Series upstream;
+   MetabParcels_setSeries(
+      upstream,
+      upstreamTime,
+      {
+         {&upstream.dox, upstreamDO},
+         {&upstream.temp, upstreamTemp},
+         {&upstream.par, upstreamPAR}
+      },
+      "upstream"
+   );
+   // Groundwater input is given for each downstream time, and is
+   // disabled if either value is missing
+   MetabParcels_Series downstream;
+   const double* gwAlphaValues = nullptr;
+   const double* gwDOValues = nullptr;
+   MetabParcels_setSeries(
+      downstream,
+      downstreamTime,
+      {
+         {&downstream.temp, downstreamTemp},
+         {&downstream.par, downstreamPAR},
+         {&downstream.airPressure, airPressure},
+         {&gwAlphaValues, gwAlpha},
+         {&gwDOValues, gwDO}
+      },
+      "downstream"
+   );
+
+   MetabParcels_check(upstream, downstream, travelTime);
+   double dailyGPPValue = asReal(dailyGPP);
+   double ratioDoCFixValue = asReal(ratioDoCFix);
+   double dailyERValue = asReal(dailyER);
+   double ratioDoCRespValue = asReal(ratioDoCResp);
+   double k600Value = asReal(k600);
+   double parTotalValue = asReal(parTotal);
+   double stdAirPressureValue = asReal(stdAirPressure);
+   int timestepsValue = asInteger(timesteps);
+   SEXP indices = PROTECT(allocVector(INTSXP, downstream.length));
+   MetabParcels* parcels = MetabParcels_build(upstream, downstream, travelTime);
+
+   // The parcels are not R vectors, so the model always keeps a copy
+   bool borrowInputs = basePointer->borrowInputs_;
+   basePointer->borrowInputs_ = false;
+   parcels->initialize(
+      basePointer,
+      dailyGPPValue,
+      ratioDoCFixValue,
+      dailyERValue,
+      ratioDoCRespValue,
+      k600Value,
+      parTotalValue,
+      stdAirPressureValue,
+      timestepsValue,
+      gwAlphaValues,
+      gwDOValues
+   );
+   basePointer->borrowInputs_ = borrowInputs;
+   indices = PROTECT(MetabParcels_indices(parcels, indices));
+   Metab_keepInputs(baseExtPointer, basePointer, {});
+
+   UNPROTECT(2);
+   return indices;
+}
+
+SEXP MetabParcels_initializeLagrangeDoDic(
+   SEXP baseExtPointer,
+   SEXP dailyGPP,
+   SEXP ratioDoCFix,
+   SEXP dailyER,
+   SEXP ratioDoCResp,
+   SEXP k600,
+   SEXP upstreamTime,
+   SEXP upstreamDO,
+   SEXP upstreamTemp,
+   SEXP upstreamPAR,
+   SEXP upstreamDIC,
+   SEXP upstreamAlkalinity,
+   SEXP downstreamTime,
+   SEXP downstreamTemp,
+   SEXP downstreamPAR,
+   SEXP airPressure,
+   SEXP pCO2air,
+   SEXP downstreamAlkalinity,
+   SEXP travelTime,
+   SEXP parTotal,
+   SEXP stdAirPressure,
+   SEXP timesteps,
+   SEXP ratioDicCFix,
+   SEXP ratioDicCResp,
+   SEXP gwAlpha,
+   SEXP gwDO,
+   SEXP gwDIC
+)
+{
+   MetabLagrangeDoDic* basePointer =
+      (MetabLagrangeDoDic*)R_ExternalPtrAddr(baseExtPointer);
+
+   MetabParcels_Series upstream;
+   MetabParcels_setSeries(
+      upstream,
+      upstreamTime,
+      {
+         {&upstream.dox, upstreamDO},
+         {&upstream.temp, upstreamTemp},
+         {&upstream.par, upstreamPAR},
+         {&upstream.dic, upstreamDIC},
+         {&upstream.alkalinity, upstreamAlkalinity}
+      },
+      "upstream"
+   );
+   // Groundwater input is given for each downstream time, and is
+   // disabled if any value is missing
+   MetabParcels_Series downstream;
+   const double* gwAlphaValues = nullptr;
+   const double* gwDOValues = nullptr;
+   const double* gwDICValues = nullptr;
+   MetabParcels_setSeries(
+      downstream,
+      downstreamTime,
+      {
+         {&downstream.temp, downstreamTemp},
+         {&downstream.par, downstreamPAR},
+         {&downstream.airPressure, airPressure},
+         {&downstream.pCO2air, pCO2air},
+         {&downstream.alkalinity, downstreamAlkalinity},
+         {&gwAlphaValues, gwAlpha},
+         {&gwDOValues, gwDO},
+         {&gwDICValues, gwDIC}
+      },
+      "downstream"
+   );
+
+   MetabParcels_check(upstream, downstream, travelTime);
+   double dailyGPPValue = asReal(dailyGPP);
+   double ratioDoCFixValue = asReal(ratioDoCFix);
+   double dailyERValue = asReal(dailyER);
+   double ratioDoCRespValue = asReal(ratioDoCResp);
+   double k600Value = asReal(k600);
+   double parTotalValue = asReal(parTotal);
+   double stdAirPressureValue = asReal(stdAirPressure);
+   int timestepsValue = asInteger(timesteps);
+   double ratioDicCFixValue = asReal(ratioDicCFix);
+   double ratioDicCRespValue = asReal(ratioDicCResp);
+   SEXP indices = PROTECT(allocVector(INTSXP, downstream.length));
+   MetabParcels* parcels = MetabParcels_build(upstream, downstream, travelTime);
+
+   // The parcels are not R vectors, so the model always keeps a copy
+   bool borrowInputs = basePointer->borrowInputs_;
+   basePointer->borrowInputs_ = false;
+   parcels->initialize(
+      basePointer,
+      dailyGPPValue,
+      ratioDoCFixValue,
+      dailyERValue,
+      ratioDoCRespValue,
+      k600Value,
+      parTotalValue,
+      stdAirPressureValue,
+      timestepsValue,
+      ratioDicCFixValue,
+      ratioDicCRespValue,
+      gwAlphaValues,
+      gwDOValues,
+      gwDICValues
+   );
+   basePointer->borrowInputs_ = borrowInputs;
+   indices = PROTECT(MetabParcels_indices(parcels, indices));
+   Metab_keepInputs(baseExtPointer, basePointer, {});
+
+   UNPROTECT(2);
+   return indices;
+}
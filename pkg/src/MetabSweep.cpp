@@ -0,0 +1,109 @@
+#include "metabc.h"
+#include <cmath>
+
+MetabSweep::MetabSweep(Metab* model, int numThreads)
+{
+   if (numThreads < 1) {
+      numThreads = std::thread::hardware_concurrency();
+   }
+   if (numThreads < 1) {
+      numThreads = 1;
+   }
+   numThreads_ = numThreads;
+   length_ = model->length_;
+
+   // Each clone runs its time steps on its own thread
+   workspaces_ = new Metab*[numThreads_];
+   for(int i = 0; i < numThreads_; i++) {
+      workspaces_[i] = model->clone();
+      workspaces_[i]->scanThreads_ = 1;
+      workspaces_[i]->parcelThreads_ = 1;
+   }
+}
+
+MetabSweep::~MetabSweep()
+{
+   for(int i = 0; i < numThreads_; i++) {
+      delete workspaces_[i];
+   }
+   delete[] workspaces_;
+}
+
+void MetabSweep::selectOutput(const char* variable)
+{
+   // Diagnostic output is only written when it is the variable swept
+   bool predictionsOnly =
+      workspaces_[0]->getOutputKind(variable) != outputDiagnostic;
+   for(int i = 0; i < numThreads_; i++) {
+      workspaces_[i]->predictionsOnly_ = predictionsOnly;
+   }
+}
+
+void MetabSweep::run
+(
+   int numSets,
+   const double* dailyGPP,
+   const double* dailyER,
+   const double* k600,
+   const char* variable,
+   double* output
+)
+{
+   selectOutput(variable);
+   parallelFor(
+      numThreads_,
+      numSets,
+      [&](int thread, int set) {
+         Metab* model = workspaces_[thread];
+         model->dailyGPP_ = dailyGPP[set];
+         model->dailyER_ = dailyER[set];
+         model->k600_ = k600[set];
+         model->run();
+
+         double* values = model->getOutputVariable(variable);
+         double* setOutput = output + (long)set * length_;
+         for(int i = 0; i < length_; i++) {
+            setOutput[i] = values ? values[i] : NAN;
+         }
+      }
+   );
+}
+
+void MetabSweep::runSSE
+(
+   int numSets,
+   const double* dailyGPP,
+   const double* dailyER,
+   const double* k600,
+   const char* variable,
+   const double* obs,
+   double* sse
+)
+{
+   selectOutput(variable);
+   parallelFor(
+      numThreads_,
+      numSets,
+      [&](int thread, int set) {
+         Metab* model = workspaces_[thread];
+         model->dailyGPP_ = dailyGPP[set];
+         model->dailyER_ = dailyER[set];
+         model->k600_ = k600[set];
+         model->run();
+
+         double* values = model->getOutputVariable(variable);
+         if (!values) {
+            sse[set] = NAN;
+            return;
+         }
+         double sum = 0;
+         for(int i = 0; i < length_; i++) {
+            if (!std::isnan(obs[i])) {
+               double residual = obs[i] - values[i];
+               sum += residual * residual;
+            }
+         }
+         sse[set] = sum;
+      }
+   );
+}
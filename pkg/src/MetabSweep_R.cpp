@@ -0,0 +1,101 @@
+#include "metabc_R.h"
+
+SEXP MetabSweep_constructor(SEXP metabExternalPointer, SEXP numThreads)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   MetabSweep* sweep = new MetabSweep(model, asInteger(numThreads));
+
+   SEXP sweepExternalPointer = PROTECT(
+      R_MakeExternalPtr(sweep, R_NilValue, R_NilValue)
+   );
+   R_RegisterCFinalizer(
+      sweepExternalPointer,
+      finalizerExternalPointer<MetabSweep>
+   );
+
+   UNPROTECT(1);
+   return sweepExternalPointer;
+}
+
+SEXP MetabSweep_destructor(SEXP sweepExternalPointer)
+{
+   finalizerExternalPointer<MetabSweep>(sweepExternalPointer);
+
+   return R_NilValue;
+}
+
+// Checks the parameter sets and the name of the output variable of a sweep
+static void MetabSweep_check
+(
+   MetabSweep* sweep,
+   SEXP dailyGPP,
+   SEXP dailyER,
+   SEXP k600,
+   SEXP variable
+)
+{
+   Metab_checkParamSets(length(dailyGPP), {dailyGPP, dailyER, k600});
+   const char* name = CHAR(asChar(variable));
+   if (!sweep->workspaces_[0]->getOutputSlot(name)) {
+      error("Model has no output variable named '%s'.", name);
+   }
+}
+
+SEXP MetabSweep_run
+(
+   SEXP sweepExternalPointer,
+   SEXP dailyGPP,
+   SEXP dailyER,
+   SEXP k600,
+   SEXP variable
+)
+{
+   MetabSweep* sweep = (MetabSweep*)R_ExternalPtrAddr(sweepExternalPointer);
+   MetabSweep_check(sweep, dailyGPP, dailyER, k600, variable);
+   int numSets = length(dailyGPP);
+
+   SEXP out = PROTECT(allocMatrix(REALSXP, sweep->length_, numSets));
+   sweep->run(
+      numSets,
+      REAL(dailyGPP),
+      REAL(dailyER),
+      REAL(k600),
+      CHAR(asChar(variable)),
+      REAL(out)
+   );
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP MetabSweep_runSSE
+(
+   SEXP sweepExternalPointer,
+   SEXP dailyGPP,
+   SEXP dailyER,
+   SEXP k600,
+   SEXP variable,
+   SEXP obs
+)
+{
+   MetabSweep* sweep = (MetabSweep*)R_ExternalPtrAddr(sweepExternalPointer);
+   MetabSweep_check(sweep, dailyGPP, dailyER, k600, variable);
+   int numSets = length(dailyGPP);
+   if (length(obs) != sweep->length_) {
+      error("Observations must have one value for each element of model output.");
+   }
+
+   SEXP out = PROTECT(allocVector(REALSXP, numSets));
+   sweep->runSSE(
+      numSets,
+      REAL(dailyGPP),
+      REAL(dailyER),
+      REAL(k600),
+      CHAR(asChar(variable)),
+      REAL(obs),
+      REAL(out)
+   );
+
+   UNPROTECT(1);
+   return out;
+}
@@ -0,0 +1,110 @@
+#include "metabc.h"
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+
+MetabWindowScheduler::MetabWindowScheduler(int numThreads)
+{
+   if (numThreads < 1) {
+      numThreads = std::thread::hardware_concurrency();
+   }
+   if (numThreads < 1) {
+      numThreads = 1;
+   }
+   numThreads_ = numThreads;
+}
+
+void MetabWindowScheduler::run
+(
+   int numWindows,
+   Metab** models,
+   const double* start,
+   const bool* estimate,
+   const double* lower,
+   const double* upper,
+   MetabOptim_Result* results
+)
+{
+   // Windows are claimed in order, so the previous window of a pipelined
+   // fit has always been claimed by a running thread and waiting on it
+   // cannot deadlock
+   std::vector<bool> finished(numWindows, false);
+   std::mutex finishedMutex;
+   std::condition_variable finishedChanged;
+
+   // Each model runs its time steps on the thread that fits it, as the
+   // windows already occupy the threads
+   std::vector<int> scanThreads(numWindows);
+   std::vector<int> parcelThreads(numWindows);
+   for(int window = 0; window < numWindows; window++) {
+      scanThreads[window] = models[window]->scanThreads_;
+      parcelThreads[window] = models[window]->parcelThreads_;
+      models[window]->scanThreads_ = 1;
+      models[window]->parcelThreads_ = 1;
+   }
+
+   parallelFor(
+      numThreads_,
+      numWindows,
+      [&](int, int window) {
+         Metab* model = models[window];
+         const double* windowStart = start + 3 * window;
+         MetabOptim_Result result = model->optimize(
+            method_,
+            windowStart,
+            estimate,
+            lower,
+            upper,
+            reltol_,
+            maxit_
+         );
+
+         if (pipelined_ && window > 0) {
+            std::unique_lock<std::mutex> lock(finishedMutex);
+            finishedChanged.wait(lock, [&]() { return finished[window - 1]; });
+            lock.unlock();
+
+            // Re-polish from the estimates of the previous window,
+            // keeping the values of fixed parameters for this window
+            double polishStart[3];
+            for(int p = 0; p < 3; p++) {
+               polishStart[p] = estimate[p] ?
+                  results[window - 1].par[p] : windowStart[p];
+            }
+            MetabOptim_Result polished = model->optimize(
+               method_,
+               polishStart,
+               estimate,
+               lower,
+               upper,
+               reltol_,
+               maxit_
+            );
+            polished.evaluations += result.evaluations;
+            if (polished.value <= result.value || std::isnan(result.value)) {
+               result = polished;
+            } else {
+               // Leave the model at the speculative estimates
+               result.evaluations = polished.evaluations;
+               model->dailyGPP_ = result.par[0];
+               model->dailyER_ = result.par[1];
+               model->k600_ = result.par[2];
+               model->run();
+               result.evaluations++;
+            }
+         }
+
+         results[window] = result;
+         if (pipelined_) {
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            finished[window] = true;
+            finishedChanged.notify_all();
+         }
+      }
+   );
+
+   for(int window = 0; window < numWindows; window++) {
+      models[window]->scanThreads_ = scanThreads[window];
+      models[window]->parcelThreads_ = parcelThreads[window];
+   }
+}
@@ -0,0 +1,82 @@
+#include "metabc_R.h"
+
+SEXP MetabWindowScheduler_run
+(
+   SEXP metabExternalPointers,
+   SEXP start,
+   SEXP estimate,
+   SEXP lower,
+   SEXP upper,
+   SEXP method,
+   SEXP reltol,
+   SEXP maxit,
+   SEXP pipelined,
+   SEXP numThreads
+)
+{
+   int numWindows = length(metabExternalPointers);
+   if (length(start) != 3 * numWindows) {
+      error("Starting values must have three values for each window.");
+   }
+
+   MetabWindowScheduler scheduler(asInteger(numThreads));
+   scheduler.method_ = asInteger(method);
+   scheduler.reltol_ = asReal(reltol);
+   scheduler.maxit_ = asInteger(maxit);
+   scheduler.pipelined_ = asLogical(pipelined);
+
+   Metab** models = new Metab*[numWindows];
+   for(int w = 0; w < numWindows; w++) {
+      models[w] = (Metab*)R_ExternalPtrAddr(
+         VECTOR_ELT(metabExternalPointers, w)
+      );
+      Metab_claimOutputs(VECTOR_ELT(metabExternalPointers, w), models[w]);
+   }
+   bool estimateParams[3];
+   for(int p = 0; p < 3; p++) {
+      estimateParams[p] = LOGICAL(estimate)[p];
+   }
+
+   MetabOptim_Result* results = new MetabOptim_Result[numWindows];
+   scheduler.run(
+      numWindows,
+      models,
+      REAL(start),
+      estimateParams,
+      REAL(lower),
+      REAL(upper),
+      results
+   );
+
+   SEXP par = PROTECT(allocMatrix(REALSXP, numWindows, 3));
+   SEXP value = PROTECT(allocVector(REALSXP, numWindows));
+   SEXP evaluations = PROTECT(allocVector(INTSXP, numWindows));
+   SEXP convergence = PROTECT(allocVector(INTSXP, numWindows));
+   for(int w = 0; w < numWindows; w++) {
+      for(int p = 0; p < 3; p++) {
+         REAL(par)[w + p * numWindows] = results[w].par[p];
+      }
+      REAL(value)[w] = results[w].value;
+      INTEGER(evaluations)[w] = results[w].evaluations;
+      INTEGER(convergence)[w] = results[w].convergence;
+   }
+   delete[] models;
+   delete[] results;
+
+   SEXP vecOutput = PROTECT(allocVector(VECSXP, 4));
+   SET_VECTOR_ELT(vecOutput, 0, par);
+   SET_VECTOR_ELT(vecOutput, 1, value);
+   SET_VECTOR_ELT(vecOutput, 2, evaluations);
+   SET_VECTOR_ELT(vecOutput, 3, convergence);
+
+   SEXP vecOutput_names = PROTECT(allocVector(VECSXP, 4));
+   SET_VECTOR_ELT(vecOutput_names, 0, install("par"));
+   SET_VECTOR_ELT(vecOutput_names, 1, install("value"));
+   SET_VECTOR_ELT(vecOutput_names, 2, install("evaluations"));
+   SET_VECTOR_ELT(vecOutput_names, 3, install("convergence"));
+
+   setAttrib(vecOutput, install("names"), vecOutput_names);
+
+   UNPROTECT(6);
+   return vecOutput;
+}
@@ -1,8 +1,177 @@
 #include "metabc_R.h"
+#include <cstring>
+
+// Keeps the forcing vectors borrowed by a model that shares memory with R,
+// after initialize() has pointed the model at its new arrays
+void Metab_keepInputs
+(
+   SEXP externalPointer,
+   Metab* model,
+   std::initializer_list<SEXP> inputs
+)
+{
+   SEXP state = R_ExternalPtrProtected(externalPointer);
+
+   if (model->borrowInputs_) {
+      SEXP borrowed = PROTECT(allocVector(VECSXP, inputs.size()));
+      int index = 0;
+      for(SEXP input : inputs) {
+         MARK_NOT_MUTABLE(input);
+         SET_VECTOR_ELT(borrowed, index++, input);
+      }
+      SET_VECTOR_ELT(state, stateInputs, borrowed);
+      UNPROTECT(1);
+   } else {
+      SET_VECTOR_ELT(state, stateInputs, R_NilValue);
+   }
+
+   // Output memory from a previous initialization is no longer used
+   SET_VECTOR_ELT(state, stateOutputs, R_NilValue);
+   SET_VECTOR_ELT(state, stateConstants, R_NilValue);
+   LOGICAL(VECTOR_ELT(state, stateShared))[0] = FALSE;
+}
+
+// Points the model at new output vectors if the vectors it writes into
+// have been returned to R, so runs never change values R already holds.
+// The values are copied only if the caller may not overwrite all of them.
+void Metab_claimOutputs(SEXP externalPointer, Metab* model, bool preserve)
+{
+   SEXP state = R_ExternalPtrProtected(externalPointer);
+   if (!LOGICAL(VECTOR_ELT(state, stateShared))[0]) {
+      return;
+   }
+
+   SEXP outputs = VECTOR_ELT(state, stateOutputs);
+   SEXP names = getAttrib(outputs, R_NamesSymbol);
+   for(int v = 0; v < length(outputs); v++) {
+      SEXP column = allocVector(REALSXP, model->length_);
+      SET_VECTOR_ELT(outputs, v, column);
+      const char* name = CHAR(STRING_ELT(names, v));
+      double** slot = model->getOutputSlot(name);
+
+      // Runs in predictions only mode leave diagnostic output in place
+      if (
+         preserve ||
+         (
+            model->predictionsOnly_ &&
+            model->getOutputKind(name) == outputDiagnostic
+         )
+      ) {
+         memcpy(REAL(column), *slot, model->length_ * sizeof(double));
+      }
+      *slot = REAL(column);
+   }
+   LOGICAL(VECTOR_ELT(state, stateShared))[0] = FALSE;
+}
+
+// Checks that each vector of a batch of parameter sets has a numeric value
+// for each set. Optional vectors may instead be NULL.
+void Metab_checkParamSets
+(
+   int numSets,
+   std::initializer_list<SEXP> params,
+   std::initializer_list<SEXP> optionalParams
+)
+{
+   for(SEXP param : params) {
+      if (!isReal(param) || length(param) != numSets) {
+         error("Parameters must have one numeric value for each parameter set.");
+      }
+   }
+   for(SEXP param : optionalParams) {
+      if (!isNull(param) && (!isReal(param) || length(param) != numSets)) {
+         error("Parameters must have one numeric value for each parameter set.");
+      }
+   }
+}
+
+// Converts the code of a pH or DIC solver to the solver, rejecting codes
+// that name no solver.
+CarbonateEq::Solver Metab_asSolver(SEXP value)
+{
+   int code = asInteger(value);
+   if (code != CarbonateEq::brent && code != CarbonateEq::newton) {
+      error("Solver code must be 0 (Brent) or 1 (Newton).");
+   }
+   return (CarbonateEq::Solver)code;
+}
+
+// Gets a column of a summary of model output. Models that share memory
+// with R return the vector the model writes into (or, for constant
+// columns, a vector cached until the next initialization) without
+// copying the values.
+SEXP Metab_summaryColumn
+(
+   SEXP externalPointer,
+   Metab* model,
+   const char* name,
+   bool constant
+)
+{
+   SEXP state = R_ExternalPtrProtected(externalPointer);
+   double** slot = model->getOutputSlot(name);
+
+   if (!LOGICAL(VECTOR_ELT(state, stateZeroCopy))[0]) {
+      SEXP column = allocVector(REALSXP, model->length_);
+      memcpy(REAL(column), *slot, model->length_ * sizeof(double));
+      return column;
+   }
+
+   int element = constant ? stateConstants : stateOutputs;
+   SEXP columns = VECTOR_ELT(state, element);
+   SEXP names = getAttrib(columns, R_NamesSymbol);
+   for(int v = 0; v < length(columns); v++) {
+      if (!strcmp(CHAR(STRING_ELT(names, v)), name)) {
+         SEXP column = VECTOR_ELT(columns, v);
+         if (!constant) {
+            LOGICAL(VECTOR_ELT(state, stateShared))[0] = TRUE;
+         }
+         MARK_NOT_MUTABLE(column);
+         return column;
+      }
+   }
+
+   // The first request for a column moves it into memory owned by R
+   int numColumns = length(columns);
+   SEXP newColumns = PROTECT(allocVector(VECSXP, numColumns + 1));
+   SEXP newNames = PROTECT(allocVector(STRSXP, numColumns + 1));
+   for(int v = 0; v < numColumns; v++) {
+      SET_VECTOR_ELT(newColumns, v, VECTOR_ELT(columns, v));
+      SET_STRING_ELT(newNames, v, STRING_ELT(names, v));
+   }
+   SEXP column = allocVector(REALSXP, model->length_);
+   SET_VECTOR_ELT(newColumns, numColumns, column);
+   SET_STRING_ELT(newNames, numColumns, mkChar(name));
+   setAttrib(newColumns, R_NamesSymbol, newNames);
+   SET_VECTOR_ELT(state, element, newColumns);
+
+   memcpy(REAL(column), *slot, model->length_ * sizeof(double));
+   if (!constant) {
+      *slot = REAL(column);
+      LOGICAL(VECTOR_ELT(state, stateShared))[0] = TRUE;
+   }
+   MARK_NOT_MUTABLE(column);
+
+   UNPROTECT(2);
+   return column;
+}
+
+// Makes a named list of columns with equal lengths a data frame
+void Metab_setDataFrame(SEXP list, int numRows)
+{
+   SEXP rowNames = PROTECT(allocVector(INTSXP, 2));
+   INTEGER(rowNames)[0] = NA_INTEGER;
+   INTEGER(rowNames)[1] = -numRows;
+   setAttrib(list, R_RowNamesSymbol, rowNames);
+   setAttrib(list, R_ClassSymbol, mkString("data.frame"));
+
+   UNPROTECT(1);
+}
 
 SEXP Metab_run(SEXP metabExtPointer)
 {
    Metab* metabPointer = (Metab*)R_ExternalPtrAddr(metabExtPointer);
+   Metab_claimOutputs(metabExtPointer, metabPointer);
    metabPointer->run();
 
    return R_NilValue;
@@ -40,3 +209,313 @@ SEXP Metab_setk600(SEXP metabExternalPointer, SEXP value)
    UNPROTECT(1);
    return out;
 }
+
+SEXP Metab_setCalcSensitivity(SEXP metabExternalPointer, SEXP value)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->calcSensitivity_;
+   model->calcSensitivity_ = asLogical(value);
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP Metab_setZeroCopy(SEXP metabExternalPointer, SEXP value)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   SEXP state = R_ExternalPtrProtected(metabExternalPointer);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->borrowInputs_;
+   model->borrowInputs_ = asLogical(value);
+   LOGICAL(VECTOR_ELT(state, stateZeroCopy))[0] = model->borrowInputs_;
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP Metab_setPredictionsOnly(SEXP metabExternalPointer, SEXP value)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->predictionsOnly_;
+   model->predictionsOnly_ = asLogical(value);
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP Metab_setScanThreads(SEXP metabExternalPointer, SEXP value)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->scanThreads_;
+   model->scanThreads_ = asInteger(value);
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP Metab_setParcelThreads(SEXP metabExternalPointer, SEXP value)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   SEXP out = PROTECT(allocVector(REALSXP, 1));
+   REAL(out)[0] = model->parcelThreads_;
+   model->parcelThreads_ = asInteger(value);
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP Metab_getOutput(SEXP metabExternalPointer, SEXP names)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   int numColumns = length(names);
+   for(int v = 0; v < numColumns; v++) {
+      if (!model->getOutputSlot(CHAR(STRING_ELT(names, v)))) {
+         error(
+            "Model has no output variable named '%s'.",
+            CHAR(STRING_ELT(names, v))
+         );
+      }
+   }
+
+   SEXP out = PROTECT(allocVector(VECSXP, numColumns));
+   for(int v = 0; v < numColumns; v++) {
+      const char* name = CHAR(STRING_ELT(names, v));
+      SET_VECTOR_ELT(
+         out,
+         v,
+         Metab_summaryColumn(
+            metabExternalPointer,
+            model,
+            name,
+            model->getOutputKind(name) == outputConstant
+         )
+      );
+   }
+   setAttrib(out, R_NamesSymbol, names);
+   Metab_setDataFrame(out, model->length_);
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP Metab_getDoSensitivity(SEXP metabExternalPointer)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   MetabDo_Sensitivity* sensitivity = model->getDoSensitivity();
+   if (!sensitivity) {
+      return R_NilValue;
+   }
+
+   SEXP dailyGPP = PROTECT(allocVector(REALSXP, model->length_));
+   SEXP dailyER = PROTECT(allocVector(REALSXP, model->length_));
+   SEXP k600 = PROTECT(allocVector(REALSXP, model->length_));
+   for(int i = 0; i < model->length_; i++) {
+      REAL(dailyGPP)[i] = sensitivity->dailyGPP[i];
+      REAL(dailyER)[i] = sensitivity->dailyER[i];
+      REAL(k600)[i] = sensitivity->k600[i];
+   }
+
+   SEXP vecOutput = PROTECT(allocVector(VECSXP, 3));
+   SET_VECTOR_ELT(vecOutput, 0, dailyGPP);
+   SET_VECTOR_ELT(vecOutput, 1, dailyER);
+   SET_VECTOR_ELT(vecOutput, 2, k600);
+
+   SEXP vecOutput_names = PROTECT(allocVector(VECSXP, 3));
+   SET_VECTOR_ELT(vecOutput_names, 0, install("dailyGPP"));
+   SET_VECTOR_ELT(vecOutput_names, 1, install("dailyER"));
+   SET_VECTOR_ELT(vecOutput_names, 2, install("k600"));
+
+   setAttrib(vecOutput, install("names"), vecOutput_names);
+
+   UNPROTECT(5);
+   return vecOutput;
+}
+
+SEXP Metab_getDoSSEGradient(SEXP metabExternalPointer, SEXP obsDO)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   if (length(obsDO) != model->length_) {
+      error("Observations must have one value for each element of model output.");
+   }
+
+   SEXP sse = PROTECT(allocVector(REALSXP, 1));
+   SEXP gradient = PROTECT(allocVector(REALSXP, 3));
+   REAL(sse)[0] = model->calcDoSSEGradient(REAL(obsDO), REAL(gradient));
+
+   SEXP vecOutput = PROTECT(allocVector(VECSXP, 2));
+   SET_VECTOR_ELT(vecOutput, 0, sse);
+   SET_VECTOR_ELT(vecOutput, 1, gradient);
+
+   SEXP vecOutput_names = PROTECT(allocVector(VECSXP, 2));
+   SET_VECTOR_ELT(vecOutput_names, 0, install("sse"));
+   SET_VECTOR_ELT(vecOutput_names, 1, install("gradient"));
+
+   setAttrib(vecOutput, install("names"), vecOutput_names);
+
+   UNPROTECT(4);
+   return vecOutput;
+}
+
+SEXP Metab_setObjective
+(
+   SEXP metabExternalPointer,
+   SEXP type,
+   SEXP names,
+   SEXP obs,
+   SEXP sigma,
+   SEXP weights
+)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+
+   // Check all variables before the current objective is cleared
+   for(int v = 0; v < length(names); v++) {
+      SEXP varObs = VECTOR_ELT(obs, v);
+      SEXP varSigma = VECTOR_ELT(sigma, v);
+      if (!model->getOutputSlot(CHAR(STRING_ELT(names, v)))) {
+         error(
+            "Model has no output variable named '%s'.",
+            CHAR(STRING_ELT(names, v))
+         );
+      }
+      if (length(varObs) != model->length_) {
+         error("Observations must have one value for each element of model output.");
+      }
+      if (isNull(varSigma)) {
+         continue;
+      }
+      if (length(varSigma) != 1 && length(varSigma) != length(varObs)) {
+         error("Sigma must have one value or one value for each observation.");
+      }
+      for(int i = 0; i < length(varSigma); i++) {
+         if (!(REAL(varSigma)[i] > 0)) {
+            error("Sigma must be greater than zero.");
+         }
+      }
+   }
+
+   model->objective_.clear();
+   model->objective_.type_ = (MetabObjective::Type)asInteger(type);
+
+   for(int v = 0; v < length(names); v++) {
+      SEXP varObs = VECTOR_ELT(obs, v);
+      SEXP varSigma = VECTOR_ELT(sigma, v);
+      model->objective_.addVariable(
+         CHAR(STRING_ELT(names, v)),
+         REAL(varObs),
+         length(varObs),
+         isNull(varSigma) ? nullptr : REAL(varSigma),
+         isNull(varSigma) ? 0 : length(varSigma),
+         REAL(weights)[v]
+      );
+   }
+
+   return R_NilValue;
+}
+
+SEXP Metab_runObjective(SEXP metabExternalPointer, SEXP components)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   Metab_claimOutputs(metabExternalPointer, model);
+   if (!asLogical(components)) {
+      SEXP out = PROTECT(allocVector(REALSXP, 1));
+      REAL(out)[0] = model->runObjective();
+
+      UNPROTECT(1);
+      return out;
+   }
+
+   int numVariables = model->objective_.variables_.size();
+   SEXP value = PROTECT(allocVector(REALSXP, 1));
+   SEXP varComponents = PROTECT(allocVector(REALSXP, numVariables));
+   REAL(value)[0] = model->runObjective(REAL(varComponents));
+
+   SEXP varNames = PROTECT(allocVector(STRSXP, numVariables));
+   for(int v = 0; v < numVariables; v++) {
+      SET_STRING_ELT(
+         varNames,
+         v,
+         mkChar(model->objective_.variables_[v].name.c_str())
+      );
+   }
+   setAttrib(varComponents, R_NamesSymbol, varNames);
+
+   SEXP vecOutput = PROTECT(allocVector(VECSXP, 2));
+   SET_VECTOR_ELT(vecOutput, 0, value);
+   SET_VECTOR_ELT(vecOutput, 1, varComponents);
+
+   SEXP vecOutput_names = PROTECT(allocVector(VECSXP, 2));
+   SET_VECTOR_ELT(vecOutput_names, 0, install("value"));
+   SET_VECTOR_ELT(vecOutput_names, 1, install("components"));
+
+   setAttrib(vecOutput, install("names"), vecOutput_names);
+
+   UNPROTECT(5);
+   return vecOutput;
+}
+
+SEXP Metab_optimize
+(
+   SEXP metabExternalPointer,
+   SEXP method,
+   SEXP start,
+   SEXP estimate,
+   SEXP lower,
+   SEXP upper,
+   SEXP reltol,
+   SEXP maxit
+)
+{
+   Metab* model = (Metab*)R_ExternalPtrAddr(metabExternalPointer);
+   Metab_claimOutputs(metabExternalPointer, model);
+   bool estimateParams[3];
+   for(int p = 0; p < 3; p++) {
+      estimateParams[p] = LOGICAL(estimate)[p];
+   }
+
+   MetabOptim_Result result = model->optimize(
+      asInteger(method),
+      REAL(start),
+      estimateParams,
+      REAL(lower),
+      REAL(upper),
+      asReal(reltol),
+      asInteger(maxit)
+   );
+
+   SEXP par = PROTECT(allocVector(REALSXP, 3));
+   SEXP parNames = PROTECT(allocVector(STRSXP, 3));
+   const char* names[3] = {"dailyGPP", "dailyER", "k600"};
+   for(int p = 0; p < 3; p++) {
+      REAL(par)[p] = result.par[p];
+      SET_STRING_ELT(parNames, p, mkChar(names[p]));
+   }
+   setAttrib(par, R_NamesSymbol, parNames);
+
+   SEXP value = PROTECT(allocVector(REALSXP, 1));
+   REAL(value)[0] = result.value;
+   SEXP evaluations = PROTECT(allocVector(INTSXP, 1));
+   INTEGER(evaluations)[0] = result.evaluations;
+   SEXP convergence = PROTECT(allocVector(INTSXP, 1));
+   INTEGER(convergence)[0] = result.convergence;
+
+   SEXP vecOutput = PROTECT(allocVector(VECSXP, 4));
+   SET_VECTOR_ELT(vecOutput, 0, par);
+   SET_VECTOR_ELT(vecOutput, 1, value);
+   SET_VECTOR_ELT(vecOutput, 2, evaluations);
+   SET_VECTOR_ELT(vecOutput, 3, convergence);
+
+   SEXP vecOutput_names = PROTECT(allocVector(VECSXP, 4));
+   SET_VECTOR_ELT(vecOutput_names, 0, install("par"));
+   SET_VECTOR_ELT(vecOutput_names, 1, install("value"));
+   SET_VECTOR_ELT(vecOutput_names, 2, install("evaluations"));
+   SET_VECTOR_ELT(vecOutput_names, 3, install("convergence"));
+
+   setAttrib(vecOutput, install("names"), vecOutput_names);
+
+   UNPROTECT(7);
+   return vecOutput;
+}
@@ -1,6 +1,13 @@
 class CarbonateEq
 {
    public:
+      //! Algorithms available for solving pH from DIC and total alkalinity
+      enum Solver {
+         //! Brent minimization of the alkalinity residual over pH
+         brent = 0,
+         //! Safeguarded Newton iteration on the alkalinity residual over [H+]
+         newton = 1
+      };
       CarbonateEq(){};
       CarbonateEq(
          double tempC,
@@ -21,10 +28,33 @@ class CarbonateEq
       double kDissocH2OApp;
       double kHenryCO2;
       double kHenryCO2fromTempFunc;
+      //! Algorithm used by optpHFromDICTotalAlk
+      Solver pHSolver = brent;
+      //! Initial half width of a pH bracket around the previous solution
+      //! (warm start is disabled if not positive)
+      double warmStartWidth = 0;
+      //! pH from the previous solution (negative if there is none)
+      double lastpH = -1;
       void reset(
          double tempC,
          double eConduct
       );
+      void copyConstants(const CarbonateEq& source);
+      //! Calculates the constants set by reset for arrays of temperatures
+      //! and conductivities, without the rest of the state set by reset.
+      //! Results are identical to those of reset.
+      static void resetArray
+      (
+         int length,
+         const double* tempC,
+         const double* eConduct,
+         double* kDissocH2CO3App,
+         double* kDissocHCO3App,
+         double* kDissocH2OApp,
+         double* kHenryCO2,
+         double* activityCoeffH,
+         double* activityCoeffCO3
+      );
       void optfCO2FromDICTotalAlk
       (
          double concDIC,
@@ -34,6 +64,15 @@ class CarbonateEq
          double max,
          double out[]
       );
+      void optfCO2DerivFromDICTotalAlk
+      (
+         double concDIC,
+         double totalAlk,
+         double tolerance,
+         double min,
+         double max,
+         double out[]
+      );
       double optpHFromDICTotalAlk
       (
          double concDIC,
@@ -42,16 +81,46 @@ class CarbonateEq
          double min,
          double max
       );
+      double newtonpHFromDICTotalAlk
+      (
+         double concDIC,
+         double totalAlk,
+         double tolerance,
+         double min,
+         double max
+      );
       double calcTotalAlkFromDICpH
       (
          double concDIC,
          double pH
       );
+      double calcTotalAlkFromDICConcH
+      (
+         double concDIC,
+         double concH,
+         double* derivative
+      );
       double calcfCO2FromDICpH
       (
          double concDIC,
          double pH
       );
+      void speciate
+      (
+         int length,
+         const double* tempC,
+         const double* eConduct,
+         const double* concDIC,
+         const double* totalAlk,
+         double tolerance,
+         double min,
+         double max,
+         double* pH,
+         double* fCO2,
+         double* concCO2,
+         double* concHCO3,
+         double* concCO3
+      );
 };
 
 struct proposeDic_info
@@ -65,3 +134,12 @@ struct proposeDic_info
 };
 
 double proposeDic(double dic, void* info);
+
+double newtonDic
+(
+   proposeDic_info* info,
+   double guess,
+   double min,
+   double max,
+   double tolerance
+);
@@ -15,4 +15,16 @@ extern "C"
       SEXP pHmin,
       SEXP pHmax
    );
+   SEXP CarbonateEq_setpHSolver(SEXP externalPointer, SEXP value);
+   SEXP CarbonateEq_setWarmStartWidth(SEXP externalPointer, SEXP value);
+   SEXP CarbonateEq_speciate(
+      SEXP externalPointer,
+      SEXP tempC,
+      SEXP eConduct,
+      SEXP concDIC,
+      SEXP totalAlk,
+      SEXP pHtolerance,
+      SEXP pHmin,
+      SEXP pHmax
+   );
 }
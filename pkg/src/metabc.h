@@ -1,5 +1,7 @@
 #include "carbonate.h"
 #include "utilities.h"
+#include <string>
+#include <vector>
 
 //!  The structure for fundamental model output
 /*!
@@ -13,6 +15,157 @@ struct Metab_Output {
    double* cRespiration;
 };
 
+//!  The structure for sensitivities of DO to the model parameters
+/*!
+ *   This is a structure of arrays used to store the derivatives of
+ *   the DO concentrations with respect to the parameters of the model
+ */
+struct MetabDo_Sensitivity {
+   /*! Derivative of DO concentration with respect to daily GPP (days) */
+   double* dailyGPP;
+   /*! Derivative of DO concentration with respect to daily ER (days) */
+   double* dailyER;
+   /*! Derivative of DO concentration with respect to k600 (micromolarity days) */
+   double* k600;
+};
+
+//!  Kinds of model output variables, by when they are written
+enum Metab_OutputKind {
+   //! Predicted concentrations, written by every run
+   outputPrediction = 0,
+   //! Fluxes and rates explaining the predictions, not written by runs
+   //! in predictions only mode \sa Metab::predictionsOnly_
+   outputDiagnostic = 1,
+   //! Values that depend only on the forcing, written by initialize()
+   outputConstant = 2
+};
+
+class Metab;
+
+//!  Observations of a model output variable used by an objective function
+struct MetabObjective_Variable {
+   /*! Name of the output variable \sa Metab::getOutputVariable() */
+   std::string name;
+   /*! Observations for each element of model output (NaN if missing) */
+   std::vector<double> obs;
+   /*! Standard deviations of the observation errors (one value for all
+       observations, or one value for each observation) */
+   std::vector<double> sigma;
+   /*! Weight of the variable in the total objective */
+   double weight;
+};
+
+//!  An objective function comparing model output with observations
+/*!
+ *   Evaluates the fit of model output to observations of one or more
+ *   output variables directly from the arrays of the model. The total
+ *   is the weighted sum of the component for each variable.
+ */
+class MetabObjective {
+   public:
+      //! Types of objective functions
+      enum Type {
+         //! Sum of squared errors
+         sse = 0,
+         //! Gaussian negative log likelihood
+         gaussian = 1
+      };
+
+      //! The type of objective function
+      Type type_ = sse;
+      //! The observed variables
+      std::vector<MetabObjective_Variable> variables_;
+
+      //!  Removes all observed variables
+      void clear();
+
+      //!  Adds an observed variable
+      /*!
+       *   \param name
+       *     Name of the output variable \sa Metab::getOutputVariable()
+       *   \param obs
+       *     Array of observations for each element of model output
+       *     (NaN values are ignored)
+       *   \param length
+       *     Number of observations
+       *   \param sigma
+       *     Array of standard deviations of the observation errors, used
+       *     by the Gaussian objective (may be nullptr for SSE)
+       *   \param numSigma
+       *     Number of standard deviations (one for a single value applied
+       *     to all observations, or length for heteroscedastic errors)
+       *   \param weight
+       *     Weight of the variable in the total objective
+       */
+      void addVariable(
+         const char* name,
+         const double* obs,
+         int length,
+         const double* sigma,
+         int numSigma,
+         double weight
+      );
+
+      //!  Calculates the objective from the current output of a model
+      /*!
+       *   \param model
+       *     The model that has been run
+       *   \param components
+       *     Optional array that receives the unweighted component for each
+       *     variable
+       *
+       *   \return
+       *     The weighted sum of the components, or NaN if the model has no
+       *     output for one of the observed variables
+       */
+      double calc(Metab* model, double* components = nullptr) const;
+
+      //!  Whether the gradient can be calculated from the DO sensitivities
+      /*!
+       *   \param model
+       *     The model that will be run
+       *
+       *   \return
+       *     True if DO ("dox") is the only observed variable and the model
+       *     calculates sensitivities of DO \sa Metab::getDoSensitivity()
+       */
+      bool hasDoGradient(Metab* model) const;
+
+      //!  Calculates the gradient of the objective from the DO sensitivities
+      /*!
+       *   Uses the output and sensitivities of the last run of the model,
+       *   which must have been executed with calcSensitivity_ set to true.
+       *   \sa hasDoGradient()
+       *
+       *   \param model
+       *     The model that has been run
+       *   \param gradient
+       *     Array of three elements that receives the derivatives of the
+       *     objective with respect to daily GPP, daily ER and k600
+       */
+      void calcDoGradient(Metab* model, double* gradient) const;
+};
+
+//!  Methods available for the optimization of model parameters
+enum MetabOptim_Method {
+   //! Nelder-Mead simplex \sa NelderMead_fmin()
+   optimNelderMead = 0,
+   //! Bounded quasi-Newton \sa BFGSB_fmin()
+   optimBFGSB = 1
+};
+
+//!  The results of an optimization of the model parameters
+struct MetabOptim_Result {
+   /*! Estimates of daily GPP, daily ER and k600 */
+   double par[3];
+   /*! Value of the objective function at the estimates */
+   double value;
+   /*! Number of runs of the model */
+   int evaluations;
+   /*! Convergence code \sa Optim_Convergence */
+   int convergence;
+};
+
 //!  An abstract class providing the basic functions of a metabolism model
 /*!
  *   Provides the basic interface to a metabolism model, and defines
@@ -33,6 +186,25 @@ class Metab {
       double* gwAlpha_;
       //! Integer length of arrays for calculations
       int length_;
+      //! Whether runs also calculate the sensitivities of DO to the parameters
+      bool calcSensitivity_ = false;
+      //! Whether initialize() uses the forcing arrays provided in place
+      bool borrowInputs_ = false;
+      //! Whether runs only write the predicted concentrations, leaving the
+      //! diagnostic output of the previous run in place \sa Metab_OutputKind
+      bool predictionsOnly_ = false;
+      //! Number of threads used to resolve the DO recurrence with a
+      //! parallel scan (sequential if one, all available processors if
+      //! less than one) \sa linearScan()
+      int scanThreads_ = 1;
+      //! Number of threads used for the independent parcels of Lagrangian
+      //! models (sequential if one, all available processors if less
+      //! than one) \sa parallelChunks()
+      int parcelThreads_ = 1;
+      //! Objective function evaluated by runObjective()
+      MetabObjective objective_;
+      //! Memory for the arrays of the model and its output
+      Arena arena_;
 
       //! Object that will determine how GPP should be distributed based on PAR
       ParDistCalculator parDistCalculator_;
@@ -71,12 +243,176 @@ class Metab {
          double* gwAlpha = nullptr
       );
 
+      //!  Stores an array of length_ forcing values
+      /*!
+       *   Copies the values into the arena, or returns the array itself
+       *   if the model borrows its inputs (\sa borrowInputs_). A borrowed
+       *   array must remain valid and unchanged while the model uses it.
+       *
+       *   \param values
+       *     Array of forcing values provided to initialize()
+       *
+       *   \return
+       *     Pointer to the array the model reads the values from
+       */
+      double* storeInput(double* values);
+
       //!  Abstract definition of the run method
       /*!
        *   Inhereting classes must implement a run method to execute the model
        */
       virtual void run() = 0;
 
+      //!  Runs the model and evaluates the objective function
+      /*!
+       *   \param components
+       *     Optional array that receives the unweighted component of the
+       *     objective for each observed variable
+       *
+       *   \return
+       *     The value of the objective function \sa MetabObjective::calc()
+       */
+      double runObjective(double* components = nullptr);
+
+      //!  Abstract definition of the clone method
+      /*!
+       *   Inheriting classes must implement a clone method that creates an
+       *   independent copy of an initialized model, with its own memory
+       *   for all attributes and output.
+       *
+       *   \return
+       *     Pointer to the new model (the caller is responsible for deleting it)
+       */
+      virtual Metab* clone() = 0;
+
+      //!  Gets an output variable by name
+      /*!
+       *   \param name
+       *     Name of the output variable, matching the names used in the
+       *     summaries of model output (e.g. "cFixation")
+       *
+       *   \return
+       *     Pointer to the array of length_ values of the output variable,
+       *     or nullptr if the model has no output with that name
+       */
+      double* getOutputVariable(const char* name);
+
+      //!  Gets the attribute that points to an output variable by name
+      /*!
+       *   Pointing the attribute at another array of length_ values (e.g.
+       *   memory owned by R) makes subsequent runs write the output
+       *   variable directly into that array.
+       *
+       *   \param name
+       *     Name of the output variable \sa getOutputVariable()
+       *
+       *   \return
+       *     Pointer to the attribute, or nullptr if the model has no
+       *     output with that name
+       */
+      virtual double** getOutputSlot(const char* name);
+
+      //!  Gets the kind of an output variable by name
+      /*!
+       *   \param name
+       *     Name of the output variable \sa getOutputVariable()
+       *
+       *   \return
+       *     When the output variable is written \sa Metab_OutputKind
+       */
+      virtual Metab_OutputKind getOutputKind(const char* name);
+
+      //!  Gets the number of arrays allocated from the arena
+      /*!
+       *   Inheriting classes that allocate arrays of length_ from arena_
+       *   add their arrays to the count of their parent class, so that
+       *   initialize() can reserve memory for all of them at once.
+       *
+       *   \return
+       *     Upper bound on the number of arrays allocated by initialize()
+       */
+      virtual int arenaArrays();
+
+      //!  Gets the sensitivities of DO to the parameters
+      /*!
+       *   Sensitivities are only current after a run with calcSensitivity_
+       *   set to true.
+       *
+       *   \return
+       *     Pointer to the sensitivities, or nullptr if the model does
+       *     not calculate sensitivities
+       */
+      virtual MetabDo_Sensitivity* getDoSensitivity();
+
+      //!  Sum of squared errors of the DO predictions and its gradient
+      /*!
+       *   Uses the output and sensitivities of the last run, which must
+       *   have been executed with calcSensitivity_ set to true.
+       *
+       *   \param obsDO
+       *     Array of length_ observed DO concentrations (micromolarity).
+       *     NaN values are ignored.
+       *   \param gradient
+       *     Array of three elements that receives the derivatives of the
+       *     sum of squared errors with respect to daily GPP, daily ER
+       *     and k600
+       *
+       *   \return
+       *     The sum of squared errors, or NaN if the model does not
+       *     calculate sensitivities
+       */
+      double calcDoSSEGradient(const double* obsDO, double* gradient);
+
+      //!  Estimates the parameters by minimizing the objective function
+      /*!
+       *   Runs the minimization of the objective function set in
+       *   objective_ entirely in native code. Gradients for the bounded
+       *   quasi-Newton method come from the DO sensitivities when
+       *   available \sa MetabObjective::hasDoGradient(), or from central
+       *   differences otherwise. The model is left with the parameters
+       *   set to the estimates and the output of a run at the estimates.
+       *
+       *   \param method
+       *     The minimization method \sa MetabOptim_Method
+       *   \param start
+       *     Array of starting values for daily GPP, daily ER and k600.
+       *     Parameters that are not estimated are fixed at these values.
+       *   \param estimate
+       *     Array of three flags indicating which parameters are estimated
+       *   \param lower
+       *     Array of three lower bounds (may be -infinity)
+       *   \param upper
+       *     Array of three upper bounds (may be infinity)
+       *   \param reltol
+       *     Relative convergence tolerance
+       *   \param maxit
+       *     Maximum number of iterations (function evaluations for
+       *     Nelder-Mead)
+       *
+       *   \return
+       *     The estimates, objective value, number of runs and
+       *     convergence code
+       */
+      MetabOptim_Result optimize(
+         int method,
+         const double* start,
+         const bool* estimate,
+         const double* lower,
+         const double* upper,
+         double reltol,
+         int maxit
+      );
+
+      //!  Copies the calculators and run settings of another model
+      /*!
+       *   Copies the calculators, the sensitivity setting and the
+       *   objective function.
+       *
+       *   \param model
+       *     The model with the settings to copy
+       */
+      void copySettings(Metab* model);
+
       //!  Define the PAR distribution calculator to use
       /*!
        *   \param function
@@ -180,12 +516,33 @@ class MetabDo : virtual public Metab {
       double* parAvg_;
       //! Fractions of GPP corresponding to each time step (last element not used)
       double* parDist_;
+      //! Fractions of GPP for the change in PAR over each time step, used by solvers that integrate the linear change in production (last element not used)
+      double* parTilt_;
       //! Array of the durations of the time steps (last element not used)
       double* dt_;
       //! Array of saturated DO concentrations corresponding to time elements
       double* satDo_;
       //! Array of the gas exchange rates for DO (per day)
       double* kDo_;
+      //! Array of temperature dependent ratios of the DO gas exchange rate to k600 (unitless)
+      double* kDoSchmidt_;
+      //! Sensitivities of DO to the parameters (calculated if calcSensitivity_ is true)
+      MetabDo_Sensitivity sensitivityDo_;
+      //! Fraction of DO retained over each time step by solvers using a parallel scan
+      double* scanRetention_;
+
+      //! DO concentrations with no GPP or ER, driven by the initial DO and gas exchange (micromolarity)
+      double* doBasisForcing_;
+      //! Response of DO concentrations to a unit of DO production per day (micromolarity)
+      double* doBasisGPP_;
+      //! Response of DO concentrations to a unit of DO consumption per day (micromolarity)
+      double* doBasisER_;
+      //! The k600 used to calculate the superposition basis (negative if not calculated)
+      double superpositionk600_ = -1;
+      //! Observed DO concentrations for superpositionSSE() (NaN values are ignored)
+      double* superpositionObsDO_ = nullptr;
+      //! Inner products of the observations and basis used by superpositionSSE()
+      double superpositionProducts_[6];
 
       //! Output structure for DO related output
       MetabDo_Output outputDo_;
@@ -251,6 +608,125 @@ class MetabDo : virtual public Metab {
        *   Inhereting classes must implement a run method to execute the model
        */
       virtual void run() = 0;
+
+      //!  Calculates the fractions of GPP for each time step
+      /*!
+       *   Called by initialize() because the distribution only depends on
+       *   the forcing. Distributes GPP by the PAR at the start of each
+       *   time step.
+       */
+      virtual void calcParDist();
+
+      //!  Initializes the model as a copy of another initialized model
+      /*!
+       *   Used by implementations of clone(). Calculators, parameters and
+       *   forcing are copied from the other model.
+       *
+       *   \param model
+       *     The model to copy
+       */
+      void initializeCopy(MetabDo* model);
+
+      //!  Gets the attribute that points to an output variable by name
+      /*!
+       *   Adds the DO output to the variables available from Metab
+       *   \sa Metab::getOutputSlot()
+       */
+      double** getOutputSlot(const char* name);
+
+      //!  Gets the kind of an output variable by name
+      /*!
+       *   \sa Metab::getOutputKind()
+       */
+      Metab_OutputKind getOutputKind(const char* name);
+
+      //!  Gets the number of arrays allocated from the arena
+      /*!
+       *   \sa Metab::arenaArrays()
+       */
+      int arenaArrays();
+
+      //!  Gets the sensitivities of DO to the parameters
+      /*!
+       *   \sa Metab::getDoSensitivity()
+       */
+      MetabDo_Sensitivity* getDoSensitivity();
+
+      //!  Runs the DO model for several sets of parameters
+      /*!
+       *   All parameter sets share the forcing of the model. The generic
+       *   implementation runs the model once for each set, then restores
+       *   the parameters and runs the model once more at them, so the
+       *   output of the model matches the restored parameters.
+       *
+       *   \param numSets
+       *     Number of parameter sets
+       *   \param dailyGPP
+       *     Array of daily gross primary production for each set
+       *   \param dailyER
+       *     Array of daily ecosystem respiration for each set
+       *   \param k600
+       *     Array of gas exchange rates at a Schmidt number of 600 for each set
+       *   \param ratioDoCFix
+       *     Array of ratios of moles O2 produced per moles carbon fixed
+       *     for each set (the current ratio is used for all sets if nullptr)
+       *   \param ratioDoCResp
+       *     Array of ratios of moles O2 consumed per moles carbon respired
+       *     for each set (the current ratio is used for all sets if nullptr)
+       *   \param dox
+       *     Array of length_ * numSets elements that receives the DO
+       *     concentrations (micromolarity), one time series after another
+       */
+      virtual void runBatch(
+         int numSets,
+         const double* dailyGPP,
+         const double* dailyER,
+         const double* k600,
+         const double* ratioDoCFix,
+         const double* ratioDoCResp,
+         double* dox
+      );
+
+      //!  Calculates the basis trajectories for the current k600
+      /*!
+       *   With k600 and the forcing fixed, DO concentrations are an
+       *   affine function of DO production and consumption. Three runs
+       *   of the model provide the trajectory with no metabolism and
+       *   the responses to a unit of daily production and consumption
+       *   of DO. A final run at the current parameters leaves the
+       *   model output consistent with them.
+       */
+      void calcSuperposition();
+
+      //!  Calculates DO concentrations from the superposition basis
+      /*!
+       *   Fills outputDo_.dox as a weighted sum of the basis trajectories
+       *   for the current daily GPP and ER, recalculating the basis if
+       *   k600 has changed. Other output is not updated, use run() for
+       *   the full output.
+       */
+      void runSuperposition();
+
+      //!  Sets the observed DO concentrations used by superpositionSSE()
+      /*!
+       *   \param obsDO
+       *     Array of observed DO concentrations (micromolarity) corresponding
+       *     to each time. NaN values are excluded from the sum of squares.
+       */
+      void setSuperpositionObs(double* obsDO);
+
+      //!  Sum of squared errors of the DO predictions
+      /*!
+       *   Evaluated from inner products of the observations and basis
+       *   trajectories without running the model, recalculating the basis
+       *   if k600 has changed.
+       *
+       *   \return
+       *     Sum of squared differences between observed and predicted
+       *     DO concentrations (micromolarity squared), or NaN if no
+       *     observations have been set
+       */
+      double superpositionSSE();
 };
 
 //! An implementation of MetabDo using a Forward Euler type solution
@@ -266,6 +742,58 @@ class MetabForwardEulerDo : virtual public MetabDo {
        *   \sa MetabDo::run()
        */
       void run();
+
+      //!  Runs the time steps specialized for the settings of the model
+      /*!
+       *   \tparam diagnostics
+       *     Whether the diagnostic output is written \sa predictionsOnly_
+       */
+      template <bool diagnostics>
+      void selectSteps();
+
+      //!  Runs the time steps of the Forward Euler DO model
+      /*!
+       *   Specialized at compile time for groundwater input, the
+       *   calculation of sensitivities and the writing of diagnostic
+       *   output, so the loops over time steps have no branches.
+       *   \sa run()
+       */
+      template <bool groundwater, bool sensitivity, bool diagnostics>
+      void runSteps();
+
+      //!  Runs the time steps of the Forward Euler DO model with a parallel scan
+      /*!
+       *   Calculates the retention and input of DO over every time step,
+       *   then resolves the DO recurrence with linearScan() using
+       *   scanThreads_ threads. Diagnostic output and sensitivities are
+       *   calculated from the resolved DO concentrations.
+       *   \sa runSteps()
+       */
+      template <bool groundwater, bool sensitivity, bool diagnostics>
+      void scanSteps();
+
+      //!  Implements the clone function abstracted in Metab
+      /*!
+       *   \sa Metab::clone()
+       */
+      Metab* clone();
+
+      //!  Runs the Forward Euler DO model for several sets of parameters
+      /*!
+       *   Parameter sets are advanced together through the DO recurrence
+       *   in blocks of batchLanes. Parameters and output of the model
+       *   are not changed.
+       *   \sa MetabDo::runBatch()
+       */
+      void runBatch(
+         int numSets,
+         const double* dailyGPP,
+         const double* dailyER,
+         const double* k600,
+         const double* ratioDoCFix,
+         const double* ratioDoCResp,
+         double* dox
+      );
 };
 
 //! An implementation of MetabDo using a Crank Nicolson type solution
@@ -280,6 +808,120 @@ public:
     *   \sa MetabDo::run()
     */
    void run();
+
+   /*!
+    *   Runs the time steps specialized for the settings of the model.
+    *
+    *   \tparam diagnostics
+    *     Whether the diagnostic output is written \sa predictionsOnly_
+    */
+   template <bool diagnostics>
+   void selectSteps();
+
+   /*!
+    *   Runs the time steps of the Crank Nicolson DO model, specialized
+    *   at compile time for the calculation of sensitivities and the
+    *   writing of diagnostic output so the loops over time steps have
+    *   no branches.
+    *   \sa run()
+    */
+   template <bool sensitivity, bool diagnostics>
+   void runSteps();
+
+   /*!
+    *   Runs the time steps of the Crank Nicolson DO model with a parallel
+    *   scan, resolving the DO recurrence with linearScan() using
+    *   scanThreads_ threads.
+    *   \sa runSteps()
+    */
+   template <bool sensitivity, bool diagnostics>
+   void scanSteps();
+
+   //!  Implements the clone function abstracted in Metab
+   /*!
+    *   \sa Metab::clone()
+    */
+   Metab* clone();
+
+   /*!
+    *   Distributes GPP by the average PAR over each time step.
+    *   \sa MetabDo::calcParDist()
+    */
+   void calcParDist();
+
+   /*!
+    *   Runs the Crank Nicolson DO model for several sets of parameters.
+    *   Parameter sets are advanced together through the DO recurrence
+    *   in blocks of batchLanes. Parameters and output of the model
+    *   are not changed.
+    *   \sa MetabDo::runBatch()
+    */
+   void runBatch(
+      int numSets,
+      const double* dailyGPP,
+      const double* dailyER,
+      const double* k600,
+      const double* ratioDoCFix,
+      const double* ratioDoCResp,
+      double* dox
+   );
+};
+
+//! An implementation of MetabDo using an exponential integrator
+/*!
+ *   Between samples, DO is linear in the DO concentration. Holding the
+ *   gas exchange rate at its average over each time step (groundwater
+ *   turnover at its value at the start of the step), and letting
+ *   production and the DO saturation concentration vary linearly
+ *   between samples, each step is integrated exactly with the phi
+ *   functions of the decay. The solution is unconditionally stable, so
+ *   coarse time steps with large k * dt remain accurate.
+ *   \sa phiCalc()
+ */
+class MetabExponentialDo : virtual public MetabDo {
+   public:
+      // Inherit constructors and destructors from base class
+      using MetabDo::MetabDo;
+
+      //!  Implements the run function abstracted in MetabDo
+      /*!
+       *   Runs the metabolism model for DO by exact integration over
+       *   each time step.
+       *   \sa MetabDo::run()
+       */
+      void run();
+
+      //!  Runs the time steps specialized for the settings of the model
+      /*!
+       *   \tparam diagnostics
+       *     Whether the diagnostic output is written \sa predictionsOnly_
+       */
+      template <bool diagnostics>
+      void selectSteps();
+
+      //!  Runs the time steps of the exponential DO model
+      /*!
+       *   Specialized at compile time for groundwater input, the
+       *   calculation of sensitivities and the writing of diagnostic
+       *   output, so the loops over time steps have no branches.
+       *   \sa run()
+       */
+      template <bool groundwater, bool sensitivity, bool diagnostics>
+      void runSteps();
+
+      //!  Implements the clone function abstracted in Metab
+      /*!
+       *   \sa Metab::clone()
+       */
+      Metab* clone();
+
+      //!  Distributes GPP by the average PAR over each time step
+      /*!
+       *   Also stores the fraction of GPP for the change in PAR over
+       *   each time step, so runs do not call the PAR calculator.
+       *   \sa MetabDo::calcParDist()
+       */
+      void calcParDist();
 };
 
 class MetabLagrangeDo : virtual public Metab {
@@ -334,6 +976,12 @@ class MetabLagrangeDo : virtual public Metab {
       double* upstreamkDo_;
       //! Array of the gas exchange rates for DO (per day) when the parcels are passing the downstream end
       double* downstreamkDo_;
+      //! Temperature dependence of the DO gas exchange rate (per unit k600) when the parcels are passing the upstream end
+      double* upstreamkDoSchmidt_;
+      //! Temperature dependence of the DO gas exchange rate (per unit k600) when the parcels are passing the downstream end
+      double* downstreamkDoSchmidt_;
+      //! Sensitivities of DO to the parameters (calculated if calcSensitivity_ is true)
+      MetabDo_Sensitivity sensitivityDo_;
 
       //! Output structure for DO related output
       MetabDo_Output outputDo_;
@@ -407,43 +1055,259 @@ class MetabLagrangeDo : virtual public Metab {
        *   Inhereting classes must implement a run method to execute the model
        */
       virtual void run() = 0;
+
+      //!  Prepares any state derived from the forcing of each parcel
+      /*!
+       *   Called at the end of initialize(), so implementations can do
+       *   work that does not depend on the parameters once rather than
+       *   in every run. The default does nothing.
+       */
+      virtual void initializeParcels();
+
+      //!  Initializes the model as a copy of another initialized model
+      /*!
+       *   Used by implementations of clone(). Calculators, parameters and
+       *   forcing are copied from the other model.
+       *
+       *   \param model
+       *     The model to copy
+       */
+      void initializeCopy(MetabLagrangeDo* model);
+
+      //!  Gets the attribute that points to an output variable by name
+      /*!
+       *   Adds the DO output to the variables available from Metab
+       *   \sa Metab::getOutputSlot()
+       */
+      double** getOutputSlot(const char* name);
+
+      //!  Gets the kind of an output variable by name
+      /*!
+       *   \sa Metab::getOutputKind()
+       */
+      Metab_OutputKind getOutputKind(const char* name);
+
+      //!  Gets the number of arrays allocated from the arena
+      /*!
+       *   \sa Metab::arenaArrays()
+       */
+      int arenaArrays();
+
+      //!  Gets the sensitivities of DO to the parameters
+      /*!
+       *   \sa Metab::getDoSensitivity()
+       */
+      MetabDo_Sensitivity* getDoSensitivity();
 };
 
+//!  The parcels advanced by the one step Crank Nicolson solution
+/*!
+ *   A structure of parameters and arrays shared by the models that run
+ *   the one step solution for DO, so the arithmetic over parcels is
+ *   written once. Arrays that are not used by a specialization of
+ *   MetabLagrangeCN_run() may be null pointers.
+ *   \sa MetabLagrangeCNOneStepDo, MetabNetwork
+ */
+struct MetabLagrangeCN_Parcels {
+   /*! Daily gross primary production */
+   double dailyGPP = 0;
+   /*! Daily ecosystem respiration */
+   double dailyER = 0;
+   /*! Gas exchange rate at a Schmidt number of 600 */
+   double k600 = 0;
+   /*! Ratio of DO produced to carbon fixed */
+   double ratioDoCFix = 0;
+   /*! Ratio of DO consumed to carbon respired */
+   double ratioDoCResp = 0;
+   /*! Travel time of each parcel (days) */
+   const double* travelTimes = nullptr;
+   /*! Fraction of daily GPP over the travel time of each parcel */
+   const double* parDist = nullptr;
+   /*! DO of each parcel passing the upstream end */
+   const double* upstreamDO = nullptr;
+   /*! Saturated DO of each parcel passing the upstream end */
+   const double* upstreamSatDo = nullptr;
+   /*! Saturated DO of each parcel passing the downstream end */
+   const double* downstreamSatDo = nullptr;
+   /*! Temperature dependence of gas exchange at the upstream end */
+   const double* upstreamkDoSchmidt = nullptr;
+   /*! Temperature dependence of gas exchange at the downstream end */
+   const double* downstreamkDoSchmidt = nullptr;
+   /*! Turnover rate of water due to groundwater input (groundwater runs) */
+   const double* gwAlpha = nullptr;
+   /*! DO of the groundwater input (groundwater runs) */
+   const double* gwDO = nullptr;
+   /*! Predicted DO of each parcel passing the downstream end */
+   double* dox = nullptr;
+   /*! Carbon fixed by each parcel (diagnostic runs) */
+   double* cFixation = nullptr;
+   /*! Carbon respired by each parcel (diagnostic runs) */
+   double* cRespiration = nullptr;
+   /*! DO produced by each parcel (diagnostic runs) */
+   double* doProduction = nullptr;
+   /*! DO consumed by each parcel (diagnostic runs) */
+   double* doConsumption = nullptr;
+   /*! DO equilibrated with the atmosphere by each parcel (diagnostic runs) */
+   double* doEquilibration = nullptr;
+   /*! Gas exchange rate of DO at the upstream end (diagnostic runs) */
+   double* upstreamkDo = nullptr;
+   /*! Gas exchange rate of DO at the downstream end (diagnostic runs) */
+   double* downstreamkDo = nullptr;
+   /*! Derivative of DO with respect to daily GPP (sensitivity runs) */
+   double* sensitivityDailyGPP = nullptr;
+   /*! Derivative of DO with respect to daily ER (sensitivity runs) */
+   double* sensitivityDailyER = nullptr;
+   /*! Derivative of DO with respect to k600 (sensitivity runs) */
+   double* sensitivityk600 = nullptr;
+};
+
+//!  Runs a range of parcels with the one step Crank Nicolson solution
+/*!
+ *   Specialized at compile time for groundwater input, the calculation
+ *   of sensitivities and the writing of diagnostic output, so the loop
+ *   over parcels has no branches.
+ *
+ *   \tparam lanes
+ *     Whether the parcels are run in blocks of batchLanes lanes, which
+ *     are gathered into local arrays and advanced together by loops
+ *     with a fixed number of iterations that the compiler turns into
+ *     vector instructions. Results are identical to the scalar loop.
+ *   \param parcels
+ *     The parameters and arrays of the parcels
+ *   \param first
+ *     Index of the first parcel
+ *   \param last
+ *     Index one past the last parcel
+ */
+template <bool groundwater, bool sensitivity, bool diagnostics, bool lanes>
+void MetabLagrangeCN_run(
+   const MetabLagrangeCN_Parcels& parcels,
+   int first,
+   int last
+);
+
 //! An implementation of MetabLagrangeDo based on Crank Nicolson approximations in one time step
 class MetabLagrangeCNOneStepDo : virtual public MetabLagrangeDo {
    public:
       // Inherit constructors and destructors from the base class
       using MetabLagrangeDo::MetabLagrangeDo;
 
+      //! Whether runs use the scalar loop over parcels rather than the
+      //! lane kernel, which remains as the reference for the kernel
+      //! \sa MetabLagrangeCN_run()
+      bool scalarParcels_ = false;
+
       /*!
        *   Runs the metabolism model for DO based on linear approximations
        *   used in the provided generic class
        *   \sa MetabLagrangeDo::run()
        */
       void run();
+
+      //!  Runs the parcels specialized for the settings of the model
+      /*!
+       *   \tparam diagnostics
+       *     Whether the diagnostic output is written \sa predictionsOnly_
+       *   \tparam lanes
+       *     Whether the lane kernel is used \sa scalarParcels_
+       */
+      template <bool diagnostics, bool lanes>
+      void selectParcels();
+
+      //!  Runs the parcels of the model
+      /*!
+       *   Chunks of parcels are run in parallel by
+       *   MetabLagrangeCN_run(). \sa run()
+       */
+      template <bool groundwater, bool sensitivity, bool diagnostics, bool lanes>
+      void runParcels();
+
+      //!  Implements the clone function abstracted in Metab
+      /*!
+       *   \sa Metab::clone()
+       */
+      Metab* clone();
 };
 
 //! An implementation of MetabLagrangeDo using a generic type to specify MetabDO type
 template <class T>
 class MetabLagrangeGenericDo : virtual public MetabLagrangeDo {
    public:
-      // Inherit constructors and destructors from the base class
+      // Inherit constructors from the base class
       using MetabLagrangeDo::MetabLagrangeDo;
 
-      //! Array of MetabDo objects used for each parcel simulation
-      MetabDo* parcelModels;
+      //!  Destroy the object
+      /*!
+       *   Deletes the pool of parcel models
+       */
+      ~MetabLagrangeGenericDo();
+
+      // Attributes
+
+      //! Pool of models that integrate the parcels, one for each thread.
+      //! Models are reused for every parcel and every run, with their
+      //! forcing pointed at the parcel arrays below.
+      std::vector<T*> parcelModels_;
+      //! Time steps along the travel time of each parcel (days), with
+      //! lengthTimeVector_ elements for each parcel
+      std::vector<double> parcelDt_;
+      //! PAR interpolated along the travel time of each parcel
+      std::vector<double> parcelPar_;
+      //! Fractions of GPP over the time steps of each parcel
+      std::vector<double> parcelParDist_;
+      //! Fractions of GPP for the change in PAR over the time steps of
+      //! each parcel (only used by exponential solvers)
+      std::vector<double> parcelParTilt_;
+      //! Saturated DO concentrations along the travel time of each parcel
+      std::vector<double> parcelSatDo_;
+      //! Temperature dependence of the DO gas exchange rate (per unit
+      //! k600) along the travel time of each parcel
+      std::vector<double> parcelkDoSchmidt_;
+
+      // Methods
 
+      //!  Calculates the forcing of the parcel models for each parcel
       /*!
-       *   Runs the metabolism model for DO based on linear approximations
-       *   used in the provided generic class
+       *   Forcing is interpolated linearly between the upstream and
+       *   downstream ends over the lengthTimeVector_ times along the
+       *   travel time of each parcel, and the arrays of the parcel models
+       *   that do not depend on the parameters are stored for all parcels.
+       *   \sa MetabLagrangeDo::initializeParcels()
+       */
+      void initializeParcels();
+
+      //!  Initializes a parcel model with the forcing of a parcel
+      /*!
+       *   \param model
+       *     The parcel model to initialize
+       *   \param parcel
+       *     Index of the parcel
+       */
+      void initializeParcelModel(T* model, int parcel);
+
+      /*!
+       *   Runs the metabolism model for DO by integrating each parcel
+       *   over lengthTimeVector_ - 1 time steps with the solution scheme
+       *   of the provided generic class, which must be a MetabDo solver.
+       *   Output for each parcel is the DO concentration at the downstream
+       *   end, with fluxes totaled over the travel time.
        *   \sa MetabLagrangeDo::run()
        */
       void run();
+
+      //!  Implements the clone function abstracted in Metab
+      /*!
+       *   \sa Metab::clone()
+       */
+      Metab* clone();
 };
 // Include the definition of the details of implemetation for this template
 // of a generic class
 #include "MetabLagrangeGenericDo.hpp"
 
+// Include the definition of the one step Crank Nicolson kernel
+#include "MetabLagrangeCN.hpp"
+
 //!  The structure for DIC related model output
 /*!
  *   This is a structure of arrays used to store the
@@ -491,12 +1355,18 @@ class MetabDoDic : virtual public MetabDo {
       double* kCO2_;
       //! Array of henry's constants for carbon dioxide corresponding to each time element
       double* kH_;
+      //! Array of temperature dependent ratios of the CO2 gas exchange rate to k600 (unitless)
+      double* kCO2Schmidt_;
       //! Pointer to the function to use to calculate the gas exchange rate for carbon dioxide from the k600
       double (*kSchmidtCO2Calculator_)(double tempC, double k600);
       //! Structure for DIC related output
       MetabDic_Output outputDic_;
       //! The object to use for carbonate equilibrium calculations
       CarbonateEq carbonateEq_;
+      //! Carbonate equilibrium constants for the temperature at each time element
+      CarbonateEq* carbonateConstants_ = nullptr;
+      //! Algorithm used to solve for DIC in implicit time steps (ignored by explicit solutions)
+      CarbonateEq::Solver dicSolver_ = CarbonateEq::brent;
 
       // Methods
 
@@ -570,6 +1440,75 @@ class MetabDoDic : virtual public MetabDo {
        */
       virtual void run() = 0;
 
+      //!  Runs the DO and DIC model for several sets of parameters
+      /*!
+       *   All parameter sets share the forcing of the model. The model is
+       *   run once for each set because the carbonate equilibrium makes
+       *   DIC nonlinear in the parameters. Parameters are restored
+       *   afterwards and the model is run once more at them, so the
+       *   output of the model matches the restored parameters.
+       *   \sa MetabDo::runBatch()
+       *
+       *   \param ratioDicCFix
+       *     Array of ratios of the moles of DIC-C consumed per mole of
+       *     organic carbon fixed for each set (current ratio used if nullptr)
+       *   \param ratioDicCResp
+       *     Array of ratios of the moles of DIC-C produced per mole of
+       *     organic carbon respired for each set (current ratio used if nullptr)
+       *   \param dic
+       *     Array of length_ * numSets elements that receives the DIC
+       *     concentrations (micromolarity)
+       *   \param pCO2
+       *     Array of length_ * numSets elements that receives the pCO2
+       *     (microatmospheres)
+       *   \param pH
+       *     Array of length_ * numSets elements that receives the pH
+       */
+      void runBatchDic(
+         int numSets,
+         const double* dailyGPP,
+         const double* dailyER,
+         const double* k600,
+         const double* ratioDoCFix,
+         const double* ratioDoCResp,
+         const double* ratioDicCFix,
+         const double* ratioDicCResp,
+         double* dox,
+         double* dic,
+         double* pCO2,
+         double* pH
+      );
+
+      //!  Initializes the model as a copy of another initialized model
+      /*!
+       *   Used by implementations of clone(). Calculators, parameters,
+       *   forcing and carbonate equilibrium settings are copied from the
+       *   other model.
+       *
+       *   \param model
+       *     The model to copy
+       */
+      void initializeCopy(MetabDoDic* model);
+
+      //!  Gets the attribute that points to an output variable by name
+      /*!
+       *   Adds the DIC output to the variables available from MetabDo
+       *   \sa Metab::getOutputSlot()
+       */
+      double** getOutputSlot(const char* name);
+
+      //!  Gets the kind of an output variable by name
+      /*!
+       *   \sa Metab::getOutputKind()
+       */
+      Metab_OutputKind getOutputKind(const char* name);
+
+      //!  Gets the number of arrays allocated from the arena
+      /*!
+       *   \sa Metab::arenaArrays()
+       */
+      int arenaArrays();
+
       //!  Define the Schmidt number calculator to use
       /*!
        *   \param function
@@ -609,6 +1548,12 @@ class MetabForwardEulerDoDic :
        *   \sa MetabDoDic::run()
        */
       void run();
+
+      //!  Implements the clone function abstracted in Metab
+      /*!
+       *   \sa Metab::clone()
+       */
+      Metab* clone();
 };
 
 //!  An implementation of MetabDoDic using a Forward Euler type solution
@@ -644,6 +1589,48 @@ class MetabCrankNicolsonDoDic :
        *   \sa MetabDoDic::run()
        */
       void run();
+
+      //!  Implements the clone function abstracted in Metab
+      /*!
+       *   \sa Metab::clone()
+       */
+      Metab* clone();
+};
+
+//!  An implementation of MetabDoDic using an exponential integrator
+/*!
+ *   This class inherits from MetabDoDic to implement a DoDic model,
+ *   and also inherits the functions of MetabExponentialDo to perform
+ *   the DO calculations. DIC is advanced by an exponential Euler step:
+ *   the aqueous CO2 concentration is linearized in DIC at the start of
+ *   each time step, and the resulting linear equation is integrated
+ *   exactly. Steps are unconditionally stable with respect to gas
+ *   exchange.
+ */
+class MetabExponentialDoDic :
+   public MetabDoDic,
+   public MetabExponentialDo
+{
+   public:
+
+      // Inherit constructors and destructors from base class
+      using MetabDoDic::MetabDoDic;
+
+      // Methods
+
+      //!  Implements the run function abstracted in MetabDoDic
+      /*!
+       *   Runs the metabolism model for DO and DIC based on exponential
+       *   integration over each time step.
+       *   \sa MetabDoDic::run()
+       */
+      void run();
+
+      //!  Implements the clone function abstracted in Metab
+      /*!
+       *   \sa Metab::clone()
+       */
+      Metab* clone();
 };
 
 class MetabLagrangeDoDic : virtual public MetabLagrangeDo {
@@ -688,6 +1675,10 @@ class MetabLagrangeDoDic : virtual public MetabLagrangeDo {
       double* upstreamkCO2_;
       //! Gas exchange rate for CO2 as a parcel passes downstream end
       double* downstreamkCO2_;
+      //! Temperature dependence of the CO2 gas exchange rate (per unit k600) as a parcel passes the upstream end
+      double* upstreamkCO2Schmidt_;
+      //! Temperature dependence of the CO2 gas exchange rate (per unit k600) as a parcel passes the downstream end
+      double* downstreamkCO2Schmidt_;
       //! Henry's constant as a parcel passes the upstream end
       double* upstreamkH_;
       //! Henry's constant as a parcel passes the downstream end
@@ -697,6 +1688,10 @@ class MetabLagrangeDoDic : virtual public MetabLagrangeDo {
       double (*kSchmidtCO2Calculator_)(double tempC, double k600);
       //! The object to use for carbonate equilibrium calculations
       CarbonateEq carbonateEq_;
+      //! Carbonate equilibrium constants for the temperature as each parcel passes the downstream end
+      CarbonateEq* downstreamCarbonateConstants_ = nullptr;
+      //! Algorithm used to solve for DIC in implicit time steps (ignored by explicit solutions)
+      CarbonateEq::Solver dicSolver_ = CarbonateEq::brent;
 
       //! Structure for DIC related output
       MetabDic_Output outputDic_;
@@ -790,6 +1785,36 @@ class MetabLagrangeDoDic : virtual public MetabLagrangeDo {
        */
       virtual void run() = 0;
 
+      //!  Initializes the model as a copy of another initialized model
+      /*!
+       *   Used by implementations of clone(). Calculators, parameters,
+       *   forcing and carbonate equilibrium settings are copied from the
+       *   other model.
+       *
+       *   \param model
+       *     The model to copy
+       */
+      void initializeCopy(MetabLagrangeDoDic* model);
+
+      //!  Gets the attribute that points to an output variable by name
+      /*!
+       *   Adds the DIC output to the variables available from MetabLagrangeDo
+       *   \sa Metab::getOutputSlot()
+       */
+      double** getOutputSlot(const char* name);
+
+      //!  Gets the kind of an output variable by name
+      /*!
+       *   \sa Metab::getOutputKind()
+       */
+      Metab_OutputKind getOutputKind(const char* name);
+
+      //!  Gets the number of arrays allocated from the arena
+      /*!
+       *   \sa Metab::arenaArrays()
+       */
+      int arenaArrays();
+
       //!  Define the Schmidt number calculator to use
       /*!
        *   \param function
@@ -827,4 +1852,623 @@ class MetabLagrangeCNOneStepDoDic :
        *   \sa MetabLagrangeDo::run()
        */
       void run();
+
+      //!  Implements the clone function abstracted in Metab
+      /*!
+       *   \sa Metab::clone()
+       */
+      Metab* clone();
+};
+
+//!  Sensor time series at one end of a reach used to build parcels
+/*!
+ *   Arrays that are not measured at an end are null pointers.
+ *   \sa MetabParcels
+ */
+struct MetabParcels_Series {
+   /*! Number of elements in each array */
+   int length = 0;
+   /*! Times of the observations (days), increasing for the upstream end */
+   const double* time = nullptr;
+   /*! Water temperatures (deg C) */
+   const double* temp = nullptr;
+   /*! Photosynthetically active radiation */
+   const double* par = nullptr;
+   /*! Dissolved oxygen concentrations (upstream end, or observations
+       at the downstream end of a segment \sa MetabNetwork) */
+   const double* dox = nullptr;
+   /*! Air pressures (downstream end) */
+   const double* airPressure = nullptr;
+   /*! Dissolved inorganic carbon concentrations (upstream end) */
+   const double* dic = nullptr;
+   /*! Alkalinities */
+   const double* alkalinity = nullptr;
+   /*! Partial pressures of carbon dioxide in the air (downstream end) */
+   const double* pCO2air = nullptr;
+};
+
+//!  Builds the water parcels of a Lagrangian model from sensor series
+/*!
+ *   A parcel leaves the reach at each time of the downstream series and
+ *   entered the reach one travel time earlier. Upstream values are
+ *   interpolated linearly to the entry times in a single pass that
+ *   moves along the upstream series with the parcels, and downstream
+ *   values are taken at the exit times. Parcels are dropped if any of
+ *   their values are not finite, their travel time is not positive, or
+ *   their entry time is outside the upstream series.
+ */
+class MetabParcels {
+   public:
+      // Attributes
+
+      //! Number of valid parcels
+      int numParcels_ = 0;
+      //! Index in the downstream series of each parcel
+      std::vector<int> downstreamIndex_;
+      //! Time each parcel passes the upstream end (days)
+      std::vector<double> upstreamTime_;
+      //! Time each parcel passes the downstream end (days)
+      std::vector<double> downstreamTime_;
+      //! Temperature of each parcel passing the upstream end
+      std::vector<double> upstreamTemp_;
+      //! Temperature of each parcel passing the downstream end
+      std::vector<double> downstreamTemp_;
+      //! PAR on each parcel passing the upstream end
+      std::vector<double> upstreamPAR_;
+      //! PAR on each parcel passing the downstream end
+      std::vector<double> downstreamPAR_;
+      //! DO of each parcel passing the upstream end
+      std::vector<double> upstreamDO_;
+      //! Air pressure when each parcel passes the downstream end
+      std::vector<double> airPressure_;
+      //! DIC of each parcel passing the upstream end (if built with DIC)
+      std::vector<double> upstreamDIC_;
+      //! pCO2 in the air when each parcel passes the downstream end
+      std::vector<double> pCO2air_;
+      //! Alkalinity of each parcel passing the upstream end
+      std::vector<double> upstreamAlkalinity_;
+      //! Alkalinity of each parcel passing the downstream end
+      std::vector<double> downstreamAlkalinity_;
+
+      // Methods
+
+      //!  Builds the parcels
+      /*!
+       *   The DIC related values are built if the upstream series has DIC,
+       *   in which case both series must have alkalinity and the
+       *   downstream series must have pCO2 in the air.
+       *
+       *   \param upstream
+       *     Series at the upstream end, with times, temperature, PAR and DO
+       *   \param downstream
+       *     Series at the downstream end, with times, temperature, PAR and
+       *     air pressure
+       *   \param travelTimeLength
+       *     Number of travel times (one for a constant travel time, or the
+       *     length of the downstream series)
+       *   \param travelTime
+       *     Travel times of the parcels leaving at the downstream times
+       *     (days)
+       */
+      void build(
+         const MetabParcels_Series& upstream,
+         const MetabParcels_Series& downstream,
+         int travelTimeLength,
+         const double* travelTime
+      );
+
+      //!  Selects the values of a downstream series for the parcels
+      /*!
+       *   \param values
+       *     Array of values for each downstream time (may be nullptr)
+       *   \param parcelValues
+       *     Receives the value for each parcel, or is cleared if values
+       *     is nullptr
+       */
+      void select(
+         const double* values,
+         std::vector<double>& parcelValues
+      );
+
+      //!  Initializes a DO model with the parcels
+      /*!
+       *   Groundwater input is simulated if both gwAlpha and gwDO are
+       *   provided.
+       *   \sa MetabLagrangeDo::initialize()
+       *
+       *   \param gwAlpha
+       *     Array of groundwater turnover rates for each downstream time
+       *     (per day)
+       *   \param gwDO
+       *     Array of DO concentrations in inflowing groundwater for each
+       *     downstream time (micromolarity)
+       */
+      void initialize(
+         MetabLagrangeDo* model,
+         double dailyGPP,
+         double ratioDoCFix,
+         double dailyER,
+         double ratioDoCResp,
+         double k600,
+         double parTotal,
+         double stdAirPressure,
+         int timeSteps,
+         const double* gwAlpha = nullptr,
+         const double* gwDO = nullptr
+      );
+
+      //!  Initializes a DO and DIC model with the parcels
+      /*!
+       *   Groundwater input is simulated if gwAlpha, gwDO and gwDIC are
+       *   all provided.
+       *   \sa MetabLagrangeDoDic::initialize()
+       *
+       *   \param gwAlpha
+       *     Array of groundwater turnover rates for each downstream time
+       *     (per day)
+       *   \param gwDO
+       *     Array of DO concentrations in inflowing groundwater for each
+       *     downstream time (micromolarity)
+       *   \param gwDIC
+       *     Array of DIC concentrations in inflowing groundwater for each
+       *     downstream time (micromolarity)
+       */
+      void initialize(
+         MetabLagrangeDoDic* model,
+         double dailyGPP,
+         double ratioDoCFix,
+         double dailyER,
+         double ratioDoCResp,
+         double k600,
+         double parTotal,
+         double stdAirPressure,
+         int timeSteps,
+         double ratioDicCFix,
+         double ratioDicCResp,
+         const double* gwAlpha = nullptr,
+         const double* gwDO = nullptr,
+         const double* gwDIC = nullptr
+      );
+};
+
+//!  A network of reaches modeled by the parcels of Lagrangian models
+/*!
+ *   Holds the parcels of many reaches (segments) of a stream network in
+ *   one set of arrays, with the parameters of each segment, and advances
+ *   them with the one step Crank Nicolson solution of
+ *   MetabLagrangeCNOneStepDo. A segment is added after the segment
+ *   upstream of it, so the order the segments are added is a topological
+ *   order of the network. Runs are split into ranges of the parcels of
+ *   one segment, which are spread over a pool of threads.
+ *
+ *   If the segments are chained, the DO of a parcel entering a segment is
+ *   the DO predicted for the parcels leaving the upstream segment,
+ *   interpolated to its entry time. The segments are then run in levels
+ *   of their depth in the network, each level after the level upstream.
+ */
+class MetabNetwork {
+   public:
+      //!  Create a new network without segments
+      /*!
+       *   \param numThreads
+       *     Number of threads (all available processors if less than one)
+       */
+      MetabNetwork(int numThreads);
+
+      // Attributes
+
+      //! Number of threads used for runs and fits
+      int numThreads_;
+      //! Whether the DO entering a segment is predicted by the segment upstream
+      bool chained_ = false;
+      //! Number of segments
+      int numSegments_ = 0;
+      //! Number of parcels of all segments
+      int numParcels_ = 0;
+
+      //! Index of the segment upstream of each segment (-1 for none)
+      std::vector<int> upstreamSegment_;
+      //! Number of segments between each segment and the top of the network
+      std::vector<int> segmentDepth_;
+      //! Index of the first parcel of each segment, with an extra element
+      //! for the end of the last segment
+      std::vector<int> segmentStart_;
+      //! Daily gross primary production of each segment
+      std::vector<double> dailyGPP_;
+      //! Daily ecosystem respiration of each segment
+      std::vector<double> dailyER_;
+      //! Gas exchange rate at a Schmidt number of 600 of each segment
+      std::vector<double> k600_;
+      //! Ratio of DO produced to carbon fixed of each segment
+      std::vector<double> ratioDoCFix_;
+      //! Ratio of DO consumed to carbon respired of each segment
+      std::vector<double> ratioDoCResp_;
+
+      //! Travel time of each parcel (days)
+      std::vector<double> travelTimes_;
+      //! Fraction of daily GPP over the travel time of each parcel
+      std::vector<double> parDist_;
+      //! Observed DO of each parcel passing the upstream end
+      std::vector<double> upstreamDO_;
+      //! Saturated DO of each parcel passing the upstream end
+      std::vector<double> upstreamSatDo_;
+      //! Saturated DO of each parcel passing the downstream end
+      std::vector<double> downstreamSatDo_;
+      //! Temperature dependence of gas exchange (per unit k600) of each
+      //! parcel passing the upstream end
+      std::vector<double> upstreamkDoSchmidt_;
+      //! Temperature dependence of gas exchange (per unit k600) of each
+      //! parcel passing the downstream end
+      std::vector<double> downstreamkDoSchmidt_;
+      //! Time each parcel passes the downstream end (days)
+      std::vector<double> downstreamTime_;
+      //! Observed DO of each parcel passing the downstream end (NaN if
+      //! missing), used by the fits
+      std::vector<double> observedDO_;
+      //! Index of the parcel of the upstream segment that left it last
+      //! before each parcel entered its segment (-1 if the entry time is
+      //! outside the parcels of the upstream segment, in which case the
+      //! observed DO is used even if the segments are chained)
+      std::vector<int> linkParcel_;
+      //! Fraction of the time to the next parcel of the upstream segment
+      //! at the entry time of each parcel
+      std::vector<double> linkFraction_;
+      //! Whether each segment has groundwater input
+      std::vector<bool> groundwater_;
+      //! Turnover rate of water due to groundwater input for each parcel
+      //! (per day, zero for segments without groundwater input)
+      std::vector<double> gwAlpha_;
+      //! DO of the groundwater input for each parcel
+      std::vector<double> gwDO_;
+
+      //! DO entering each parcel in the last chained run
+      std::vector<double> entryDO_;
+
+      //! Predicted DO of each parcel passing the downstream end
+      std::vector<double> dox_;
+      //! Derivative of the predicted DO of each parcel with respect to
+      //! daily GPP of its segment
+      std::vector<double> sensitivityDailyGPP_;
+      //! Derivative of the predicted DO of each parcel with respect to
+      //! daily ER of its segment
+      std::vector<double> sensitivityDailyER_;
+      //! Derivative of the predicted DO of each parcel with respect to
+      //! k600 of its segment
+      std::vector<double> sensitivityk600_;
+
+      //! Segments in order of their depth
+      std::vector<int> levelSegments_;
+      //! Index in levelSegments_ of the first segment of each level, with
+      //! an extra element for the end of the last level
+      std::vector<int> levelStart_;
+      //! Segment of each range of parcels, ranges in order of their level
+      std::vector<int> rangeSegment_;
+      //! Index of the first parcel of each range
+      std::vector<int> rangeFirst_;
+      //! Index one past the last parcel of each range
+      std::vector<int> rangeLast_;
+      //! Index of the first range of each level, with an extra element
+      //! for the end of the last level
+      std::vector<int> levelRangeStart_;
+
+      // Methods
+
+      //!  Adds a segment to the network
+      /*!
+       *   The parcels are initialized in a MetabLagrangeCNOneStepDo model
+       *   to calculate the values that do not depend on the parameters.
+       *   Parameters of the new segment are zero until they are set.
+       *
+       *   \param upstreamSegment
+       *     Index of the segment upstream, which must already have been
+       *     added (-1 for a segment at the top of the network). Parcels of
+       *     the segment upstream must be in order of their exit times.
+       *   \param parcels
+       *     The parcels of the segment \sa MetabParcels::build()
+       *   \param observedDO
+       *     Array of observed DO for each element of the downstream series
+       *     used to build the parcels (may be nullptr if not observed)
+       *   \param ratioDoCFix
+       *     Ratio of DO produced to carbon fixed
+       *   \param ratioDoCResp
+       *     Ratio of DO consumed to carbon respired
+       *   \param parTotal
+       *     Total PAR for the segment \sa MetabLagrangeDo::initialize()
+       *   \param stdAirPressure
+       *     Air pressure at standard conditions
+       *   \param gwAlpha
+       *     Optional array of the turnover rate of water due to
+       *     groundwater input for each element of the downstream series
+       *     (nullptr for no groundwater input)
+       *   \param gwDO
+       *     Optional array of the DO of the groundwater input for each
+       *     element of the downstream series
+       *
+       *   \return
+       *     The index of the segment
+       */
+      int addSegment(
+         int upstreamSegment,
+         MetabParcels& parcels,
+         const double* observedDO,
+         double ratioDoCFix,
+         double ratioDoCResp,
+         double parTotal,
+         double stdAirPressure,
+         const double* gwAlpha = nullptr,
+         const double* gwDO = nullptr
+      );
+
+      //!  Runs all segments with their current parameters
+      /*!
+       *   Unchained segments are independent, so all ranges of parcels
+       *   are run in a single parallel pass. Chained segments are run one
+       *   level after another.
+       *
+       *   \param sensitivity
+       *     Whether the sensitivities to the parameters of the segment of
+       *     each parcel are calculated. Sensitivities of chained segments
+       *     do not include the effect of the parameters upstream.
+       */
+      void run(bool sensitivity = false);
+
+      //!  Runs a range of the parcels of a segment
+      /*!
+       *   Parcels are run by the lane kernel MetabLagrangeCN_run(), after
+       *   the DO entering the parcels of a chained segment is
+       *   interpolated from the DO predicted upstream \sa chained_
+       *
+       *   \param segment
+       *     Index of the segment
+       *   \param first
+       *     Index of the first parcel
+       *   \param last
+       *     Index one past the last parcel
+       *   \param sensitivity
+       *     Whether the sensitivities are calculated
+       */
+      void runParcels(int segment, int first, int last, bool sensitivity);
+
+      //!  Runs all parcels of a segment
+      /*!
+       *   \param segment
+       *     Index of the segment
+       *   \param sensitivity
+       *     Whether the sensitivities are calculated
+       */
+      void runSegment(int segment, bool sensitivity);
+
+      //!  Calculates the sum of squared errors of the predictions of a segment
+      /*!
+       *   Uses the output of the last run of the segment. Parcels without
+       *   an observed DO are ignored.
+       *
+       *   \param segment
+       *     Index of the segment
+       *   \param gradient
+       *     Optional array of three elements that receives the derivatives
+       *     of the sum with respect to daily GPP, daily ER and k600, which
+       *     requires the sensitivities from the last run
+       *
+       *   \return
+       *     The sum of squared errors
+       */
+      double calcSSE(int segment, double* gradient = nullptr);
+
+      //!  Fits the parameters of each segment to the observed DO
+      /*!
+       *   Each segment is fit by minimizing the sum of squared errors of
+       *   its own predictions, with gradients from the sensitivities.
+       *   Unchained segments are fit all at once over the pool of
+       *   threads. Chained segments are fit one level after another, with
+       *   the DO entering each segment predicted from the estimates
+       *   upstream, so observations downstream do not inform the
+       *   estimates upstream. Segments are left with their parameters set
+       *   to the estimates and their output at the estimates.
+       *
+       *   \param method
+       *     The minimization method \sa MetabOptim_Method
+       *   \param start
+       *     Array of 3 * numSegments_ starting values of daily GPP, daily
+       *     ER and k600 for each segment. Parameters that are not estimated
+       *     are fixed at these values.
+       *   \param estimate
+       *     Array of three flags indicating which parameters are estimated
+       *   \param lower
+       *     Array of three lower bounds (may be -infinity)
+       *   \param upper
+       *     Array of three upper bounds (may be infinity)
+       *   \param reltol
+       *     Relative convergence tolerance of the minimization
+       *   \param maxit
+       *     Maximum number of iterations of the minimization
+       *   \param results
+       *     Array of numSegments_ elements that receives the results of the
+       *     fit of each segment
+       */
+      void fit(
+         int method,
+         const double* start,
+         const bool* estimate,
+         const double* lower,
+         const double* upper,
+         double reltol,
+         int maxit,
+         MetabOptim_Result* results
+      );
+
+      //!  Groups the segments and ranges of parcels into levels
+      /*!
+       *   Called by addSegment() after the segment is stored.
+       */
+      void arrangeLevels();
+};
+
+//!  Evaluates a model for many sets of parameters using a pool of threads
+/*!
+ *   Each thread runs its own clone of an initialized model, so the
+ *   parameter sets can be spread over the threads without sharing any
+ *   model state. Results are written directly to the slot of each
+ *   parameter set.
+ */
+class MetabSweep {
+   public:
+      //!  Create a new sweep from an initialized model
+      /*!
+       *   \param model
+       *     The initialized model to clone for each thread
+       *   \param numThreads
+       *     Number of threads (all available processors if less than one)
+       */
+      MetabSweep(Metab* model, int numThreads);
+
+      //!  Destroy the object
+      /*!
+       *   Deletes the clones of the model
+       */
+      ~MetabSweep();
+
+      // Attributes
+
+      //! Number of threads used for the sweep
+      int numThreads_;
+      //! Clones of the model used by each thread
+      Metab** workspaces_;
+      //! Number of elements in the output of the model
+      int length_;
+
+      // Methods
+
+      //!  Sets the output written by the clones of the model
+      /*!
+       *   Clones run in predictions only mode unless the variable is
+       *   diagnostic output \sa Metab::predictionsOnly_
+       *
+       *   \param variable
+       *     Name of the output variable used by the sweep
+       */
+      void selectOutput(const char* variable);
+
+      //!  Runs the model for each parameter set and gathers an output variable
+      /*!
+       *   \param numSets
+       *     Number of parameter sets
+       *   \param dailyGPP
+       *     Array of daily gross primary production for each set
+       *   \param dailyER
+       *     Array of daily ecosystem respiration for each set
+       *   \param k600
+       *     Array of gas exchange rates at a Schmidt number of 600 for each set
+       *   \param variable
+       *     Name of the output variable to gather \sa Metab::getOutputVariable()
+       *   \param output
+       *     Array of length_ * numSets elements that receives the output
+       *     variable, one time series after another (NaN if the model has
+       *     no output variable with the name provided)
+       */
+      void run(
+         int numSets,
+         const double* dailyGPP,
+         const double* dailyER,
+         const double* k600,
+         const char* variable,
+         double* output
+      );
+
+      //!  Runs the model for each parameter set and gathers sums of squared errors
+      /*!
+       *   \param numSets
+       *     Number of parameter sets
+       *   \param dailyGPP
+       *     Array of daily gross primary production for each set
+       *   \param dailyER
+       *     Array of daily ecosystem respiration for each set
+       *   \param k600
+       *     Array of gas exchange rates at a Schmidt number of 600 for each set
+       *   \param variable
+       *     Name of the output variable to compare with the observations
+       *   \param obs
+       *     Array of length_ observations of the variable (NaN values are ignored)
+       *   \param sse
+       *     Array of numSets elements that receives the sum of squared errors
+       *     for each parameter set
+       */
+      void runSSE(
+         int numSets,
+         const double* dailyGPP,
+         const double* dailyER,
+         const double* k600,
+         const char* variable,
+         const double* obs,
+         double* sse
+      );
+};
+
+//!  Fits the parameters of many models concurrently using a pool of threads
+/*!
+ *   Each model (e.g. the model of one analysis window of a long time
+ *   series) is fit by Metab::optimize() with the objective function
+ *   attached to it. Windows are either fit independently, or pipelined:
+ *   each window is first fit speculatively from its own starting values,
+ *   then re-polished from the estimates of the previous window once those
+ *   are final, keeping the better of the two fits.
+ */
+class MetabWindowScheduler {
+   public:
+      //!  Create a new scheduler
+      /*!
+       *   \param numThreads
+       *     Number of threads (all available processors if less than one)
+       */
+      MetabWindowScheduler(int numThreads);
+
+      // Attributes
+
+      //! Number of threads used for the fits
+      int numThreads_;
+      //! Whether each window is re-polished from the estimates of the previous window
+      bool pipelined_ = false;
+      //! The minimization method \sa MetabOptim_Method
+      int method_ = optimNelderMead;
+      //! Relative convergence tolerance of the minimization
+      double reltol_ = 1.490116e-08;
+      //! Maximum number of iterations of the minimization
+      int maxit_ = 500;
+
+      // Methods
+
+      //!  Fits the parameters of each model
+      /*!
+       *   Models are only accessed by the thread that fits them, so
+       *   they must be independent objects. Their scan and parcel thread
+       *   counts are set to one during the fits and restored afterwards.
+       *
+       *   \param numWindows
+       *     Number of models
+       *   \param models
+       *     Array of initialized models with objective functions attached,
+       *     left with their parameters set to the estimates
+       *   \param start
+       *     Array of 3 * numWindows starting values of daily GPP, daily ER
+       *     and k600 for each model. Parameters that are not estimated are
+       *     fixed at these values.
+       *   \param estimate
+       *     Array of three flags indicating which parameters are estimated
+       *   \param lower
+       *     Array of three lower bounds (may be -infinity)
+       *   \param upper
+       *     Array of three upper bounds (may be infinity)
+       *   \param results
+       *     Array of numWindows elements that receives the results of the
+       *     fit of each model
+       */
+      void run(
+         int numWindows,
+         Metab** models,
+         const double* start,
+         const bool* estimate,
+         const double* lower,
+         const double* upper,
+         MetabOptim_Result* results
+      );
 };
@@ -1,6 +1,7 @@
 #include <R.h>
 #include <Rinternals.h>
 #include "metabc.h"
+#include <initializer_list>
 
 template <class T>
 void finalizerExternalPointer(SEXP externalPointer) {
@@ -11,6 +12,71 @@ void finalizerExternalPointer(SEXP externalPointer) {
 
 }
 
+//! Elements of the list of R objects protected by the pointers to a model
+enum Metab_RState {
+   //! Logical flag for models that share memory with R \sa Metab_setZeroCopy
+   stateZeroCopy = 0,
+   //! Forcing vectors borrowed by the model
+   stateInputs = 1,
+   //! Named list of output vectors that runs write into
+   stateOutputs = 2,
+   //! Named list of columns that do not change between runs
+   stateConstants = 3,
+   //! Logical flag for output vectors that have been returned to R
+   stateShared = 4,
+   stateLength = 5
+};
+
+void Metab_keepInputs(
+   SEXP externalPointer,
+   Metab* model,
+   std::initializer_list<SEXP> inputs
+);
+
+void Metab_claimOutputs(
+   SEXP externalPointer,
+   Metab* model,
+   bool preserve = false
+);
+
+void Metab_checkParamSets(
+   int numSets,
+   std::initializer_list<SEXP> params,
+   std::initializer_list<SEXP> optionalParams = {}
+);
+
+CarbonateEq::Solver Metab_asSolver(SEXP value);
+
+SEXP Metab_summaryColumn(
+   SEXP externalPointer,
+   Metab* model,
+   const char* name,
+   bool constant = false
+);
+
+void Metab_setDataFrame(SEXP list, int numRows);
+
+void MetabParcels_setSeries(
+   MetabParcels_Series& series,
+   SEXP time,
+   std::initializer_list<std::pair<const double**, SEXP>> values,
+   const char* name
+);
+
+void MetabParcels_check(
+   const MetabParcels_Series& upstream,
+   const MetabParcels_Series& downstream,
+   SEXP travelTime
+);
+
+MetabParcels* MetabParcels_build(
+   const MetabParcels_Series& upstream,
+   const MetabParcels_Series& downstream,
+   SEXP travelTime
+);
+
+SEXP MetabParcels_indices(MetabParcels* parcels, SEXP indices);
+
 template <class T, class B>
 SEXP Metab_constructor()
 {
@@ -18,8 +84,14 @@ SEXP Metab_constructor()
    B* basePointer = dynamic_cast <B*> (modelPointer);
    Metab* metabPointer = dynamic_cast <Metab*> (basePointer);
 
+   // All pointers to the model protect the same list of R objects,
+   // so any of them can be used to reach memory shared with R
+   SEXP state = PROTECT(allocVector(VECSXP, stateLength));
+   SET_VECTOR_ELT(state, stateZeroCopy, ScalarLogical(FALSE));
+   SET_VECTOR_ELT(state, stateShared, ScalarLogical(FALSE));
+
    SEXP modelExtPointer = PROTECT(
-      R_MakeExternalPtr(modelPointer, R_NilValue, R_NilValue)
+      R_MakeExternalPtr(modelPointer, R_NilValue, state)
    );
 
    R_RegisterCFinalizer(
@@ -28,10 +100,10 @@ SEXP Metab_constructor()
    );
 
    SEXP baseExtPointer = PROTECT(
-      R_MakeExternalPtr(basePointer, R_NilValue, R_NilValue)
+      R_MakeExternalPtr(basePointer, R_NilValue, state)
    );
    SEXP metabExtPointer = PROTECT(
-      R_MakeExternalPtr(metabPointer, R_NilValue, R_NilValue)
+      R_MakeExternalPtr(metabPointer, R_NilValue, state)
    );
 
    SEXP vecOutput = PROTECT(allocVector(VECSXP, 3));
@@ -46,17 +118,17 @@ SEXP Metab_constructor()
 
    setAttrib(vecOutput, install("names"), vecOutput_names);
 
-   UNPROTECT(5);
+   UNPROTECT(6);
    return vecOutput;
 }
 
-SEXP MetabDo_getSummary(MetabDo*);
+SEXP MetabDo_getSummary(SEXP, MetabDo*);
 
-SEXP MetabDoDic_getSummary(MetabDoDic*);
+SEXP MetabDoDic_getSummary(SEXP, MetabDoDic*);
 
-SEXP MetabLagrangeDo_getSummary(MetabLagrangeDo*);
+SEXP MetabLagrangeDo_getSummary(SEXP, MetabLagrangeDo*);
 
-SEXP MetabLagrangeDoDic_getSummary(MetabLagrangeDoDic*);
+SEXP MetabLagrangeDoDic_getSummary(SEXP, MetabLagrangeDoDic*);
 
 extern "C"
 {
@@ -68,6 +140,44 @@ extern "C"
 
    SEXP Metab_setk600(SEXP metabExternalPointer, SEXP value);
 
+   SEXP Metab_setCalcSensitivity(SEXP metabExternalPointer, SEXP value);
+
+   SEXP Metab_setZeroCopy(SEXP metabExternalPointer, SEXP value);
+
+   SEXP Metab_setPredictionsOnly(SEXP metabExternalPointer, SEXP value);
+
+   SEXP Metab_setScanThreads(SEXP metabExternalPointer, SEXP value);
+
+   SEXP Metab_setParcelThreads(SEXP metabExternalPointer, SEXP value);
+
+   SEXP Metab_getOutput(SEXP metabExternalPointer, SEXP names);
+
+   SEXP Metab_getDoSensitivity(SEXP metabExternalPointer);
+
+   SEXP Metab_getDoSSEGradient(SEXP metabExternalPointer, SEXP obsDO);
+
+   SEXP Metab_setObjective(
+      SEXP metabExternalPointer,
+      SEXP type,
+      SEXP names,
+      SEXP obs,
+      SEXP sigma,
+      SEXP weights
+   );
+
+   SEXP Metab_runObjective(SEXP metabExternalPointer, SEXP components);
+
+   SEXP Metab_optimize(
+      SEXP metabExternalPointer,
+      SEXP method,
+      SEXP start,
+      SEXP estimate,
+      SEXP lower,
+      SEXP upper,
+      SEXP reltol,
+      SEXP maxit
+   );
+
    SEXP MetabDo_initialize(
       SEXP baseExtPointer,
       SEXP dailyGPP,
@@ -97,6 +207,21 @@ extern "C"
 
    SEXP MetabDo_getDt(SEXP externalPointer);
 
+   SEXP MetabDo_runSuperposition(SEXP baseExternalPointer);
+
+   SEXP MetabDo_setSuperpositionObs(SEXP baseExternalPointer, SEXP obsDO);
+
+   SEXP MetabDo_getSuperpositionSSE(SEXP baseExternalPointer);
+
+   SEXP MetabDo_runBatch(
+      SEXP baseExternalPointer,
+      SEXP dailyGPP,
+      SEXP dailyER,
+      SEXP k600,
+      SEXP ratioDoCFix,
+      SEXP ratioDoCResp
+   );
+
    SEXP MetabForwardEulerDo_constructor();
 
    SEXP MetabForwardEulerDo_destructor(SEXP externalPointer);
@@ -105,6 +230,10 @@ extern "C"
 
    SEXP MetabCrankNicolsonDo_destructor(SEXP);
 
+   SEXP MetabExponentialDo_constructor();
+
+   SEXP MetabExponentialDo_destructor(SEXP externalPointer);
+
    SEXP MetabLagrangeDo_initialize(
       SEXP baseExtPointer,
       SEXP dailyGPP,
@@ -138,9 +267,18 @@ extern "C"
 
    SEXP MetabLagrangeCNOneStepDo_destructor(SEXP externalPointer);
 
-   SEXP MetabLagrangeGenericDo_constructor_CN();
+   SEXP MetabLagrangeCNOneStepDo_setScalarParcels(
+      SEXP metabExternalPointer,
+      SEXP value
+   );
 
-   SEXP MetabLagrangeGenericDo_destructor_CN(SEXP externalPointer);
+   SEXP MetabLagrangeGenericCNDo_constructor();
+
+   SEXP MetabLagrangeGenericCNDo_destructor(SEXP externalPointer);
+
+   SEXP MetabLagrangeGenericExponentialDo_constructor();
+
+   SEXP MetabLagrangeGenericExponentialDo_destructor(SEXP externalPointer);
 
    SEXP MetabDoDic_initialize(
       SEXP baseExtPointer,
@@ -175,6 +313,23 @@ extern "C"
 
    SEXP MetabDoDic_setRatioDicCResp(SEXP baseExternalPointer, SEXP value);
 
+   SEXP MetabDoDic_setpHWarmStart(SEXP baseExternalPointer, SEXP value);
+
+   SEXP MetabDoDic_setpHSolver(SEXP baseExternalPointer, SEXP value);
+
+   SEXP MetabDoDic_setDicSolver(SEXP baseExternalPointer, SEXP value);
+
+   SEXP MetabDoDic_runBatch(
+      SEXP baseExternalPointer,
+      SEXP dailyGPP,
+      SEXP dailyER,
+      SEXP k600,
+      SEXP ratioDoCFix,
+      SEXP ratioDoCResp,
+      SEXP ratioDicCFix,
+      SEXP ratioDicCResp
+   );
+
    SEXP MetabDoDic_getSummary(SEXP);
 
    SEXP MetabForwardEulerDoDic_constructor();
@@ -185,6 +340,10 @@ extern "C"
 
    SEXP MetabCrankNicolsonDoDic_destructor(SEXP externalPointer);
 
+   SEXP MetabExponentialDoDic_constructor();
+
+   SEXP MetabExponentialDoDic_destructor(SEXP externalPointer);
+
    SEXP MetabLagrangeDoDic_initialize(
       SEXP baseExtPointer,
       SEXP dailyGPP,
@@ -223,9 +382,147 @@ extern "C"
 
    SEXP MetabLagrangeDoDic_setRatioDicCResp(SEXP baseExternalPointer, SEXP value);
 
+   SEXP MetabLagrangeDoDic_setpHWarmStart(SEXP baseExternalPointer, SEXP value);
+
+   SEXP MetabLagrangeDoDic_setpHSolver(SEXP baseExternalPointer, SEXP value);
+
+   SEXP MetabLagrangeDoDic_setDicSolver(SEXP baseExternalPointer, SEXP value);
+
    SEXP MetabLagrangeDoDic_getSummary(SEXP);
 
    SEXP MetabLagrangeCNOneStepDoDic_constructor();
 
    SEXP MetabLagrangeCNOneStepDoDic_destructor(SEXP externalPointer);
+
+   SEXP MetabParcels_initializeLagrangeDo(
+      SEXP baseExtPointer,
+      SEXP dailyGPP,
+      SEXP ratioDoCFix,
+      SEXP dailyER,
+      SEXP ratioDoCResp,
+      SEXP k600,
+      SEXP upstreamTime,
+      SEXP upstreamDO,
+      SEXP upstreamTemp,
+      SEXP upstreamPAR,
+      SEXP downstreamTime,
+      SEXP downstreamTemp,
+      SEXP downstreamPAR,
+      SEXP airPressure,
+      SEXP travelTime,
+      SEXP parTotal,
+      SEXP stdAirPressure,
+      SEXP timesteps,
+      SEXP gwAlpha,
+      SEXP gwDO
+   );
+
+   SEXP MetabParcels_initializeLagrangeDoDic(
+      SEXP baseExtPointer,
+      SEXP dailyGPP,
+      SEXP ratioDoCFix,
+      SEXP dailyER,
+      SEXP ratioDoCResp,
+      SEXP k600,
+      SEXP upstreamTime,
+      SEXP upstreamDO,
+      SEXP upstreamTemp,
+      SEXP upstreamPAR,
+      SEXP upstreamDIC,
+      SEXP upstreamAlkalinity,
+      SEXP downstreamTime,
+      SEXP downstreamTemp,
+      SEXP downstreamPAR,
+      SEXP airPressure,
+      SEXP pCO2air,
+      SEXP downstreamAlkalinity,
+      SEXP travelTime,
+      SEXP parTotal,
+      SEXP stdAirPressure,
+      SEXP timesteps,
+      SEXP ratioDicCFix,
+      SEXP ratioDicCResp,
+      SEXP gwAlpha,
+      SEXP gwDO,
+      SEXP gwDIC
+   );
+
+   SEXP MetabNetwork_constructor(SEXP numThreads);
+
+   SEXP MetabNetwork_destructor(SEXP networkExternalPointer);
+
+   SEXP MetabNetwork_addSegment(
+      SEXP networkExternalPointer,
+      SEXP upstreamSegment,
+      SEXP upstreamTime,
+      SEXP upstreamDO,
+      SEXP upstreamTemp,
+      SEXP upstreamPAR,
+      SEXP downstreamTime,
+      SEXP downstreamDO,
+      SEXP downstreamTemp,
+      SEXP downstreamPAR,
+      SEXP airPressure,
+      SEXP travelTime,
+      SEXP ratioDoCFix,
+      SEXP ratioDoCResp,
+      SEXP parTotal,
+      SEXP stdAirPressure,
+      SEXP gwAlpha,
+      SEXP gwDO
+   );
+
+   SEXP MetabNetwork_run(
+      SEXP networkExternalPointer,
+      SEXP dailyGPP,
+      SEXP dailyER,
+      SEXP k600,
+      SEXP chained
+   );
+
+   SEXP MetabNetwork_fit(
+      SEXP networkExternalPointer,
+      SEXP start,
+      SEXP estimate,
+      SEXP lower,
+      SEXP upper,
+      SEXP method,
+      SEXP reltol,
+      SEXP maxit,
+      SEXP chained
+   );
+
+   SEXP MetabSweep_constructor(SEXP metabExternalPointer, SEXP numThreads);
+
+   SEXP MetabSweep_destructor(SEXP sweepExternalPointer);
+
+   SEXP MetabSweep_run(
+      SEXP sweepExternalPointer,
+      SEXP dailyGPP,
+      SEXP dailyER,
+      SEXP k600,
+      SEXP variable
+   );
+
+   SEXP MetabSweep_runSSE(
+      SEXP sweepExternalPointer,
+      SEXP dailyGPP,
+      SEXP dailyER,
+      SEXP k600,
+      SEXP variable,
+      SEXP obs
+   );
+
+   SEXP MetabWindowScheduler_run(
+      SEXP metabExternalPointers,
+      SEXP start,
+      SEXP estimate,
+      SEXP lower,
+      SEXP upper,
+      SEXP method,
+      SEXP reltol,
+      SEXP maxit,
+      SEXP pipelined,
+      SEXP numThreads
+   );
 }
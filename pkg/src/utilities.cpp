@@ -1,7 +1,271 @@
+#include <algorithm>
 #include <cfloat> /* DBL_EPSILON */
 #include <cmath>
+#include <cstdint>
 #include "utilities.h"
 
+// Arrays are padded to whole cache lines of doubles
+static const long arenaAlignment = 8;
+
+static long arenaPaddedLength(int length)
+{
+   return (length + arenaAlignment - 1) / arenaAlignment * arenaAlignment;
+}
+
+Arena::~Arena()
+{
+   delete[] block_;
+   for(size_t i = 0; i < overflow_.size(); i++) {
+      delete[] overflow_[i];
+   }
+}
+
+void Arena::reset(int numArrays, int length)
+{
+   long required = numArrays * arenaPaddedLength(length);
+
+   // Make room for any arrays that overflowed the block last time, since
+   // used_ counts all of the arrays allocated then
+   for(size_t i = 0; i < overflow_.size(); i++) {
+      delete[] overflow_[i];
+   }
+   if (!overflow_.empty()) {
+      required = std::max(required, used_);
+      overflow_.clear();
+   }
+
+   if (required > capacity_) {
+      delete[] block_;
+      block_ = new double[required + arenaAlignment];
+      start_ = (double*)(
+         ((uintptr_t)block_ + arenaAlignment * sizeof(double) - 1) &
+         ~(uintptr_t)(arenaAlignment * sizeof(double) - 1)
+      );
+      capacity_ = required;
+   }
+   used_ = 0;
+}
+
+double* Arena::allocate(int length)
+{
+   long padded = arenaPaddedLength(length);
+   if (used_ + padded > capacity_) {
+      double* array = new double[padded];
+      overflow_.push_back(array);
+      used_ += padded;
+      return array;
+   }
+   double* array = start_ + used_;
+   used_ += padded;
+   return array;
+}
+
+ThreadPool& ThreadPool::instance()
+{
+   static ThreadPool pool;
+   return pool;
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+   }
+   jobQueued_.notify_all();
+   for(auto& worker : workers_) {
+      worker.join();
+   }
+}
+
+void ThreadPool::run(int numThreads, const std::function<void(int)>& work)
+{
+   Job job;
+   job.work = &work;
+   job.nextThread = 1;
+   job.numThreads = numThreads;
+   job.active = 0;
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while (int(workers_.size()) < numThreads - 1) {
+         workers_.emplace_back(&ThreadPool::workerLoop, this);
+      }
+      queue_.push_back(&job);
+   }
+   if (numThreads > 2) {
+      jobQueued_.notify_all();
+   } else {
+      jobQueued_.notify_one();
+   }
+
+   work(0);
+
+   // The work is claimed once the calling thread runs out of it, so
+   // threads that no worker has joined are withdrawn rather than waited
+   // for, and only the workers still finishing their part are awaited
+   std::unique_lock<std::mutex> lock(mutex_);
+   if (job.nextThread < job.numThreads) {
+      for(auto queued = queue_.begin(); queued != queue_.end(); ++queued) {
+         if (*queued == &job) {
+            queue_.erase(queued);
+            break;
+         }
+      }
+   }
+   workerDone_.wait(lock, [&job]() { return job.active == 0; });
+}
+
+void ThreadPool::workerLoop()
+{
+   std::unique_lock<std::mutex> lock(mutex_);
+   while (true) {
+      jobQueued_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      if (stop_) {
+         return;
+      }
+
+      Job* job = queue_.front();
+      int thread = job->nextThread++;
+      if (job->nextThread == job->numThreads) {
+         queue_.pop_front();
+      }
+      job->active++;
+
+      lock.unlock();
+      (*job->work)(thread);
+      lock.lock();
+
+      job->active--;
+      if (job->active == 0) {
+         workerDone_.notify_all();
+      }
+   }
+}
+
+int parallelThreads(int numThreads, int count)
+{
+   if (numThreads < 1) {
+      numThreads = std::thread::hardware_concurrency();
+   }
+   if (numThreads > count) {
+      numThreads = count;
+   }
+   return numThreads < 1 ? 1 : numThreads;
+}
+
+void linearScan
+(
+   int numThreads,
+   int length,
+   const double* retention,
+   double* x
+)
+{
+   int numSteps = length - 1;
+   if (numThreads < 1) {
+      numThreads = std::thread::hardware_concurrency();
+   }
+   if (numThreads > numSteps / scanBlockSteps) {
+      numThreads = numSteps / scanBlockSteps;
+   }
+   if (numThreads < 1) {
+      numThreads = 1;
+   }
+   int numRuns = numThreads * batchLanes;
+   if (numSteps < numRuns) {
+      for(int i = 0; i < numSteps; i++) {
+         x[i + 1] += retention[i] * x[i];
+      }
+      return;
+   }
+
+   // Run r covers the steps from runStart[r] up to runStart[r + 1],
+   // with the lengths of the runs differing by at most one step
+   std::vector<int> runStart(numRuns + 1);
+   for(int run = 0; run <= numRuns; run++) {
+      runStart[run] = (int)((long)run * numSteps / numRuns);
+   }
+   int minSteps = numSteps / numRuns;
+
+   // Combined retention and input of each run, so that the value at the
+   // end of a run is runRetention * (value at its start) + runInput
+   std::vector<double> runRetention(numRuns);
+   std::vector<double> runInput(numRuns);
+   parallelFor(
+      numThreads,
+      numThreads,
+      [&](int, int block) {
+         const int* start = &runStart[block * batchLanes];
+         double a[batchLanes];
+         double b[batchLanes];
+         for(int lane = 0; lane < batchLanes; lane++) {
+            a[lane] = 1;
+            b[lane] = 0;
+         }
+         // Products of many retentions get stuck at the smallest
+         // subnormal number, where arithmetic is very slow, so products
+         // that are negligible are flushed to zero between chunks
+         for(int chunk = 0; chunk < minSteps; chunk += 64) {
+            int end = chunk + 64 < minSteps ? chunk + 64 : minSteps;
+            for(int j = chunk; j < end; j++) {
+               for(int lane = 0; lane < batchLanes; lane++) {
+                  int i = start[lane] + j;
+                  b[lane] = retention[i] * b[lane] + x[i + 1];
+                  a[lane] *= retention[i];
+               }
+            }
+            for(int lane = 0; lane < batchLanes; lane++) {
+               if (fabs(a[lane]) < 1e-200) {
+                  a[lane] = 0;
+               }
+            }
+         }
+         for(int lane = 0; lane < batchLanes; lane++) {
+            for(int i = start[lane] + minSteps; i < start[lane + 1]; i++) {
+               b[lane] = retention[i] * b[lane] + x[i + 1];
+               a[lane] *= retention[i];
+            }
+            runRetention[block * batchLanes + lane] = a[lane];
+            runInput[block * batchLanes + lane] = b[lane];
+         }
+      }
+   );
+
+   // Chain the runs to get the value at the start of each run
+   std::vector<double> runValue(numRuns);
+   runValue[0] = x[0];
+   for(int run = 1; run < numRuns; run++) {
+      runValue[run] =
+         runRetention[run - 1] * runValue[run - 1] + runInput[run - 1];
+   }
+
+   // Resolve the runs, each lane reading only the inputs of its own run
+   parallelFor(
+      numThreads,
+      numThreads,
+      [&](int, int block) {
+         const int* start = &runStart[block * batchLanes];
+         double v[batchLanes];
+         for(int lane = 0; lane < batchLanes; lane++) {
+            v[lane] = runValue[block * batchLanes + lane];
+         }
+         for(int j = 0; j < minSteps; j++) {
+            for(int lane = 0; lane < batchLanes; lane++) {
+               int i = start[lane] + j;
+               v[lane] = retention[i] * v[lane] + x[i + 1];
+               x[i + 1] = v[lane];
+            }
+         }
+         for(int lane = 0; lane < batchLanes; lane++) {
+            for(int i = start[lane] + minSteps; i < start[lane + 1]; i++) {
+               v[lane] = retention[i] * v[lane] + x[i + 1];
+               x[i + 1] = v[lane];
+            }
+         }
+      }
+   );
+}
+
 ParDistCalculator::ParDistCalculator(double parTotal)
 {
    initialize(parTotal);
@@ -72,6 +336,121 @@ double kSchmidtCO2Calc(double tempC, double k600)
    return k600 * pow((schmidt / 600), -0.5);
 }
 
+// Horner forms of the polynomials of the scalar calculators, inlined
+// into the array kernels in place of calls to pow()
+
+static inline double densityWaterPoly(double tempC)
+{
+   return
+      0.999842 + tempC * (6.7940e-5 + tempC * (-9.0953e-6 + tempC * (
+         1.0017e-7 + tempC * (-1.1201e-9 + tempC * 6.5363e-12)
+      )));
+}
+
+static const double sqrt600 = sqrt(600.0);
+
+void densityWaterCalcArray
+(
+   int length,
+   const double* tempC,
+   double* densityWater
+)
+{
+   for(int i = 0; i < length; i++) {
+      densityWater[i] = densityWaterPoly(tempC[i]);
+   }
+}
+
+void satDoCalcArray
+(
+   int length,
+   const double* tempC,
+   const double* airPressure,
+   double stdAirPressure,
+   double* satDo
+)
+{
+   for(int i = 0; i < length; i++) {
+      double normTemp = log(
+         (298.15 - tempC[i]) /
+         (273.15 + tempC[i])
+      );
+      satDo[i] =
+         airPressure[i] / stdAirPressure *
+         densityWaterPoly(tempC[i]) *
+         exp(
+            5.80871 + normTemp * (3.20291 + normTemp * (4.17887 + normTemp * (
+               5.10006 + normTemp * (-0.0986643 + normTemp * 3.80369)
+            )))
+         );
+   }
+}
+
+void kSchmidtDoCalcArray
+(
+   int length,
+   const double* tempC,
+   double k600,
+   double* kSchmidt
+)
+{
+   double scale = k600 * sqrt600;
+   for(int i = 0; i < length; i++) {
+      double schmidt =
+         1800.6 + tempC[i] * (-120.1 + tempC[i] * (
+            3.7818 + tempC[i] * -0.047608
+         ));
+      kSchmidt[i] = scale / sqrt(schmidt);
+   }
+}
+
+void kSchmidtCO2CalcArray
+(
+   int length,
+   const double* tempC,
+   double k600,
+   double* kSchmidt
+)
+{
+   double scale = k600 * sqrt600;
+   for(int i = 0; i < length; i++) {
+      double schmidt =
+         1742 + tempC[i] * (-91.24 + tempC[i] * (
+            2.208 + tempC[i] * -0.0219
+         ));
+      kSchmidt[i] = scale / sqrt(schmidt);
+   }
+}
+
+void phiCalc(double x, double phi[])
+{
+   if (fabs(x) < 0.1) {
+      // Truncation errors of the series are below 3e-18 for |x| < 0.1
+      phi[0] =
+         1 + x * (-1.0 / 2 + x * (1.0 / 6 + x * (-1.0 / 24 + x * (
+            1.0 / 120 + x * (-1.0 / 720 + x * (1.0 / 5040 + x * (-1.0 / 40320 + x * (
+               1.0 / 362880 + x * (-1.0 / 3628800)
+            ))))
+         ))));
+      phi[1] =
+         1.0 / 2 + x * (-1.0 / 6 + x * (1.0 / 24 + x * (-1.0 / 120 + x * (
+            1.0 / 720 + x * (-1.0 / 5040 + x * (1.0 / 40320 + x * (-1.0 / 362880 + x * (
+               1.0 / 3628800 + x * (-1.0 / 39916800)
+            ))))
+         ))));
+      phi[2] =
+         1.0 / 6 + x * (-1.0 / 24 + x * (1.0 / 120 + x * (-1.0 / 720 + x * (
+            1.0 / 5040 + x * (-1.0 / 40320 + x * (1.0 / 362880 + x * (-1.0 / 3628800 + x * (
+               1.0 / 39916800 + x * (-1.0 / 479001600)
+            ))))
+         ))));
+   } else {
+      phi[0] = -expm1(-x) / x;
+      phi[1] = (1 - phi[0]) / x;
+      phi[2] = (0.5 - phi[1]) / x;
+   }
+}
+
 // An approximation of x is returned where an abstract function f(x) attains a minimum on
 // the interval (ax,bx).
 //
@@ -222,3 +601,326 @@ double Brent_fmin
 
    return x;
 } // Brent_fmin()
+
+//! Projects a point onto the bounds of the variables
+static void projectBounds
+(
+   int n,
+   double* x,
+   const double* lower,
+   const double* upper
+)
+{
+   for(int i = 0; i < n; i++) {
+      if (x[i] < lower[i]) x[i] = lower[i];
+      if (x[i] > upper[i]) x[i] = upper[i];
+   }
+}
+
+//! Evaluates a function for a minimizer, treating NaN as infinity
+static double evalOptimFunction
+(
+   double (*f)(const double*, double*, void*),
+   const double* x,
+   double* gradient,
+   void* info
+)
+{
+   double value = (*f)(x, gradient, info);
+   return std::isnan(value) ? INFINITY : value;
+}
+
+double NelderMead_fmin
+(
+   int n,
+   double* x,
+   const double* lower,
+   const double* upper,
+   double (*f)(const double*, double*, void*),
+   void* info,
+   double reltol,
+   int maxit,
+   int* convergence
+)
+{
+   int numPoints = n + 1;
+   std::vector<double> points(numPoints * n);
+   std::vector<double> values(numPoints);
+   std::vector<double> centroid(n);
+   std::vector<double> reflected(n);
+   std::vector<double> trial(n);
+
+   // Initial simplex steps 10 percent away from the start in each variable
+   projectBounds(n, x, lower, upper);
+   for(int p = 0; p < numPoints; p++) {
+      double* point = &points[p * n];
+      for(int i = 0; i < n; i++) {
+         point[i] = x[i];
+      }
+      if (p > 0) {
+         int i = p - 1;
+         double step = 0.1 * fabs(x[i]);
+         if (step == 0) step = 0.1;
+         if (x[i] + step > upper[i]) step = -step;
+         point[i] += step;
+         projectBounds(n, point, lower, upper);
+      }
+      values[p] = evalOptimFunction(f, point, nullptr, info);
+   }
+   int evaluations = numPoints;
+
+   double convtol = std::isfinite(values[0]) ?
+      reltol * (fabs(values[0]) + reltol) : reltol;
+   *convergence = optimMaxIterations;
+
+   int best = 0;
+   for(;;) {
+      // Find the best, worst and second worst points
+      best = 0;
+      int worst = 0;
+      for(int p = 1; p < numPoints; p++) {
+         if (values[p] < values[best]) best = p;
+         if (values[p] > values[worst]) worst = p;
+      }
+      int nextWorst = best;
+      for(int p = 0; p < numPoints; p++) {
+         if (p != worst && values[p] > values[nextWorst]) nextWorst = p;
+      }
+
+      if (values[worst] <= values[best] + convtol) {
+         *convergence = optimConverged;
+         break;
+      }
+      if (evaluations >= maxit) {
+         break;
+      }
+
+      double* worstPoint = &points[worst * n];
+      for(int i = 0; i < n; i++) {
+         centroid[i] = 0;
+         for(int p = 0; p < numPoints; p++) {
+            if (p != worst) centroid[i] += points[p * n + i];
+         }
+         centroid[i] /= n;
+      }
+
+      // Reflection
+      for(int i = 0; i < n; i++) {
+         reflected[i] = 2 * centroid[i] - worstPoint[i];
+      }
+      projectBounds(n, reflected.data(), lower, upper);
+      double reflectedValue =
+         evalOptimFunction(f, reflected.data(), nullptr, info);
+      evaluations++;
+
+      if (reflectedValue < values[best]) {
+         // Expansion
+         for(int i = 0; i < n; i++) {
+            trial[i] = 3 * centroid[i] - 2 * worstPoint[i];
+         }
+         projectBounds(n, trial.data(), lower, upper);
+         double trialValue = evalOptimFunction(f, trial.data(), nullptr, info);
+         evaluations++;
+         if (trialValue < reflectedValue) {
+            std::copy(trial.begin(), trial.end(), worstPoint);
+            values[worst] = trialValue;
+         } else {
+            std::copy(reflected.begin(), reflected.end(), worstPoint);
+            values[worst] = reflectedValue;
+         }
+      } else if (reflectedValue < values[nextWorst]) {
+         std::copy(reflected.begin(), reflected.end(), worstPoint);
+         values[worst] = reflectedValue;
+      } else {
+         // Contraction on the outside or inside of the simplex
+         bool outside = reflectedValue < values[worst];
+         for(int i = 0; i < n; i++) {
+            trial[i] = 0.5 * (centroid[i] +
+               (outside ? reflected[i] : worstPoint[i]));
+         }
+         double trialValue = evalOptimFunction(f, trial.data(), nullptr, info);
+         evaluations++;
+         if (trialValue < fmin(reflectedValue, values[worst])) {
+            std::copy(trial.begin(), trial.end(), worstPoint);
+            values[worst] = trialValue;
+         } else {
+            // Shrink toward the best point
+            double* bestPoint = &points[best * n];
+            for(int p = 0; p < numPoints; p++) {
+               if (p == best) continue;
+               double* point = &points[p * n];
+               for(int i = 0; i < n; i++) {
+                  point[i] = 0.5 * (bestPoint[i] + point[i]);
+               }
+               values[p] = evalOptimFunction(f, point, nullptr, info);
+               evaluations++;
+            }
+         }
+      }
+   }
+
+   for(int i = 0; i < n; i++) {
+      x[i] = points[best * n + i];
+   }
+   return values[best];
+}
+
+double BFGSB_fmin
+(
+   int n,
+   double* x,
+   const double* lower,
+   const double* upper,
+   double (*f)(const double*, double*, void*),
+   void* info,
+   double reltol,
+   int maxit,
+   int* convergence
+)
+{
+   const double armijo = 1e-4;
+   const double minStep = 1e-12;
+
+   std::vector<double> gradient(n);
+   std::vector<double> newGradient(n);
+   std::vector<double> newX(n);
+   std::vector<double> direction(n);
+   std::vector<double> s(n);
+   std::vector<double> y(n);
+   std::vector<double> hy(n);
+   std::vector<bool> isFree(n);
+   // Approximation of the inverse Hessian, reset to the identity
+   // when it fails to give a descent direction
+   std::vector<double> invHessian(n * n);
+   bool reset = true;
+   auto resetHessian = [&]() {
+      for(int i = 0; i < n * n; i++) {
+         invHessian[i] = (i % (n + 1) == 0) ? 1 : 0;
+      }
+      reset = true;
+   };
+   resetHessian();
+
+   projectBounds(n, x, lower, upper);
+   double value = evalOptimFunction(f, x, gradient.data(), info);
+   *convergence = optimMaxIterations;
+
+   for(int iter = 0; iter < maxit; iter++) {
+      // Variables at a bound with the gradient pointing outward stay fixed
+      for(int i = 0; i < n; i++) {
+         isFree[i] = !(
+            (x[i] <= lower[i] && gradient[i] > 0) ||
+            (x[i] >= upper[i] && gradient[i] < 0)
+         );
+      }
+
+      double slope = 0;
+      for(int i = 0; i < n; i++) {
+         direction[i] = 0;
+         if (!isFree[i]) continue;
+         for(int j = 0; j < n; j++) {
+            if (isFree[j]) direction[i] -= invHessian[i * n + j] * gradient[j];
+         }
+         slope += direction[i] * gradient[i];
+      }
+      if (slope >= 0 && !reset) {
+         resetHessian();
+         slope = 0;
+         for(int i = 0; i < n; i++) {
+            direction[i] = isFree[i] ? -gradient[i] : 0;
+            slope += direction[i] * gradient[i];
+         }
+      }
+      if (slope >= 0) {
+         // The projected gradient is zero
+         *convergence = optimConverged;
+         break;
+      }
+
+      // Backtracking line search along the projected path. The full
+      // step, which is usually accepted, is evaluated with its gradient
+      // so the accepted point does not have to be evaluated again.
+      double step = 1;
+      double newValue = INFINITY;
+      bool accepted = false;
+      bool fullStep = true;
+      while (step > minStep) {
+         double decrease = 0;
+         for(int i = 0; i < n; i++) {
+            newX[i] = x[i] + step * direction[i];
+         }
+         projectBounds(n, newX.data(), lower, upper);
+         for(int i = 0; i < n; i++) {
+            decrease += gradient[i] * (newX[i] - x[i]);
+         }
+         newValue = evalOptimFunction(
+            f,
+            newX.data(),
+            fullStep ? newGradient.data() : nullptr,
+            info
+         );
+         if (newValue <= value + armijo * decrease) {
+            accepted = true;
+            break;
+         }
+         step *= 0.2;
+         fullStep = false;
+      }
+      if (!accepted) {
+         if (reset) {
+            *convergence = optimLineSearchFailed;
+            break;
+         }
+         resetHessian();
+         continue;
+      }
+
+      if (!fullStep) {
+         newValue = evalOptimFunction(f, newX.data(), newGradient.data(), info);
+      }
+      double sy = 0;
+      double yy = 0;
+      for(int i = 0; i < n; i++) {
+         s[i] = newX[i] - x[i];
+         y[i] = newGradient[i] - gradient[i];
+         sy += s[i] * y[i];
+         yy += y[i] * y[i];
+      }
+      bool small = fabs(value - newValue) <= reltol * (fabs(value) + reltol);
+      std::copy(newX.begin(), newX.end(), x);
+      std::copy(newGradient.begin(), newGradient.end(), gradient.begin());
+      value = newValue;
+      if (small) {
+         *convergence = optimConverged;
+         break;
+      }
+
+      // BFGS update of the inverse Hessian, scaled on the first update
+      // after a reset
+      if (sy > 0 && yy > 0) {
+         if (reset) {
+            for(int i = 0; i < n * n; i++) {
+               invHessian[i] *= sy / yy;
+            }
+            reset = false;
+         }
+         double yhy = 0;
+         for(int i = 0; i < n; i++) {
+            hy[i] = 0;
+            for(int j = 0; j < n; j++) {
+               hy[i] += invHessian[i * n + j] * y[j];
+            }
+            yhy += y[i] * hy[i];
+         }
+         for(int i = 0; i < n; i++) {
+            for(int j = 0; j < n; j++) {
+               invHessian[i * n + j] +=
+                  (sy + yhy) * s[i] * s[j] / (sy * sy) -
+                  (hy[i] * s[j] + s[i] * hy[j]) / sy;
+            }
+         }
+      }
+   }
+
+   return value;
+}
@@ -1,3 +1,243 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//!  Contiguous storage for the arrays of a model
+/*!
+ *   Arrays are carved from a single block of memory sized by reset(),
+ *   each starting on a cache line. Resetting for the same or a smaller
+ *   size reuses the block, so a model can be initialized again without
+ *   allocating or leaking memory.
+ */
+class Arena {
+   public:
+      Arena(){};
+      ~Arena();
+      Arena(const Arena&) = delete;
+      Arena& operator=(const Arena&) = delete;
+
+      //! Memory allocated for the block
+      double* block_ = nullptr;
+      //! Start of the block aligned to a cache line
+      double* start_ = nullptr;
+      //! Number of elements available from the start of the block
+      long capacity_ = 0;
+      //! Number of elements already allocated from the block
+      long used_ = 0;
+      //! Arrays allocated separately after the block was full
+      std::vector<double*> overflow_;
+
+      //!  Prepares the arena for a new set of arrays
+      /*!
+       *   Arrays allocated before the reset become invalid.
+       *
+       *   \param numArrays
+       *     Number of arrays that will be allocated
+       *   \param length
+       *     Number of elements in each array
+       */
+      void reset(int numArrays, int length);
+
+      //!  Allocates an array from the arena
+      /*!
+       *   If more arrays are allocated than were reserved by reset(),
+       *   the extra arrays are allocated separately and freed by the next
+       *   reset, which reserves room for them in the block.
+       *
+       *   \param length
+       *     Number of elements in the array
+       *
+       *   \return
+       *     Pointer to the array, valid until the next reset
+       */
+      double* allocate(int length);
+};
+
+//! Number of lanes advanced together by the batch calculation kernels
+const int batchLanes = 8;
+
+//!  Persistent pool of worker threads shared by the parallel loops
+/*!
+ *   Workers are started the first time they are needed and wait on a
+ *   queue of jobs between calls, so a parallel loop costs a wake up
+ *   rather than starting and joining threads. The pool grows to the
+ *   largest number of threads requested and its workers are joined when
+ *   the library is unloaded.
+ *
+ *   The calling thread of a job always works on it as thread zero, and
+ *   only waits for the workers that joined the job before it ran out of
+ *   work. Jobs started from within a job therefore never wait for a
+ *   worker that is busy elsewhere, so nested loops (such as the parcel
+ *   chunks of models run by a sweep) cannot deadlock the pool.
+ */
+class ThreadPool {
+   public:
+      ThreadPool(){};
+      ~ThreadPool();
+      ThreadPool(const ThreadPool&) = delete;
+      ThreadPool& operator=(const ThreadPool&) = delete;
+
+      //! A job waiting in the queue or being worked by the pool
+      struct Job {
+         //! Function called as work(thread) by each thread of the job
+         const std::function<void(int)>* work;
+         //! Index of the thread assigned to the next worker to join
+         int nextThread;
+         //! Number of threads of the job, including the calling thread
+         int numThreads;
+         //! Number of workers still working on the job
+         int active;
+      };
+
+      //! Guards the queue and the jobs in it
+      std::mutex mutex_;
+      //! Signalled when a job is queued or the pool is stopped
+      std::condition_variable jobQueued_;
+      //! Signalled when a worker leaves a job
+      std::condition_variable workerDone_;
+      //! Jobs with threads that no worker has joined yet
+      std::deque<Job*> queue_;
+      //! The worker threads
+      std::vector<std::thread> workers_;
+      //! Whether the workers should exit
+      bool stop_ = false;
+
+      //!  Gets the pool shared by all parallel loops
+      static ThreadPool& instance();
+
+      //!  Runs a function on several threads
+      /*!
+       *   \param numThreads
+       *     Number of threads, including the calling thread
+       *   \param work
+       *     Function called as work(thread) once on each thread that
+       *     joins the job, with thread from zero up to numThreads - 1.
+       *     Threads that join after the work is done return at once, so
+       *     the function should claim its work from a shared counter.
+       */
+      void run(int numThreads, const std::function<void(int)>& work);
+
+      //!  Loop of each worker thread, which joins the jobs in the queue
+      void workerLoop();
+};
+
+//!  Calls a function for each index in a range using a pool of threads
+/*!
+ *   Threads claim indices from a shared atomic counter, so faster threads
+ *   take on more of the work without any locking. The calling thread
+ *   works as thread zero, with the other threads taken from the
+ *   persistent ThreadPool.
+ *
+ *   \param numThreads
+ *     Number of threads to use (all available processors if less than one)
+ *   \param count
+ *     Number of indices, starting from zero
+ *   \param body
+ *     Function called as body(thread, index)
+ */
+template <class F>
+void parallelFor(int numThreads, int count, F body)
+{
+   if (numThreads < 1) {
+      numThreads = std::thread::hardware_concurrency();
+   }
+   if (numThreads > count) {
+      numThreads = count;
+   }
+
+   std::atomic<int> next(0);
+   auto work = [&](int thread) {
+      for(int index = next++; index < count; index = next++) {
+         body(thread, index);
+      }
+   };
+
+   if (numThreads <= 1) {
+      work(0);
+      return;
+   }
+   ThreadPool::instance().run(numThreads, work);
+}
+
+//! Number of parcels in each chunk of the parallel parcel loops
+const int parcelChunkLength = 1024;
+
+//!  Calls a function for consecutive chunks of a range using a pool of threads
+/*!
+ *   \param numThreads
+ *     Number of threads to use (all available processors if less than one)
+ *   \param count
+ *     Number of indices, starting from zero
+ *   \param chunkLength
+ *     Number of indices in each chunk (the last chunk may be shorter)
+ *   \param body
+ *     Function called as body(thread, first, last) for the indices from
+ *     first up to but not including last \sa parallelFor()
+ */
+template <class F>
+void parallelChunks(int numThreads, int count, int chunkLength, F body)
+{
+   int numChunks = (count + chunkLength - 1) / chunkLength;
+   parallelFor(
+      numThreads,
+      numChunks,
+      [&](int thread, int chunk) {
+         int first = chunk * chunkLength;
+         int last = count - first < chunkLength ? count : first + chunkLength;
+         body(thread, first, last);
+      }
+   );
+}
+
+//!  Gets the number of threads used by parallelFor()
+/*!
+ *   \param numThreads
+ *     Number of threads requested (all available processors if less than one)
+ *   \param count
+ *     Number of indices
+ *
+ *   \return
+ *     Number of threads that parallelFor() would start (at least one)
+ */
+int parallelThreads(int numThreads, int count);
+
+//! Minimum number of time steps resolved by each thread of linearScan()
+const int scanBlockSteps = 16384;
+
+//!  Resolves a first order linear recurrence with a blocked parallel scan
+/*!
+ *   Solves x[i + 1] = retention[i] * x[i] + x[i + 1] in place for each
+ *   time step i, where x[i + 1] holds the input over the step before the
+ *   call. The steps are split into a block for each thread, and each
+ *   block into batchLanes runs of consecutive steps that are advanced
+ *   together. The combined retention and input of each run are
+ *   calculated in parallel and chained from x[0] to the start of each
+ *   run, before the runs are resolved in parallel. Results differ from
+ *   the sequential recurrence only by the order of the floating point
+ *   operations.
+ *
+ *   \param numThreads
+ *     Number of threads to use (all available processors if less than
+ *     one), limited so each thread resolves at least scanBlockSteps steps
+ *   \param length
+ *     Number of elements in x (one more than the number of time steps)
+ *   \param retention
+ *     Fraction of x retained over each time step
+ *   \param x
+ *     Initial value followed by the inputs over each time step, replaced
+ *     by the values of the recurrence
+ */
+void linearScan(
+   int numThreads,
+   int length,
+   const double* retention,
+   double* x
+);
+
 
 class ParDistCalculator {
    public:
@@ -35,6 +275,112 @@ double kSchmidtDoCalc(double tempC, double k600);
 
 double kSchmidtCO2Calc(double tempC, double k600);
 
+//!  Calculates densities of water for an array of temperatures
+/*!
+ *   Equivalent to densityWaterCalc() for each element, with the
+ *   polynomial evaluated by Horner's scheme rather than with pow().
+ *
+ *   \param length
+ *     Number of elements in the arrays
+ *   \param tempC
+ *     Array of water temperatures (deg C)
+ *   \param densityWater
+ *     Array that receives the densities of water (kilograms per liter)
+ */
+void densityWaterCalcArray(
+   int length,
+   const double* tempC,
+   double* densityWater
+);
+
+//!  Calculates saturated DO concentrations for arrays of conditions
+/*!
+ *   Equivalent to densityWaterCalc() and satDoCalc() for each element,
+ *   with the polynomials evaluated by Horner's scheme rather than with
+ *   pow(). Relative differences from the scalar functions are below
+ *   1e-13 for temperatures from -5 to 35 deg C.
+ *
+ *   \param length
+ *     Number of elements in the arrays
+ *   \param tempC
+ *     Array of water temperatures (deg C)
+ *   \param airPressure
+ *     Array of air pressures (same units as std air pressure)
+ *   \param stdAirPressure
+ *     Air pressure at standard conditions
+ *   \param satDo
+ *     Array that receives the saturated DO concentrations (micromolarity)
+ */
+void satDoCalcArray(
+   int length,
+   const double* tempC,
+   const double* airPressure,
+   double stdAirPressure,
+   double* satDo
+);
+
+//!  Calculates DO gas exchange rates for an array of temperatures
+/*!
+ *   Equivalent of kSchmidtDoCalc() for each element. The Schmidt number
+ *   polynomial is evaluated by Horner's scheme, and pow(x, -0.5) is
+ *   replaced by a square root and a division, so no element calls
+ *   pow(). Relative differences from the scalar function are
+ *   below 1e-13 for temperatures from -5 to 35 deg C (the Schmidt
+ *   number of DO reaches zero near 40 deg C).
+ *
+ *   \param length
+ *     Number of elements in the arrays
+ *   \param tempC
+ *     Array of water temperatures (deg C)
+ *   \param k600
+ *     The gas exchange rate at a Schmidt number of 600 (per day)
+ *   \param kSchmidt
+ *     Array that receives the gas exchange rates for DO (per day)
+ */
+void kSchmidtDoCalcArray(
+   int length,
+   const double* tempC,
+   double k600,
+   double* kSchmidt
+);
+
+//!  Calculates CO2 gas exchange rates for an array of temperatures
+/*!
+ *   Equivalent of kSchmidtCO2Calc() for each element
+ *   \sa kSchmidtDoCalcArray()
+ *
+ *   \param length
+ *     Number of elements in the arrays
+ *   \param tempC
+ *     Array of water temperatures (deg C)
+ *   \param k600
+ *     The gas exchange rate at a Schmidt number of 600 (per day)
+ *   \param kSchmidt
+ *     Array that receives the gas exchange rates for CO2 (per day)
+ */
+void kSchmidtCO2CalcArray(
+   int length,
+   const double* tempC,
+   double k600,
+   double* kSchmidt
+);
+
+//!  Calculates the phi functions of exponential integrators
+/*!
+ *   For a linear decay at rate a over a time step dt with x = a * dt,
+ *   the change over the step is the change at the initial rate scaled
+ *   by phi1 = (1 - exp(-x)) / x. The functions follow the recurrence
+ *   phi(k + 1) = (1 / k! - phi(k)) / x, and weight inputs that vary
+ *   over the step. Series expansions are used for small x, where the
+ *   recurrence loses precision.
+ *
+ *   \param x
+ *     Product of the decay rate and the length of the time step
+ *   \param phi
+ *     Array of three elements that receives phi1, phi2 and phi3
+ */
+void phiCalc(double x, double phi[]);
+
 double Brent_fmin(
    double ax,
    double bx,
@@ -42,3 +388,97 @@ double Brent_fmin(
    void *info,
    double tol
 );
+
+//!  Convergence codes returned by the multivariate minimizers
+enum Optim_Convergence {
+   //! The relative change in the objective fell below the tolerance
+   optimConverged = 0,
+   //! The iteration (or evaluation) limit was reached
+   optimMaxIterations = 1,
+   //! The line search could not find a decrease of the objective
+   optimLineSearchFailed = 52
+};
+
+//!  Minimizes a function of several variables by the Nelder-Mead method
+/*!
+ *   Simplex points are projected onto the bounds, so the function is
+ *   never evaluated outside of them. Convergence follows optim in R:
+ *   the search stops when the range of the function values over the
+ *   simplex is less than reltol * (|f(x0)| + reltol).
+ *
+ *   \param n
+ *     Number of variables
+ *   \param x
+ *     Array of n starting values, replaced by the location of the minimum
+ *   \param lower
+ *     Array of n lower bounds (may be -infinity)
+ *   \param upper
+ *     Array of n upper bounds (may be infinity)
+ *   \param f
+ *     Function called as f(x, nullptr, info). NaN values are treated
+ *     as infinity.
+ *   \param info
+ *     Pointer passed through to f
+ *   \param reltol
+ *     Relative convergence tolerance
+ *   \param maxit
+ *     Maximum number of function evaluations
+ *   \param convergence
+ *     Receives the convergence code \sa Optim_Convergence
+ *
+ *   \return
+ *     The minimum value of the function
+ */
+double NelderMead_fmin(
+   int n,
+   double* x,
+   const double* lower,
+   const double* upper,
+   double (*f)(const double*, double*, void*),
+   void* info,
+   double reltol,
+   int maxit,
+   int* convergence
+);
+
+//!  Minimizes a function of several variables by a bounded quasi-Newton method
+/*!
+ *   BFGS updates of the inverse Hessian are combined with steps projected
+ *   onto the bounds. Variables at a bound with a gradient pointing out of
+ *   the feasible region are held fixed for the step, and a backtracking
+ *   line search along the projected path enforces sufficient decrease.
+ *
+ *   \param n
+ *     Number of variables
+ *   \param x
+ *     Array of n starting values, replaced by the location of the minimum
+ *   \param lower
+ *     Array of n lower bounds (may be -infinity)
+ *   \param upper
+ *     Array of n upper bounds (may be infinity)
+ *   \param f
+ *     Function called as f(x, gradient, info), which also fills the array
+ *     of n derivatives if gradient is not nullptr
+ *   \param info
+ *     Pointer passed through to f
+ *   \param reltol
+ *     Relative convergence tolerance on the change in the function value
+ *   \param maxit
+ *     Maximum number of iterations
+ *   \param convergence
+ *     Receives the convergence code \sa Optim_Convergence
+ *
+ *   \return
+ *     The minimum value of the function
+ */
+double BFGSB_fmin(
+   int n,
+   double* x,
+   const double* lower,
+   const double* upper,
+   double (*f)(const double*, double*, void*),
+   void* info,
+   double reltol,
+   int maxit,
+   int* convergence
+);
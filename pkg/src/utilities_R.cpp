@@ -0,0 +1,50 @@
+#include "utilities_R.h"
+
+SEXP utilities_densityWaterCalc(SEXP tempC)
+{
+   int length = LENGTH(tempC);
+   SEXP out = PROTECT(allocVector(REALSXP, length));
+   densityWaterCalcArray(length, REAL(tempC), REAL(out));
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP utilities_satDoCalc(SEXP tempC, SEXP airPressure, SEXP stdAirPressure)
+{
+   int length = LENGTH(tempC);
+   if (LENGTH(airPressure) != length) {
+      error("Air pressure must have one value for each temperature.");
+   }
+   SEXP out = PROTECT(allocVector(REALSXP, length));
+   satDoCalcArray(
+      length,
+      REAL(tempC),
+      REAL(airPressure),
+      asReal(stdAirPressure),
+      REAL(out)
+   );
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP utilities_kSchmidtDoCalc(SEXP tempC, SEXP k600)
+{
+   int length = LENGTH(tempC);
+   SEXP out = PROTECT(allocVector(REALSXP, length));
+   kSchmidtDoCalcArray(length, REAL(tempC), asReal(k600), REAL(out));
+
+   UNPROTECT(1);
+   return out;
+}
+
+SEXP utilities_kSchmidtCO2Calc(SEXP tempC, SEXP k600)
+{
+   int length = LENGTH(tempC);
+   SEXP out = PROTECT(allocVector(REALSXP, length));
+   kSchmidtCO2CalcArray(length, REAL(tempC), asReal(k600), REAL(out));
+
+   UNPROTECT(1);
+   return out;
+}
@@ -0,0 +1,11 @@
+#include <R.h>
+#include <Rinternals.h>
+#include "utilities.h"
+
+extern "C"
+{
+   SEXP utilities_densityWaterCalc(SEXP tempC);
+   SEXP utilities_satDoCalc(SEXP tempC, SEXP airPressure, SEXP stdAirPressure);
+   SEXP utilities_kSchmidtDoCalc(SEXP tempC, SEXP k600);
+   SEXP utilities_kSchmidtCO2Calc(SEXP tempC, SEXP k600);
+}